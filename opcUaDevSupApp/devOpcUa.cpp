@@ -27,7 +27,10 @@
 #include <dbEvent.h>
 #include <dbScan.h>
 #include <dbStaticLib.h>
+#include <dbBase.h>
 #include <epicsExport.h>
+#include <epicsString.h>
+#include <epicsAtomic.h>
 #include <initHooks.h>
 #include <devSup.h>
 #include <recSup.h>
@@ -55,12 +58,17 @@
 #include <menuAlarmSevr.h>
 #include <menuAlarmStat.h>
 #include <menuConvert.h>
+#include <menuPriority.h>
 //#define GEN_SIZE_OFFSET
 #include <waveformRecord.h>
 //#undef  GEN_SIZE_OFFSET
 
 #include "drvOpcUa.h"
 #include "devUaClient.h"
+#include "devUaBitWord.h"
+#include "devUaStruct.h"
+#include "devUaAggregate.h"
+#include "devUaOutQueue.h"
 
 using namespace UaClientSdk;
 
@@ -80,6 +88,7 @@ inline int debug_level(dbCommon *prec) {
 
 static  long         read(dbCommon *prec);
 static  long         write(dbCommon *prec,UaVariant &var);
+static  long         writeBit(dbCommon *prec,epicsUInt32 mask,int on);
 static  void         outRecordCallback(CALLBACK *pcallback);
 static  long         get_ioint_info(int cmd, dbCommon *prec, IOSCANPVT * ppvt);
 
@@ -96,6 +105,10 @@ epicsExportAddress(double, drvOpcua_DefaultSamplingInterval);
 epicsExportAddress(int, drvOpcua_DefaultQueueSize);
 epicsExportAddress(int, drvOpcua_DefaultDiscardOldest);
 
+// Decode notifications directly into fixed per item buffers, no UaVariant copies
+static int drvOpcua_DirectDecode = 0;
+epicsExportAddress(int, drvOpcua_DirectDecode);
+
 /*+**************************************************************************
  *		DSET functions
  **************************************************************************-*/
@@ -249,6 +262,45 @@ static void scanInfoItems(const dbCommon *pcommon, OPCUA_ItemINFO *uaItem)
             uaItem->discardOldest = 0;
         }
     }
+    if (dbFindInfo(pdbentry, "opcua:WPRIO") == 0) {
+        const char *prio = dbGetInfoString(pdbentry);
+        if (strncasecmp(prio, "HIGH", 4) == 0)
+            uaItem->writePrio = menuPriorityHIGH;
+        else if (strncasecmp(prio, "MEDIUM", 6) == 0)
+            uaItem->writePrio = menuPriorityMEDIUM;
+        else if (strncasecmp(prio, "LOW", 3) == 0)
+            uaItem->writePrio = menuPriorityLOW;
+        else
+            uaItem->writePrio = atoi(prio);
+        if (uaItem->writePrio < menuPriorityLOW || uaItem->writePrio > menuPriorityHIGH)
+            uaItem->writePrio = menuPriorityLOW;
+    }
+    if (dbFindInfo(pdbentry, "opcua:SHM") == 0) {
+        uaItem->shmPublish = atoi(dbGetInfoString(pdbentry));
+    }
+    if (dbFindInfo(pdbentry, "opcua:TRIGGEREDBY") == 0) {
+        uaItem->triggeredBy = epicsStrDup(dbGetInfoString(pdbentry));
+    }
+    if (dbFindInfo(pdbentry, "opcua:ONDEMAND") == 0) {
+        uaItem->onDemand = atoi(dbGetInfoString(pdbentry));
+    }
+    if (dbFindInfo(pdbentry, "opcua:AGGREGATE") == 0) {
+        uaItem->aggregate = DevUaAggregate::create(dbGetInfoString(pdbentry), pcommon->name);
+        if (uaItem->aggregate)
+            uaItem->aggregate->item = uaItem;
+    }
+    if (dbFindInfo(pdbentry, "opcua:WQUEUE") == 0) {
+        const char *size = dbGetInfoString(pdbentry);
+        const char *policy = (dbFindInfo(pdbentry, "opcua:WPOLICY") == 0) ? dbGetInfoString(pdbentry) : NULL;
+        uaItem->outQueue = DevUaOutQueue::create(size, policy, pcommon->name);
+    }
+    if (dbFindInfo(pdbentry, "opcua:BIT") == 0) {
+        uaItem->bit = atoi(dbGetInfoString(pdbentry));
+        if (uaItem->bit < 0 || uaItem->bit > 31) {
+            errlogPrintf("%s: info(opcua:BIT) must be 0..31, ignored\n", pcommon->name);
+            uaItem->bit = -1;
+        }
+    }
     dbFinishEntry(pdbentry);
 }
 
@@ -293,8 +345,11 @@ long init_common (dbCommon *prec, struct link* plnk, epicsType recType, int inpT
         return status;
     }
 
+    uaItem->prec = prec;    // for the messages of the link parsers
     if(strlen(plnk->value.instio.string) < ITEMPATHLEN) {
         strcpy(uaItem->ItemPath,plnk->value.instio.string);
+        structSplitLink(uaItem);
+        splitIndexRange(uaItem);
     }
     else {
         long status = S_db_badField;
@@ -307,12 +362,15 @@ long init_common (dbCommon *prec, struct link* plnk, epicsType recType, int inpT
     uaItem->stat = OpcUa_BadInvalidState;
     uaItem->flagRdbkOff = 0;
     uaItem->isArray = 0;    // default, set in init_record()
-    uaItem->prec = prec;
     uaItem->debug = (prec->tpro > 1) ? prec->tpro-1 : 0; // to avoid debug for habitual TPRO=1
     uaItem->flagLock = epicsMutexMustCreate();
+    uaItem->latency = latencyFind(((dbRecordType *) prec->rdes)->name, 1);
     uaItem->samplingInterval = drvOpcua_DefaultSamplingInterval;
     uaItem->queueSize = drvOpcua_DefaultQueueSize;
     uaItem->discardOldest = drvOpcua_DefaultDiscardOldest;
+    uaItem->directDecode = drvOpcua_DirectDecode;
+    uaItem->writePrio = (prec->prio <= menuPriorityHIGH) ? prec->prio : menuPriorityLOW;
+    uaItem->bit = -1;
     scanInfoItems(prec, uaItem);
     if(uaItem->debug >= 2)
         errlogPrintf("init_common %s\t PACT= %i\n", prec->name, prec->pact);
@@ -323,9 +381,21 @@ long init_common (dbCommon *prec, struct link* plnk, epicsType recType, int inpT
 
         callbackSetCallback(outRecordCallback, &(uaItem->callback));
         callbackSetUser(prec, &(uaItem->callback));
+        if(uaItem->bit >= 0)
+            bitWordAttach(uaItem);
+        if(uaItem->outQueue && uaItem->bitWord) {   // the bit writes are merged instead
+            errlogPrintf("%s: info(opcua:WQUEUE) ignored for a bit of a word\n", prec->name);
+            delete uaItem->outQueue;
+            uaItem->outQueue = NULL;
+        }
     }
     else {
         scanIoInit(&(uaItem->ioscanpvt));
+        if(uaItem->outQueue) {
+            errlogPrintf("%s: info(opcua:WQUEUE) ignored for an input record\n", prec->name);
+            delete uaItem->outQueue;
+            uaItem->outQueue = NULL;
+        }
     }
 
     if(addOPCUA_Item(uaItem)) {
@@ -337,32 +407,29 @@ long init_common (dbCommon *prec, struct link* plnk, epicsType recType, int inpT
 template<typename T>
 long toOpcuaTypeVariant(OPCUA_ItemINFO* uaItem,UaVariant &var,T VAL)
 {
-    if(!uaItem) {
-        if(uaItem->debug > 0) errlogPrintf("%s illegal *uaItem\n", uaItem->prec->name);
-        return -1;
-    }
-    try {
-        switch((int)uaItem->itemDataType){
-        case OpcUaType_Boolean: var.setBool( (0 != VAL)?true:false); break;
-        case OpcUaType_SByte:   var.setByte(VAL);break;
-        case OpcUaType_Byte:    var.setByte(VAL);break;
-        case OpcUaType_Int16:   var.setInt16(VAL);break;
-        case OpcUaType_UInt16:  var.setUInt16(VAL);break;
-        case OpcUaType_Int32:   var.setInt32( VAL);break;
-        case OpcUaType_Float:   var.setFloat(VAL);break;
-        case OpcUaType_Double:  var.setDouble(VAL);break;
-      //case OpcUaType_String: //won't work: var.SetString needs UaString as argument, but there is no UaString constructor for numbers!
-        default:
-            return 1;
-        }
-    }
-    catch(...) {
-        errlogPrintf("%s: Exception in toOpcuaTypeVariant() val=%f %s",uaItem->prec->name,(double)VAL,variantTypeStrings(uaItem->itemDataType));
+    if(!uaItem->writeConv) {    // no converter for this node data type, e.g. string
+        if(uaItem->debug > 0) errlogPrintf("%s: can't write %s\n", uaItem->prec->name, variantTypeStrings(uaItem->itemDataType));
+        return 1;
     }
-
-    return 0;
+    return uaItem->writeConv(&VAL, var);
 }
 
+/* Get the item value in the record type: Use the compiled converter as long as the
+ * value has the type it was bound to, the generic UaVariant conversion otherwise. */
+#define GET_ITEM_VALUE(EPTYPE, TOFUNC) \
+inline long getItemValue(OPCUA_ItemINFO* uaItem, EPTYPE &val) \
+{ \
+    const OpcUa_Variant *pVal = uaItem->directDecode ? &uaItem->directVal : (const OpcUa_Variant *) uaItem->varVal; \
+    if(uaItem->readConv && pVal->Datatype == uaItem->convType && pVal->ArrayType == OpcUa_VariantArrayType_Scalar) \
+        return uaItem->readConv(*pVal, &val); \
+    if(uaItem->directDecode) \
+        return uaItem->directValue().TOFUNC(val); \
+    return uaItem->varVal.TOFUNC(val); \
+}
+GET_ITEM_VALUE(epicsInt32, toInt32)
+GET_ITEM_VALUE(epicsUInt32, toUInt32)
+GET_ITEM_VALUE(epicsFloat64, toDouble)
+#undef GET_ITEM_VALUE
 
 /***************************************************************************
                                 Longin Support
@@ -380,7 +447,7 @@ long read_longin (struct longinRecord* prec)
     long ret = read((dbCommon*)prec);;
 
     if (!ret) {
-        if(uaItem->varVal.toInt32(prec->val)) {
+        if(getItemValue(uaItem,prec->val)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toInt32 OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
@@ -410,7 +477,7 @@ long write_longout (struct longoutRecord* prec)
     if(uaItem->prec->tpro > 1)
         uaItem->debug = (prec->tpro > 1) ? prec->tpro-1 : 0; // to avoid debug for habitual TPRO=1
     if (uaItem->flagIsRdbk ) {
-        if(uaItem->varVal.toInt32(prec->val)) {
+        if(getItemValue(uaItem,prec->val)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toInt32 OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
@@ -447,7 +514,7 @@ long read_mbbiDirect (struct mbbiDirectRecord* prec)
     epicsMutexLock(uaItem->flagLock);
     if (!ret) {
         epicsUInt32 rval;
-        if(uaItem->varVal.toUInt32(rval)) {
+        if(getItemValue(uaItem,rval)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toUInt32 OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
@@ -483,7 +550,7 @@ long write_mbboDirect (struct mbboDirectRecord* prec)
     if (uaItem->flagIsRdbk) {
 
         epicsUInt32 rval;
-        if(uaItem->varVal.toUInt32(rval)) {
+        if(getItemValue(uaItem,rval)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toUInt32 OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
@@ -526,7 +593,7 @@ long read_mbbi (struct mbbiRecord* prec)
     ret = read((dbCommon*)prec);
     if (!ret) {
         epicsUInt32 rval;
-        if(uaItem->varVal.toUInt32(rval)) {
+        if(getItemValue(uaItem,rval)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toUInt32 OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
@@ -561,7 +628,7 @@ long write_mbbo (struct mbboRecord* prec)
         uaItem->debug = (prec->tpro > 1) ? prec->tpro-1 : 0; // to avoid debug for habitual TPRO=1
     if (uaItem->flagIsRdbk) {
         epicsUInt32 rval;
-        if(uaItem->varVal.toUInt32(rval)) {
+        if(getItemValue(uaItem,rval)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toUInt32 OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
@@ -618,11 +685,12 @@ long read_bi (struct biRecord* prec)
     epicsMutexLock(uaItem->flagLock);
     ret = read((dbCommon*)prec);
     if (!ret) {
-        if(uaItem->varVal.toUInt32(prec->rval)) {
+        if(getItemValue(uaItem,prec->rval)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toUInt32 OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
         else {
+            if(uaItem->bit >= 0) prec->rval &= 1u << uaItem->bit;
             if(prec->rval==0) prec->val = 0;
             else prec->val = 1;
         }
@@ -639,8 +707,11 @@ long read_bi (struct biRecord* prec)
  ***************************************************************************/
 long init_bo( struct boRecord* prec)
 {
-    prec->mask=1;
-    return init_common((dbCommon*)prec,&(prec->out),epicsUInt32T,epicsUInt32T);
+    long ret = init_common((dbCommon*)prec,&(prec->out),epicsUInt32T,epicsUInt32T);
+    OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
+
+    prec->mask = (!ret && uaItem->bit >= 0) ? 1u << uaItem->bit : 1;
+    return ret;
 }
 
 long write_bo (struct boRecord* prec)
@@ -653,16 +724,20 @@ long write_bo (struct boRecord* prec)
     if(uaItem->prec->tpro > 1)
         uaItem->debug = (prec->tpro > 1) ? prec->tpro-1 : 0; // to avoid debug for habitual TPRO=1
     if (uaItem->flagIsRdbk) {
-        if(uaItem->varVal.toUInt32(prec->rval)) {
+        if(getItemValue(uaItem,prec->rval)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toUInt32 OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
         else {
+            if(uaItem->bit >= 0) prec->rval &= prec->mask;
             if(prec->rval==0) prec->val = 0;
             else prec->val = 1;
             prec->udf = FALSE;
         }
     }
+    else if(uaItem->bitWord) {
+        ret = writeBit((dbCommon*)prec, prec->mask, prec->val != 0);
+    }
     else {
         ret = toOpcuaTypeVariant(uaItem,var,(prec->rval & prec->mask));
         if( !ret)
@@ -695,7 +770,7 @@ long write_ao (struct aoRecord* prec)
         uaItem->debug = (prec->tpro > 1) ? prec->tpro-1 : 0; // to avoid debug for habitual TPRO=1
     if (uaItem->flagIsRdbk) {
         if(DEBUG_LEVEL>2) errlogPrintf("write_ao READ flagIsRdbk:%d\n",uaItem->flagIsRdbk);
-        if(uaItem->varVal.toDouble(value)) {
+        if(getItemValue(uaItem,value)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toDouble OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
@@ -788,7 +863,7 @@ long read_ai (struct aiRecord* prec)
     epicsMutexLock(uaItem->flagLock);
     ret = read((dbCommon*)prec);
     if (!ret) {
-        if(uaItem->varVal.toDouble(value)) {
+        if(getItemValue(uaItem,value)) {
             if(uaItem->debug) errlogPrintf("%s: conversion toDouble OutOfRange\n",uaItem->prec->name);
             ret = 1;
         }
@@ -809,7 +884,7 @@ long read_ai (struct aiRecord* prec)
                 // ASLO/AOFF conversion
                 if (prec->eslo != 0.0) value *= prec->eslo;
                 value += prec->eoff;
-                if(DEBUG_LEVEL>= 2) errlogPrintf("ai          %s %s\tbuf:%s VAL:%f\n", getTime(buf),(uaItem->varVal).toString().toUtf8(),prec->name,prec->val);
+                if(DEBUG_LEVEL>= 2) errlogPrintf("ai          %s %s\tbuf:%s VAL:%f\n", getTime(buf),uaItem->valueToString().toUtf8(),prec->name,prec->val);
                 break;
             default: // must use breakpoint table
                 if (cvtRawToEngBpt(&value,prec->linr,prec->init,(void **)&(prec->pbrk),&prec->lbrk) != 0) {
@@ -850,7 +925,10 @@ long read_stringin (struct stringinRecord* prec)
     epicsMutexLock(uaItem->flagLock);
     ret = read((dbCommon*)prec);
     if( !ret ) {
-        strncpy(prec->val,uaItem->varVal.toString().toUtf8(),40);    // string length: see stringinRecord.h
+        if(uaItem->directDecode)
+            strncpy(prec->val,uaItem->strVal,40);
+        else
+            strncpy(prec->val,uaItem->varVal.toString().toUtf8(),40);    // string length: see stringinRecord.h
         prec->udf = FALSE;	// stringinRecord process doesn't set udf field in case of no convert!
     }
     epicsMutexUnlock(uaItem->flagLock);
@@ -880,7 +958,10 @@ long write_stringout (struct stringoutRecord* prec)
         if( uaItem->itemDataType != OpcUaType_String )
             ret = 1;
         else {
-            strncpy(prec->val,uaItem->varVal.toString().toUtf8(),40);    // string length: see stringinRecord.h
+            if(uaItem->directDecode)
+                strncpy(prec->val,uaItem->strVal,40);
+            else
+                strncpy(prec->val,uaItem->varVal.toString().toUtf8(),40);    // string length: see stringinRecord.h
             //FIXME: do not hardcode length - if no longer hardcoded in recordd
             prec->udf = FALSE;
         }
@@ -921,6 +1002,14 @@ long init_waveformRecord(struct waveformRecord* prec)
     if(uaItem != NULL) {
         uaItem->isArray = 1;
         uaItem->arraySize = prec->nelm;
+        if(uaItem->directDecode && recType != epicsOldStringT) {
+            uaItem->arrElemSize = dbValueSize(prec->ftvl);
+            uaItem->arrBuf = calloc(prec->nelm, uaItem->arrElemSize);
+            if(!uaItem->arrBuf) {
+                recGblRecordError(S_db_noMemory, prec, "devOpcUa (init_record) Out of memory, calloc() failed");
+                return S_db_noMemory;
+            }
+        }
     }
     return  ret;
 }
@@ -931,8 +1020,23 @@ long read_wf(struct waveformRecord *prec)
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
     epicsMutexLock(uaItem->flagLock);
     long ret = read((dbCommon*)prec);
-    if(ret)
+    if(ret) {
+        epicsMutexUnlock(uaItem->flagLock);
+        return ret;
+    }
+    if(uaItem->directDecode) {
+        if(uaItem->arrBuf && uaItem->directVal.ArrayType == OpcUa_VariantArrayType_Array) {
+            memcpy(prec->bptr, uaItem->arrBuf, uaItem->arrLen * dbValueSize(prec->ftvl));
+            prec->nord = uaItem->arrLen;
+            prec->udf = FALSE;
+        }
+        else
+            ret = 1;
+        epicsMutexUnlock(uaItem->flagLock);
+        if(ret)
+            recGblSetSevr(prec,menuAlarmStatREAD,menuAlarmSevrINVALID);
         return ret;
+    }
     prec->nord = uaItem->arraySize;
     uaItem->arraySize = prec->nelm; //FIXME: Is that really useful at every processing? NELM never changes.
     prec->udf=FALSE;
@@ -982,12 +1086,12 @@ long read_wf(struct waveformRecord *prec)
                     break;
                 default:
                     if(uaItem->debug >= 2) errlogPrintf("%s setRecVal(): Can't convert array data type\n",uaItem->prec->name);
-                    return 1;
+                    ret = 1;
                 }
             }
             else {
                 if(uaItem->debug >= 2) errlogPrintf("%s setRecVal() Error record arraysize %d < OpcItem Size %d\n", uaItem->prec->name,val.arraySize(),uaItem->arraySize);
-                return 1;
+                ret = 1;
             }
         }      // end array
     }
@@ -1020,15 +1124,26 @@ static void outRecordCallback(CALLBACK *pcallback) {
 
     dbScanLock(prec);
     if(prec->pact == TRUE) {        // waiting for async write operation to be finished. Try again later
-        if(DEBUG_LEVEL >= 3) errlogPrintf("write Callb:  %s %s PACT:%d varVal:%s uaItem->stat:%#8x, RdbkOff:%d, IsRdbk:%d\n", getTime(buf),prec->name,prec->pact,uaItem->varVal.toString().toUtf8(),uaItem->stat,uaItem->flagRdbkOff,uaItem->flagIsRdbk);
+        if(DEBUG_LEVEL >= 3) errlogPrintf("write Callb:  %s %s PACT:%d varVal:%s uaItem->stat:%#8x, RdbkOff:%d, IsRdbk:%d\n", getTime(buf),prec->name,prec->pact,uaItem->valueToString().toUtf8(),uaItem->stat,uaItem->flagRdbkOff,uaItem->flagIsRdbk);
         procFunc(prec);
     }
+    else if(uaItem->outQueue && uaItem->outQueue->busy()) {
+        // the record has written again since, a readback would show an older value
+    }
     else {
+        if(uaItem->outQueue && uaItem->outQueue->takeFailed())
+            recGblSetSevr(prec, menuAlarmStatWRITE, menuAlarmSevrINVALID);
         uaItem->flagIsRdbk = 1;
         prec->udf=FALSE;
-        if(DEBUG_LEVEL >= 3) errlogPrintf("rdbk Callb:  %s %s PACT:%d varVal:%s uaItem->stat:%d, RdbkOff:%d, IsRdbk:%d\n", getTime(buf),prec->name,prec->pact,uaItem->varVal.toString().toUtf8(),uaItem->stat,uaItem->flagRdbkOff,uaItem->flagIsRdbk);
+        UA_TRACE("readback", prec->name, uaItem->itemIdx, uaItem->stat);
+        if(DEBUG_LEVEL >= 3) errlogPrintf("rdbk Callb:  %s %s PACT:%d varVal:%s uaItem->stat:%d, RdbkOff:%d, IsRdbk:%d\n", getTime(buf),prec->name,prec->pact,uaItem->valueToString().toUtf8(),uaItem->stat,uaItem->flagRdbkOff,uaItem->flagIsRdbk);
         dbProcess(prec);
         uaItem->flagIsRdbk = 0;
+        if(uaItem->rcvTicks) {
+            if(uaItem->latency)
+                uaItem->latency->rcvToProc.add(((int64_t) (uaTicksNow() - uaItem->rcvTicks)) / 10);
+            uaItem->rcvTicks = 0;
+        }
     }
     dbScanUnlock(prec);
 }
@@ -1053,15 +1168,28 @@ static long read(dbCommon * prec) {
                 return 1;
             }
             uaItem->debug = (prec->tpro > 1) ? prec->tpro-1 : 0; // to avoid debug for habitual TPRO=1
+            UA_TRACE("read", prec->name, uaItem->itemIdx, uaItem->stat);
 
             if(OpcUa_IsNotGood(uaItem->stat))
                 ret = 1; // something failed
+            if(uaItem->rcvTicks) {
+                if(uaItem->latency)
+                    uaItem->latency->rcvToProc.add(((int64_t) (uaTicksNow() - uaItem->rcvTicks)) / 10);
+                uaItem->rcvTicks = 0;
+            }
+            if(uaItem->onDemand && !uaItem->triggeredBy) {
+                // processed by a scan or a DB link: a reader, see DevUaClient::scanInterest()
+                const OPCUA_ItemINFO *owner = uaItem->sharedPrimary ? uaItem->sharedPrimary : uaItem;
+                epicsAtomicSetIntT(&uaItem->readInterest, 1);
+                if(owner->monitoringMode != OpcUa_MonitoringMode_Reporting)
+                    recGblSetSevr(prec, menuAlarmStatUDF, menuAlarmSevrINVALID);   // last value, may be stale
+            }
 
             if(!ret)
                 prec->udf=FALSE;
     }
     catch(...) {
-        errlogPrintf("%s: Exception in devOpcUa read() val=%s %s",prec->name,uaItem->varVal.toString().toUtf8(),variantTypeStrings(uaItem->itemDataType));
+        errlogPrintf("%s: Exception in devOpcUa read() val=%s %s",prec->name,uaItem->valueToString().toUtf8(),variantTypeStrings(uaItem->itemDataType));
         ret = 1;
     }
     if(ret) {
@@ -1074,6 +1202,10 @@ static long read(dbCommon * prec) {
 static long write(dbCommon *prec,UaVariant &var) {
     long ret = 0;
     OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
+    if(uaItem->outQueue && !uaItem->member) {   // no PACT, the write completes in the queue
+        if(DEBUG_LEVEL > 2) errlogPrintf("%s: write QUEUED\n",prec->name);
+        return uaItem->outQueue->put(uaItem, var);
+    }
     if(!prec->pact) {
         prec->pact = TRUE;
         try {
@@ -1097,3 +1229,16 @@ static long write(dbCommon *prec,UaVariant &var) {
     return ret;
 }
 
+// Bit of a word node: the write is merged with the other bits of the word, see devUaBitWord.h
+static long writeBit(dbCommon *prec,epicsUInt32 mask,int on) {
+    OPCUA_ItemINFO* uaItem = (OPCUA_ItemINFO*)prec->dpvt;
+    if(!prec->pact) {
+        prec->pact = TRUE;
+        if(DEBUG_LEVEL > 2) errlogPrintf("%s: write bit BEGIN\n",prec->name);
+        return uaItem->bitWord->write(uaItem, mask, on);
+    }
+    if(DEBUG_LEVEL > 2) errlogPrintf("%s: write bit DONE stat:%d\n",prec->name,uaItem->stat);
+    if(uaItem->stat) return 1; // 1 if writeComplete failed
+    return 0;
+}
+
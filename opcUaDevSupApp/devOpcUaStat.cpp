@@ -0,0 +1,264 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+/* Device support "OPCUA Stat": Show driver parameters of an OPCUA record as ai record.
+ *
+ *   record(ai, "$(P)sampling") {
+ *       field(DTYP, "OPCUA Stat")
+ *       field(INP,  "@$(P)myOpcRecord RSAMPLING")
+ *       field(SCAN, "10 second")
+ *   }
+ *
+ * Device support "OPCUA Latency": Latency histogram as waveform record, see devUaLatency.h.
+ * The name is a record type or a subscription as shown by opcuaStat, HIST is SRV
+ * (server->receive), PROC (receive->processed) or BOUNDS (lower bucket bounds in us).
+ *
+ *   record(waveform, "$(P)aiLatency") {
+ *       field(DTYP, "OPCUA Latency")
+ *       field(INP,  "@ai PROC")
+ *       field(FTVL, "DOUBLE")
+ *       field(NELM, "240")
+ *       field(SCAN, "10 second")
+ *   }
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dbDefs.h>
+#include <dbAccess.h>
+#include <epicsExport.h>
+#include <devSup.h>
+#include <recSup.h>
+#include <recGbl.h>
+#include <alarm.h>
+#include <aiRecord.h>
+#include <waveformRecord.h>
+#include <menuFtype.h>
+
+#include "drvOpcUa.h"
+#include "devUaClient.h"
+
+typedef enum {
+    statSampling,       // requested sampling interval, ms
+    statRevSampling,    // sampling interval revised by the server, ms
+    statQueueSize,      // requested queue size
+    statRevQueueSize,   // queue size revised by the server
+    statStatus,         // OPC UA status code of the item
+    statPublishing,     // publishing interval of the items subscription, ms
+    statConnState,      // OpcUaConnState: 0=none, 1=monitored, 2=failed and retried, 3=bad link
+    statRetries         // failed setup attempts since the last success
+} OpcUaStatParam;
+
+static const struct {
+    const char *name;
+    OpcUaStatParam param;
+} statParams[] = {
+    { "SAMPLING",   statSampling },
+    { "RSAMPLING",  statRevSampling },
+    { "QSIZE",      statQueueSize },
+    { "RQSIZE",     statRevQueueSize },
+    { "STAT",       statStatus },
+    { "PUBLISHING", statPublishing },
+    { "CONN",       statConnState },
+    { "RETRIES",    statRetries }
+};
+
+struct OpcUaStatPvt {
+    char recName[PVNAME_STRINGSZ];
+    OpcUaStatParam param;
+    OPCUA_ItemINFO *uaItem;     // resolved at first read, the record may be initialized after this one
+};
+
+// Find the item of an OPCUA record by record name
+static OPCUA_ItemINFO *findItem(const char *name)
+{
+    if(!pMyClient)
+        return NULL;
+    for(unsigned int i=0; i<pMyClient->vUaItemInfo.size(); i++) {
+        if(pMyClient->vUaItemInfo[i] && !strcmp(pMyClient->vUaItemInfo[i]->prec->name, name))
+            return pMyClient->vUaItemInfo[i];
+    }
+    return NULL;
+}
+
+static long init_ai_stat(aiRecord *prec)
+{
+    char param[32];
+    unsigned int i;
+    OpcUaStatPvt *pvt;
+
+    if(prec->inp.type != INST_IO) {
+        recGblRecordError(S_db_badField, prec, "devOpcUaStat (init_record) Illegal INP field");
+        return S_db_badField;
+    }
+    pvt = (OpcUaStatPvt *) calloc(1, sizeof(OpcUaStatPvt));
+    if(!pvt) {
+        recGblRecordError(S_db_noMemory, prec, "devOpcUaStat (init_record) Out of memory, calloc() failed");
+        return S_db_noMemory;
+    }
+    if(sscanf(prec->inp.value.instio.string, "%60s %31s", pvt->recName, param) != 2) {
+        recGblRecordError(S_db_badField, prec, "devOpcUaStat (init_record) INP must be '@record PARAM'");
+        free(pvt);
+        return S_db_badField;
+    }
+    for(i=0; i<sizeof(statParams)/sizeof(statParams[0]); i++) {
+        if(!strcmp(param, statParams[i].name))
+            break;
+    }
+    if(i == sizeof(statParams)/sizeof(statParams[0])) {
+        recGblRecordError(S_db_badField, prec, "devOpcUaStat (init_record) unknown parameter");
+        free(pvt);
+        return S_db_badField;
+    }
+    pvt->param = statParams[i].param;
+    prec->dpvt = pvt;
+    return 0;
+}
+
+static long read_ai_stat(aiRecord *prec)
+{
+    OpcUaStatPvt *pvt = (OpcUaStatPvt *) prec->dpvt;
+    OPCUA_ItemINFO *uaItem;
+
+    if(!pvt)
+        return 2;
+    if(!pvt->uaItem)
+        pvt->uaItem = findItem(pvt->recName);
+    uaItem = pvt->uaItem;
+    if(!uaItem) {
+        recGblSetSevr(prec, READ_ALARM, INVALID_ALARM);
+        return 2;
+    }
+    switch(pvt->param) {
+    case statSampling:      prec->val = uaItem->samplingInterval; break;
+    case statRevSampling:   prec->val = uaItem->revisedSamplingInterval; break;
+    case statQueueSize:     prec->val = uaItem->queueSize; break;
+    case statRevQueueSize:  prec->val = uaItem->revisedQueueSize; break;
+    case statStatus:        prec->val = uaItem->stat; break;
+    case statPublishing:    prec->val = uaItem->subscription ? uaItem->subscription->publishingInterval : 0.0; break;
+    case statConnState:     prec->val = uaItem->connState; break;
+    case statRetries:       prec->val = uaItem->nRetries; break;
+    }
+    if(!uaItem->subscription && pvt->param != statSampling && pvt->param != statQueueSize
+            && pvt->param != statConnState && pvt->param != statRetries)
+        recGblSetSevr(prec, READ_ALARM, INVALID_ALARM);
+    prec->udf = FALSE;
+    return 2;   // don't convert
+}
+
+typedef enum { histSrv, histProc, histBounds } OpcUaHistParam;
+
+struct OpcUaLatencyPvt {
+    char name[40];
+    OpcUaHistParam param;
+    DevUaLatency *latency;      // resolved at first read, subscriptions are created after iocInit
+};
+
+static long init_wf_latency(waveformRecord *prec)
+{
+    char param[32];
+    OpcUaLatencyPvt *pvt;
+    const char *inp, *sep;
+
+    if(prec->inp.type != INST_IO) {
+        recGblRecordError(S_db_badField, prec, "devOpcUaStat (init_record) Illegal INP field");
+        return S_db_badField;
+    }
+    if(prec->ftvl != menuFtypeDOUBLE) {
+        recGblRecordError(S_db_badField, prec, "devOpcUaStat (init_record) FTVL must be DOUBLE");
+        return S_db_badField;
+    }
+    pvt = (OpcUaLatencyPvt *) calloc(1, sizeof(OpcUaLatencyPvt));
+    if(!pvt) {
+        recGblRecordError(S_db_noMemory, prec, "devOpcUaStat (init_record) Out of memory, calloc() failed");
+        return S_db_noMemory;
+    }
+    // name may contain blanks, e.g. "subscription 1000ms": the last word is the parameter
+    inp = prec->inp.value.instio.string;
+    sep = strrchr(inp, ' ');
+    if(!sep || sep == inp || (size_t)(sep - inp) >= sizeof(pvt->name) || sscanf(sep+1, "%31s", param) != 1) {
+        recGblRecordError(S_db_badField, prec, "devOpcUaStat (init_record) INP must be '@name HIST'");
+        free(pvt);
+        return S_db_badField;
+    }
+    strncpy(pvt->name, inp, sep - inp);
+    if(!strcmp(param, "SRV"))           pvt->param = histSrv;
+    else if(!strcmp(param, "PROC"))     pvt->param = histProc;
+    else if(!strcmp(param, "BOUNDS"))   pvt->param = histBounds;
+    else {
+        recGblRecordError(S_db_badField, prec, "devOpcUaStat (init_record) unknown histogram");
+        free(pvt);
+        return S_db_badField;
+    }
+    prec->dpvt = pvt;
+    return 0;
+}
+
+static long read_wf_latency(waveformRecord *prec)
+{
+    OpcUaLatencyPvt *pvt = (OpcUaLatencyPvt *) prec->dpvt;
+    double *pval = (double *) prec->bptr;
+    epicsUInt32 i, n = (prec->nelm < OPCUA_LAT_BUCKETS) ? prec->nelm : OPCUA_LAT_BUCKETS;
+
+    if(!pvt)
+        return 0;
+    if(pvt->param == histBounds) {
+        for(i=0; i<n; i++)
+            pval[i] = DevUaLatencyHist::bucketLow(i);
+        prec->nord = n;
+        prec->udf = FALSE;
+        return 0;
+    }
+    if(!pvt->latency)
+        pvt->latency = latencyFind(pvt->name, 0);
+    if(!pvt->latency) {
+        recGblSetSevr(prec, READ_ALARM, INVALID_ALARM);
+        return 0;
+    }
+    const DevUaLatencyHist &h = (pvt->param == histSrv) ? pvt->latency->srvToRcv : pvt->latency->rcvToProc;
+    for(i=0; i<n; i++)
+        pval[i] = h.count[i];
+    prec->nord = n;
+    prec->udf = FALSE;
+    return 0;
+}
+
+extern "C" {
+struct {
+    long        number;
+    DEVSUPFUN   dev_report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   read_ai;
+    DEVSUPFUN   special_linconv;
+} devaiOpcUaStat = {6, NULL, NULL, (DEVSUPFUN)init_ai_stat, NULL, (DEVSUPFUN)read_ai_stat, NULL };
+epicsExportAddress(dset,devaiOpcUaStat);
+
+struct {
+    long        number;
+    DEVSUPFUN   dev_report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   read_wf;
+} devwaveformOpcUaLatency = {5, NULL, NULL, (DEVSUPFUN)init_wf_latency, NULL, (DEVSUPFUN)read_wf_latency };
+epicsExportAddress(dset,devwaveformOpcUaLatency);
+}
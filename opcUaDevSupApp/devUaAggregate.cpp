@@ -0,0 +1,237 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <errlog.h>
+#include <epicsString.h>
+
+#include "devUaAggregate.h"
+#include "devUaSubscription.h"
+
+static const struct {
+    const char *name;
+    DevUaAggregate::Function function;
+    OpcUa_UInt32 nodeId;
+} functions[] = {
+    { "Average", DevUaAggregate::aggAverage, OpcUaId_AggregateFunction_Average },
+    { "Minimum", DevUaAggregate::aggMinimum, OpcUaId_AggregateFunction_Minimum },
+    { "Maximum", DevUaAggregate::aggMaximum, OpcUaId_AggregateFunction_Maximum },
+    { "Count",   DevUaAggregate::aggCount,   OpcUaId_AggregateFunction_Count },
+    { "Total",   DevUaAggregate::aggTotal,   OpcUaId_AggregateFunction_Total },
+    { "Range",   DevUaAggregate::aggRange,   OpcUaId_AggregateFunction_Range },
+    { "Start",   DevUaAggregate::aggStart,   OpcUaId_AggregateFunction_Start },
+    { "End",     DevUaAggregate::aggEnd,     OpcUaId_AggregateFunction_End }
+};
+#define N_FUNCTIONS (sizeof(functions)/sizeof(functions[0]))
+
+DevUaAggregate::DevUaAggregate(Function function, double interval)
+    : function(function)
+    , interval(interval)
+    , revisedInterval(0.0)
+    , local(0)
+    , item(NULL)
+    , intervalStart(0)
+    , haveLast(0)
+    , intervalEnd(0)
+    , count(0)
+    , sum(0.0)
+    , min(0.0)
+    , max(0.0)
+    , first(0.0)
+    , last(0.0)
+{
+    static epicsTimerQueueActive &queue = epicsTimerQueueActive::allocate(true);
+    timer = &queue.createTimer();
+}
+
+DevUaAggregate::~DevUaAggregate()
+{
+    timer->destroy();
+}
+
+DevUaAggregate *DevUaAggregate::create(const char *spec, const char *recName)
+{
+    char name[20];
+    double interval;
+
+    if(sscanf(spec, " %19[^, ] , %lf", name, &interval) != 2 || interval <= 0.0) {
+        errlogPrintf("%s: info(opcua:AGGREGATE) must be 'Function,interval[ms]', ignored\n", recName);
+        return NULL;
+    }
+    for(size_t i=0; i<N_FUNCTIONS; i++) {
+        if(!epicsStrCaseCmp(name, functions[i].name))
+            return new DevUaAggregate(functions[i].function, interval);
+    }
+    errlogPrintf("%s: unknown aggregate '%s', ignored\n", recName, name);
+    return NULL;
+}
+
+const char *DevUaAggregate::name() const
+{
+    return functions[function].name;
+}
+
+bool DevUaAggregate::notSupported(OpcUa_StatusCode status)
+{
+    switch(status) {
+    case OpcUa_BadAggregateNotSupported:
+    case OpcUa_BadAggregateListMismatch:
+    case OpcUa_BadMonitoredItemFilterUnsupported:
+    case OpcUa_BadFilterNotAllowed:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void DevUaAggregate::setFilter(OpcUa_ExtensionObject &filter) const
+{
+    OpcUa_AggregateFilter *pFilter = NULL;
+
+    if(OpcUa_IsBad(OpcUa_EncodeableObject_CreateExtension(&OpcUa_AggregateFilter_EncodeableType, &filter, (OpcUa_Void **) &pFilter)))
+        return;
+    UaDateTime::now().copyTo(&pFilter->StartTime);
+    UaNodeId(functions[function].nodeId).copyTo(&pFilter->AggregateType);
+    pFilter->ProcessingInterval = interval;
+    pFilter->AggregateConfiguration.UseServerCapabilitiesDefaults = OpcUa_True;
+}
+
+void DevUaAggregate::setFilterResult(const OpcUa_ExtensionObject &result)
+{
+    revisedInterval = interval;
+    if(result.Encoding == OpcUa_ExtensionObjectEncoding_EncodeableObject
+            && result.Body.EncodeableObject.Type == &OpcUa_AggregateFilterResult_EncodeableType
+            && result.Body.EncodeableObject.Object)
+        revisedInterval = ((OpcUa_AggregateFilterResult *) result.Body.EncodeableObject.Object)->RevisedProcessingInterval;
+}
+
+// Close the open interval, the next one starts at its end
+int DevUaAggregate::close(OpcUa_Variant &out)
+{
+    uint64_t ivTicks = (uint64_t) (interval * 10000.0);     // ms -> 100ns
+
+    if(!count && !haveLast)
+        return 0;
+    OpcUa_Variant_Initialize(&out);
+    out.Datatype = OpcUaType_Double;
+    if(count) {
+        switch(function) {
+        case aggAverage: out.Value.Double = sum / count; break;
+        case aggMinimum: out.Value.Double = min; break;
+        case aggMaximum: out.Value.Double = max; break;
+        case aggTotal:   out.Value.Double = sum; break;
+        case aggRange:   out.Value.Double = max - min; break;
+        case aggStart:   out.Value.Double = first; break;
+        case aggEnd:     out.Value.Double = last; break;
+        case aggCount:   break;
+        }
+    }
+    else {  // no samples: the value didn't change
+        switch(function) {
+        case aggTotal:
+        case aggRange:   out.Value.Double = 0.0; break;
+        case aggCount:   break;
+        default:         out.Value.Double = last; break;
+        }
+    }
+    if(function == aggCount) {
+        out.Datatype = OpcUaType_UInt32;
+        out.Value.UInt32 = count;
+    }
+    count = 0;
+    intervalStart = intervalEnd;
+    intervalEnd += ivTicks;
+    return 1;
+}
+
+// s until the open interval is closed, samples may arrive one publishing interval late
+double DevUaAggregate::delay() const
+{
+    double grace = (item && item->subscription) ? item->subscription->publishingInterval / 1000.0 : 0.0;
+    uint64_t now = uaTicksNow();
+    double d = (intervalEnd > now) ? (intervalEnd - now) / 1e7 : 0.0;
+    return d + grace;
+}
+
+// Close the interval and process the record with its aggregate
+epicsTimerNotify::expireStatus DevUaAggregate::expire(const epicsTime &/*currentTime*/)
+{
+    OpcUa_DataValue dv;
+    DevUaSubscription *sub;
+    int done = 0;
+    double next = 0.0;
+
+    if(!item)
+        return expireStatus(noRestart);
+    OpcUa_DataValue_Initialize(&dv);
+    epicsMutexLock(item->flagLock);
+    sub = item->subscription;
+    if(sub && local) {
+        if(uaTicksNow() >= intervalEnd) {   // not closed by a sample of the next interval
+            done = close(dv.Value);
+            dv.StatusCode = OpcUa_Good;
+            dv.SourceTimestamp.dwLowDateTime  = (OpcUa_UInt32) intervalStart;
+            dv.SourceTimestamp.dwHighDateTime = (OpcUa_UInt32) (intervalStart >> 32);
+            dv.ServerTimestamp = dv.SourceTimestamp;
+        }
+        if(haveLast)
+            next = delay();
+    }
+    epicsMutexUnlock(item->flagLock);
+    if(done)
+        sub->itemDataChange(item, dv, 0, true);
+    if(next > 0.0)
+        return expireStatus(restart, next);
+    return expireStatus(noRestart);
+}
+
+int DevUaAggregate::add(const OpcUa_Variant &v, const OpcUa_DataValue &dv, OpcUa_Variant &out)
+{
+    uint64_t ticks = uaTicks(dv.SourceTimestamp);
+    uint64_t ivTicks = (uint64_t) (interval * 10000.0);     // ms -> 100ns
+    double val;
+    int done = 0;
+
+    if(!ticks)
+        ticks = uaTicks(dv.ServerTimestamp);
+    if(!ticks)
+        ticks = uaTicksNow();
+    if(intervalEnd && ticks >= intervalEnd)     // the timer didn't close the interval yet
+        done = close(out);
+    if(!OpcUa_IsGood(dv.StatusCode) || v.ArrayType != OpcUa_VariantArrayType_Scalar
+            || OpcUa_IsBad(UaVariant(v).toDouble(val)))
+        return done;
+    if(ticks >= intervalEnd) {  // first interval or after a gap
+        intervalEnd = (ivTicks > 0) ? (ticks / ivTicks + 1) * ivTicks : ticks;
+        intervalStart = intervalEnd - ivTicks;
+        timer->start(*this, delay());
+    }
+    if(!count) {
+        sum = 0.0;
+        min = max = first = val;
+    }
+    count++;
+    sum += val;
+    if(val < min) min = val;
+    if(val > max) max = val;
+    last = val;
+    haveLast = 1;
+    return done;
+}
@@ -0,0 +1,81 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUAAGGREGATE_H
+#define DEVUAAGGREGATE_H
+
+#include <epicsTimer.h>
+#include "drvOpcUa.h"
+
+/* Aggregates: A record with an info item like info(opcua:AGGREGATE, "Average,1000")
+ * gets the aggregate of its node over processing intervals of 1000 ms instead of every
+ * sample. The monitored item is created with an AggregateFilter. If the server rejects
+ * the filter, the item is monitored unfiltered and the same aggregate is computed by
+ * the driver over intervals aligned to the source timestamps. A timer closes each
+ * interval at its end plus one publishing interval for samples still on the way, so the
+ * record is processed once per interval. Like on the server, an interval without new
+ * samples continues the last value.
+ */
+class DevUaAggregate : public epicsTimerNotify
+{
+public:
+    enum Function { aggAverage, aggMinimum, aggMaximum, aggCount, aggTotal, aggRange, aggStart, aggEnd };
+
+    // Parse "Function,interval[ms]", NULL on error
+    static DevUaAggregate *create(const char *spec, const char *recName);
+    virtual ~DevUaAggregate();
+
+    const char *name() const;
+    // build the AggregateFilter of a monitored item
+    void setFilter(OpcUa_ExtensionObject &filter) const;
+    // take the revised processing interval from the result of createMonitoredItems
+    void setFilterResult(const OpcUa_ExtensionObject &result);
+    // status of createMonitoredItems that means the server doesn't aggregate
+    static bool notSupported(OpcUa_StatusCode status);
+
+    /* Local aggregation: add a sample of the value v with the timestamps of dv, call
+     * with flagLock of the item held. Return 1 and the aggregate of the completed
+     * interval in out, 0 if the interval is still open. */
+    int add(const OpcUa_Variant &v, const OpcUa_DataValue &dv, OpcUa_Variant &out);
+
+    Function function;
+    double interval;            // ms, requested processing interval
+    double revisedInterval;     // ms, as revised by the server, 0 if computed locally
+    int local;                  // server doesn't support the aggregate, computed here
+    OPCUA_ItemINFO *item;       // the item of the aggregate
+
+private:
+    DevUaAggregate(Function function, double interval);
+    // close the open interval: the aggregate in out, return 0 if there is no value yet
+    int close(OpcUa_Variant &out);
+    double delay() const;
+    virtual expireStatus expire(const epicsTime &currentTime);
+
+    epicsTimer *timer;          // closes the intervals
+    uint64_t intervalStart;     // 100ns ticks, start of the open interval
+    int haveLast;               // a sample was seen, intervals without samples continue it
+
+    uint64_t intervalEnd;       // 100ns ticks, end of the open interval
+    epicsUInt32 count;          // good samples in the open interval
+    double sum;
+    double min;
+    double max;
+    double first;
+    double last;
+};
+
+#endif // DEVUAAGGREGATE_H
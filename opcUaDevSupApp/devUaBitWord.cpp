@@ -0,0 +1,222 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <map>
+
+#include <epicsExport.h>
+#include <errlog.h>
+#include <callback.h>
+
+#include "devUaBitWord.h"
+
+// s, bo bit writes within this time after the first are merged into one write, 0 = send at once
+static double drvOpcua_BitWriteWindow = 0.0;
+
+extern "C" {
+    epicsExportAddress(double, drvOpcua_BitWriteWindow);
+}
+
+// s, a written bit overrides the monitored word until a data change shows it, at most this long
+#define BIT_PENDING_TIMEOUT 2.0
+
+typedef std::map<std::string, DevUaBitWord *> BitWordMap;
+static BitWordMap bitWords;
+static epicsMutexId bitWordsLock = epicsMutexMustCreate();
+
+void bitWordAttach(OPCUA_ItemINFO *uaItem)
+{
+    epicsMutexLock(bitWordsLock);
+    BitWordMap::iterator it = bitWords.find(uaItem->ItemPath);
+    if(it == bitWords.end())
+        it = bitWords.insert(BitWordMap::value_type(uaItem->ItemPath, new DevUaBitWord(uaItem->ItemPath))).first;
+    uaItem->bitWord = it->second;
+    epicsMutexUnlock(bitWordsLock);
+}
+
+void bitWordReport(int verb)
+{
+    epicsMutexLock(bitWordsLock);
+    if(!bitWords.empty()) {
+        errlogPrintf("Bit words: %lu, merge window %.3f s\n", (unsigned long) bitWords.size(), drvOpcua_BitWriteWindow);
+        if(verb > 0) {
+            for(BitWordMap::iterator it=bitWords.begin(); it!=bitWords.end(); ++it)
+                it->second->report(verb);
+        }
+    }
+    epicsMutexUnlock(bitWordsLock);
+}
+
+// The words live as long as the IOC, like the items
+DevUaBitWord::DevUaBitWord(const char *path)
+    : path(path)
+    , lock(epicsMutexMustCreate())
+    , timerActive(false)
+    , setMask(0)
+    , clrMask(0)
+    , carrier(NULL)
+    , pendMask(0)
+    , pendVal(0)
+    , sentMask(0)
+    , nRequests(0)
+    , nWrites(0)
+    , nFailed(0)
+{
+    static epicsTimerQueueActive &queue = epicsTimerQueueActive::allocate(true);
+    timer = &queue.createTimer();
+}
+
+DevUaBitWord::~DevUaBitWord()
+{
+    timer->destroy();
+    epicsMutexDestroy(lock);
+}
+
+long DevUaBitWord::write(OPCUA_ItemINFO *uaItem, epicsUInt32 mask, int on)
+{
+    bool send = false;
+
+    epicsMutexLock(lock);
+    if(on) {
+        setMask |= mask;
+        clrMask &= ~mask;
+    }
+    else {
+        clrMask |= mask;
+        setMask &= ~mask;
+    }
+    waiting.push_back(uaItem);
+    nRequests++;
+    if(!carrier && !timerActive) {
+        if(drvOpcua_BitWriteWindow > 0.0) {
+            timerActive = true;
+            timer->start(*this, drvOpcua_BitWriteWindow);
+        }
+        else
+            send = true;
+    }
+    epicsMutexUnlock(lock);
+    if(uaItem->debug >= 2)
+        errlogPrintf("%s: bit request %#x=%d on '%s'%s\n", uaItem->prec->name, mask, on ? 1 : 0, path.c_str(), send ? "" : " merged");
+    if(send)
+        flush();
+    return 0;
+}
+
+epicsTimerNotify::expireStatus DevUaBitWord::expire(const epicsTime &currentTime)
+{
+    uaThreadSched(thrTimer);
+    epicsMutexLock(lock);
+    timerActive = false;
+    epicsMutexUnlock(lock);
+    flush();
+    return expireStatus(noRestart);
+}
+
+// Send the requested bits as one write if no write of the word is in flight
+void DevUaBitWord::flush()
+{
+    epicsUInt32 word = 0;
+    UaVariant var;
+    OpcUa_StatusCode fail = OpcUa_Good;
+    unsigned long n;
+    long ret;
+
+    epicsMutexLock(lock);
+    if(carrier || waiting.empty()) {
+        epicsMutexUnlock(lock);
+        return;
+    }
+    OPCUA_ItemINFO *uaItem = waiting.front();
+    epicsMutexLock(uaItem->flagLock);
+    ret = OpcUa_IsBad((uaItem->directDecode ? uaItem->directValue() : uaItem->varVal).toUInt32(word));
+    epicsMutexUnlock(uaItem->flagLock);
+    if(pendMask) {
+        epicsUInt32 seen = ~(word ^ pendVal) & pendMask;   // bits the data changes already show
+        if(epicsTime::getCurrent() - pendTime > BIT_PENDING_TIMEOUT)
+            seen = pendMask;
+        pendMask &= ~seen;
+        word = (word & ~pendMask) | (pendVal & pendMask);
+    }
+    word = (word | setMask) & ~clrMask;
+    if(ret)
+        fail = OpcUa_BadWaitingForInitialData;
+    else if(!uaItem->writeConv || uaItem->writeConv(&word, var))
+        fail = OpcUa_BadTypeMismatch;
+    // the bits are pending only for a write that is sent
+    sentMask = fail ? 0 : (setMask | clrMask);
+    if(!fail) {
+        pendMask |= sentMask;
+        pendVal = (pendVal & ~sentMask) | setMask;
+        pendTime = epicsTime::getCurrent();
+        nWrites++;
+    }
+    setMask = clrMask = 0;
+    inFlight.swap(waiting);
+    waiting.clear();
+    n = inFlight.size();
+    carrier = uaItem;
+    epicsMutexUnlock(lock);
+
+    if(fail) {
+        if(uaItem->debug) {
+            if(ret)
+                errlogPrintf("%s: no valid value of '%s' to merge the bits into\n", uaItem->prec->name, path.c_str());
+            else
+                errlogPrintf("%s: can't write %s\n", uaItem->prec->name, variantTypeStrings(uaItem->itemDataType));
+        }
+        complete(uaItem, fail);
+        return;
+    }
+    if(uaItem->debug >= 2)
+        errlogPrintf("%s: write %#x to '%s' for %lu records\n", uaItem->prec->name, word, path.c_str(), n);
+    UaStatus status = pMyClient->writeFunc(uaItem, var);
+    if(status.isBad())      // no writeComplete will follow
+        complete(uaItem, status.statusCode());
+}
+
+void DevUaBitWord::complete(OPCUA_ItemINFO *uaItem, OpcUa_StatusCode stat)
+{
+    std::vector<OPCUA_ItemINFO *> done;
+
+    epicsMutexLock(lock);
+    if(carrier != uaItem) {
+        epicsMutexUnlock(lock);
+        return;
+    }
+    done.swap(inFlight);
+    carrier = NULL;
+    if(!OpcUa_IsGood(stat)) {
+        pendMask &= ~sentMask;  // the word keeps its old bits
+        nFailed++;
+    }
+    epicsMutexUnlock(lock);
+
+    for(size_t i=0; i<done.size(); i++) {
+        done[i]->stat = stat;
+        callbackRequest(&(done[i]->callback));
+    }
+    flush();
+}
+
+void DevUaBitWord::report(int verb)
+{
+    epicsMutexLock(lock);
+    errlogPrintf("  %-40s requests %u writes %u failed %u waiting %lu%s\n", path.c_str(), nRequests, nWrites, nFailed,
+                 (unsigned long) waiting.size(), carrier ? " write in flight" : "");
+    epicsMutexUnlock(lock);
+}
@@ -0,0 +1,77 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUABITWORD_H
+#define DEVUABITWORD_H
+
+#include <string>
+#include <vector>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsTimer.h>
+#include "drvOpcUa.h"
+
+/* Bit word: bo records with info(opcua:BIT) and the same link write single bits of
+ * one word node. OPC UA has no masked write for a plain variable, so the bits are
+ * merged into a read-modify-write of the whole word: Requests arriving while a write
+ * of the word is in flight, or within drvOpcua_BitWriteWindow, are sent as one write.
+ * The base value is the monitored word with the bits written before overlaid until a
+ * data change confirms them, so back to back writes don't reset each other's bits.
+ * All records of a write are completed by its writeComplete.
+ */
+class DevUaBitWord : public epicsTimerNotify
+{
+    UA_DISABLE_COPY(DevUaBitWord);
+public:
+    DevUaBitWord(const char *path);
+    ~DevUaBitWord();
+
+    // request to set (on != 0) or clear the bits of mask for the record of the item
+    long write(OPCUA_ItemINFO *uaItem, epicsUInt32 mask, int on);
+    // the write carried by the item is done or failed: complete its records, send the next
+    void complete(OPCUA_ItemINFO *uaItem, OpcUa_StatusCode stat);
+    bool isCarrier(const OPCUA_ItemINFO *uaItem) const { return carrier == uaItem; }
+    void report(int verb);
+
+    const std::string path;
+
+private:
+    virtual expireStatus expire(const epicsTime &currentTime);
+    void flush();
+
+    epicsMutexId lock;
+    epicsTimer *timer;
+    bool timerActive;
+    epicsUInt32 setMask;            // requested bits not yet sent
+    epicsUInt32 clrMask;
+    std::vector<OPCUA_ItemINFO *> waiting;  // records of the requested bits
+    std::vector<OPCUA_ItemINFO *> inFlight; // records of the write in flight
+    OPCUA_ItemINFO *carrier;        // item whose handle carries the write in flight, NULL if none
+    epicsUInt32 pendMask;           // bits written but not yet seen in a data change
+    epicsUInt32 pendVal;
+    epicsTime pendTime;
+    epicsUInt32 sentMask;           // bits of the write in flight
+    epicsUInt32 nRequests;
+    epicsUInt32 nWrites;
+    epicsUInt32 nFailed;
+};
+
+// Set uaItem->bitWord to the bit word of its link, create it if not yet there
+void bitWordAttach(OPCUA_ItemINFO *uaItem);
+void bitWordReport(int verb);
+
+#endif // DEVUABITWORD_H
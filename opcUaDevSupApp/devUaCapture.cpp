@@ -0,0 +1,273 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <map>
+
+#include <errlog.h>
+
+#include "devUaCapture.h"
+#include "devUaShmRing.h"
+#include "devUaClient.h"
+
+DevUaCapture *pCapture = NULL;
+
+DevUaCapture::DevUaCapture(const char *file, epicsUInt32 max)
+    : fileName(file)
+    , fp(NULL)
+    , lock(epicsMutexMustCreate())
+    , buf(NULL)
+    , maxData(max)
+    , nRecords(0)
+    , nTruncated(0)
+    , nErrors(0)
+{
+}
+
+DevUaCapture::~DevUaCapture()
+{
+    close();
+    free(buf);
+    epicsMutexDestroy(lock);
+}
+
+long DevUaCapture::open(std::vector<OPCUA_ItemINFO *> &vUaItemInfo)
+{
+    opcUaCapHeader hdr;
+    char name[OPCUA_CAP_NAMELEN];
+
+    if(fp)
+        return 0;
+    if(!buf)
+        buf = (char *) malloc(maxData);
+    fp = fopen(fileName.c_str(), "wb");
+    if(!fp || !buf) {
+        errlogPrintf("DevUaCapture: can't create '%s': %s\n", fileName.c_str(), strerror(errno));
+        if(fp)
+            fclose(fp);
+        fp = NULL;
+        return 1;
+    }
+    hdr.magic    = OPCUA_CAP_MAGIC;
+    hdr.version  = OPCUA_CAP_VERSION;
+    hdr.nItems   = vUaItemInfo.size();
+    hdr.reserved = 0;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    for(epicsUInt32 i=0; i<hdr.nItems; i++) {
+        memset(name, 0, sizeof(name));
+        if(vUaItemInfo[i])
+            strncpy(name, vUaItemInfo[i]->prec->name, sizeof(name)-1);
+        fwrite(name, sizeof(name), 1, fp);
+    }
+    return 0;
+}
+
+void DevUaCapture::close()
+{
+    epicsMutexLock(lock);
+    if(fp)
+        fclose(fp);
+    fp = NULL;
+    epicsMutexUnlock(lock);
+}
+
+// call with lock held
+void DevUaCapture::put(opcUaCapRecord &rec, const OpcUa_Variant *val)
+{
+    int truncated = 0;
+
+    rec.length = val ? encodeRawValue(*val, buf, maxData, &truncated) : 0;
+    if(truncated)
+        nTruncated++;
+    if(fwrite(&rec, sizeof(rec), 1, fp) != 1 || (rec.length && fwrite(buf, rec.length, 1, fp) != 1))
+        nErrors++;
+    nRecords++;
+}
+
+void DevUaCapture::batch(const UaDataNotifications &notifications, uint64_t rcvTicks)
+{
+    opcUaCapRecord rec;
+
+    epicsMutexLock(lock);
+    if(!fp) {
+        epicsMutexUnlock(lock);
+        return;
+    }
+    memset(&rec, 0, sizeof(rec));
+    rec.type   = capBatch;
+    rec.handle = notifications.length();
+    rec.time   = rcvTicks;
+    put(rec, NULL);
+    for(OpcUa_UInt32 i=0; i<notifications.length(); i++) {
+        const OpcUa_DataValue &value = notifications[i].Value;
+        rec.type       = capNotify;
+        rec.isArray    = value.Value.ArrayType ? 1 : 0;
+        rec.dataType   = value.Value.Datatype;
+        rec.handle     = notifications[i].ClientHandle;
+        rec.status     = value.StatusCode;
+        rec.serverTime = uaTicks(value.ServerTimestamp);
+        rec.sourceTime = uaTicks(value.SourceTimestamp);
+        put(rec, &value.Value);
+    }
+    epicsMutexUnlock(lock);
+}
+
+void DevUaCapture::write(OPCUA_ItemINFO *uaItem, const UaVariant &value)
+{
+    opcUaCapRecord rec;
+    const OpcUa_Variant *val = value;
+
+    epicsMutexLock(lock);
+    if(!fp) {
+        epicsMutexUnlock(lock);
+        return;
+    }
+    memset(&rec, 0, sizeof(rec));
+    rec.type     = capWrite;
+    rec.isArray  = val->ArrayType ? 1 : 0;
+    rec.dataType = val->Datatype;
+    rec.handle   = uaItem->itemIdx;
+    rec.time     = uaTicksNow();
+    put(rec, val);
+    epicsMutexUnlock(lock);
+}
+
+void DevUaCapture::report(int verb)
+{
+    epicsMutexLock(lock);
+    errlogPrintf("Capture file '%s': %s, %u records, %u values truncated, %u write errors\n", fileName.c_str(),
+                 fp ? "open" : "closed", nRecords, nTruncated, nErrors);
+    if(fp && verb > 1)
+        fflush(fp);
+    epicsMutexUnlock(lock);
+}
+
+/* Replay ------------------------------------------------------------------------ */
+
+struct ReplayArgs {
+    std::string fileName;
+    double speed;
+};
+
+static void replayThread(void *arg)
+{
+    ReplayArgs *args = (ReplayArgs *) arg;
+    opcUaCapHeader hdr;
+    opcUaCapRecord rec;
+    std::vector<OpcUa_Int32> handleMap;     // file handle -> item handle, -1 if unknown
+    std::map<std::string, OpcUa_UInt32> names;
+    char name[OPCUA_CAP_NAMELEN];
+    char *data = NULL;
+    epicsUInt32 dataSize = 0;
+    epicsUInt32 nBatches = 0, nValues = 0, nSkipped = 0, nWrites = 0;
+    uint64_t firstTicks = 0;
+    epicsTime start = epicsTime::getCurrent();
+
+    uaThreadSched(thrReplay);
+    FILE *fp = fopen(args->fileName.c_str(), "rb");
+
+    if(!fp || fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != OPCUA_CAP_MAGIC || hdr.version != OPCUA_CAP_VERSION) {
+        errlogPrintf("opcuaReplay: '%s' is no capture file\n", args->fileName.c_str());
+        if(fp)
+            fclose(fp);
+        delete args;
+        return;
+    }
+    for(OpcUa_UInt32 i=0; i<pMyClient->vUaItemInfo.size(); i++) {
+        if(pMyClient->vUaItemInfo[i])
+            names[pMyClient->vUaItemInfo[i]->prec->name] = i;
+    }
+    handleMap.assign(hdr.nItems, -1);
+    for(epicsUInt32 i=0; i<hdr.nItems && fread(name, sizeof(name), 1, fp) == 1; i++) {
+        name[sizeof(name)-1] = 0;
+        std::map<std::string, OpcUa_UInt32>::iterator it = names.find(name);
+        if(it != names.end())
+            handleMap[i] = it->second;
+    }
+
+    while(fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if(rec.type != capBatch) {      // writes are not replayed
+            if(rec.type == capWrite)
+                nWrites++;
+            fseek(fp, rec.length, SEEK_CUR);
+            continue;
+        }
+        if(args->speed > 0.0) {         // wait for the recorded time of the batch
+            if(!firstTicks)
+                firstTicks = rec.time;
+            double due = (rec.time - firstTicks) / 1.0e7 / args->speed;
+            double late = epicsTime::getCurrent() - start;
+            if(due > late)
+                epicsThreadSleep(due - late);
+        }
+        UaDataNotifications notifications;
+        OpcUa_UInt32 n = 0, count = rec.handle;
+        notifications.create(count);
+        for(OpcUa_UInt32 i=0; i<count && fread(&rec, sizeof(rec), 1, fp) == 1; i++) {
+            if(rec.length > dataSize) {
+                char *p = (char *) realloc(data, rec.length);
+                if(!p)
+                    break;
+                data = p;
+                dataSize = rec.length;
+            }
+            if(rec.length && fread(data, rec.length, 1, fp) != 1)
+                break;
+            if(rec.type != capNotify || rec.handle >= handleMap.size() || handleMap[rec.handle] < 0) {
+                nSkipped++;
+                continue;
+            }
+            OpcUa_MonitoredItemNotification &notif = notifications[n];
+            if(decodeRawValue(data, rec.length, rec.dataType, rec.isArray, &notif.Value.Value)) {
+                nSkipped++;
+                continue;
+            }
+            notif.ClientHandle = handleMap[rec.handle];
+            notif.Value.StatusCode = rec.status;
+            notif.Value.ServerTimestamp.dwHighDateTime = (OpcUa_UInt32) (rec.serverTime >> 32);
+            notif.Value.ServerTimestamp.dwLowDateTime  = (OpcUa_UInt32) rec.serverTime;
+            notif.Value.SourceTimestamp.dwHighDateTime = (OpcUa_UInt32) (rec.sourceTime >> 32);
+            notif.Value.SourceTimestamp.dwLowDateTime  = (OpcUa_UInt32) rec.sourceTime;
+            n++;
+        }
+        notifications.resize(n);
+        if(n)
+            pMyClient->replayDataChange(notifications);
+        nBatches++;
+        nValues += n;
+    }
+    errlogPrintf("opcuaReplay: '%s' done in %.3f s: %u batches, %u values, %u skipped, %u writes not replayed\n",
+                 args->fileName.c_str(), epicsTime::getCurrent() - start, nBatches, nValues, nSkipped, nWrites);
+    free(data);
+    fclose(fp);
+    delete args;
+}
+
+long opcUaReplay(const char *fileName, double speed)
+{
+    if(!pMyClient)
+        return 1;
+    ReplayArgs *args = new ReplayArgs;
+    args->fileName = fileName;
+    args->speed = speed;
+    epicsThreadCreate("opcuaReplay", epicsThreadPriorityMedium,
+                      epicsThreadGetStackSize(epicsThreadStackMedium), replayThread, args);
+    return 0;
+}
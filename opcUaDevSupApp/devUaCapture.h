@@ -0,0 +1,100 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUACAPTURE_H
+#define DEVUACAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include "drvOpcUa.h"
+
+/* Capture file of subscription traffic:
+ *
+ *   | opcUaCapHeader | name table: nItems * OPCUA_CAP_NAMELEN | records ... |
+ *
+ * Each record is an opcUaCapRecord followed by length bytes of raw value data
+ * as written by encodeRawValue(). A batch record (handle = number of notifications)
+ * precedes the notifications of one dataChange callback. Items are mapped by record
+ * name at replay, so the file can be replayed by an IOC with other item handles.
+ * All fields are in host byte order.
+ */
+#define OPCUA_CAP_MAGIC   0x4f504341u  /* "OPCA" */
+#define OPCUA_CAP_VERSION 1
+#define OPCUA_CAP_NAMELEN 64
+
+typedef enum { capBatch = 1, capNotify, capWrite } OpcUaCapType;
+
+typedef struct opcUaCapHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nItems;
+    uint32_t reserved;
+} opcUaCapHeader;
+
+typedef struct opcUaCapRecord {
+    uint8_t  type;          /* OpcUaCapType */
+    uint8_t  isArray;
+    uint16_t dataType;      /* OPC UA built-in type id */
+    uint32_t handle;        /* item handle, for capBatch the number of notifications */
+    uint32_t status;
+    uint32_t length;        /* bytes of raw value data following */
+    uint64_t time;          /* capture time, OPC UA DateTime */
+    uint64_t serverTime;
+    uint64_t sourceTime;
+} opcUaCapRecord;
+
+// Write all data changes and writes of the driver to a capture file
+class DevUaCapture
+{
+    UA_DISABLE_COPY(DevUaCapture);
+public:
+    DevUaCapture(const char *fileName, epicsUInt32 maxData);
+    ~DevUaCapture();
+
+    // create the file and write the name table. Call when all items are known.
+    long open(std::vector<OPCUA_ItemINFO *> &vUaItemInfo);
+    void close();
+    void setFileName(const char *file) { fileName = file; }
+    bool isOpen() const { return fp != NULL; }
+    void batch(const UaDataNotifications &notifications, uint64_t rcvTicks);
+    void write(OPCUA_ItemINFO *uaItem, const UaVariant &value);
+    void report(int verb);
+
+private:
+    void put(opcUaCapRecord &rec, const OpcUa_Variant *val);
+
+    std::string fileName;
+    FILE *fp;
+    epicsMutexId lock;      // serializes the subscription and write threads
+    char *buf;
+    epicsUInt32 maxData;
+    epicsUInt32 nRecords;
+    epicsUInt32 nTruncated;
+    epicsUInt32 nErrors;
+};
+
+extern DevUaCapture *pCapture;
+
+/* Feed a capture file into the dataChange callback of the client. speed is the
+ * replay rate relative to the recording, 0 replays as fast as possible. */
+long opcUaReplay(const char *fileName, double speed);
+
+#endif // DEVUACAPTURE_H
@@ -17,6 +17,7 @@
 \*************************************************************************/
 
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 
 #include <boost/algorithm/string.hpp>
@@ -28,14 +29,89 @@
 #include <boost/regex.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include <uadiscovery.h>
+
 #define epicsTypesGLOBAL
 #include "drvOpcUa.h"
 #include "devUaSubscription.h"
 #include "devUaClient.h"
+#include "devUaWriteScheduler.h"
+#include "devUaCapture.h"
+#include "devUaShmRing.h"
+#include "devUaProcessPool.h"
+#include "devUaBitWord.h"
+#include "devUaAggregate.h"
+#include "devUaOutQueue.h"
 #include <callback.h>
+#include <epicsAtomic.h>
+#include <epicsExport.h>
+#include <map>
+#include <set>
 
 using namespace UaClientSdk;
 
+// Move items sampled slower than the publishing interval to subscriptions publishing at that rate
+static int drvOpcua_RegroupSubscriptions = 0;
+
+// Retry of failed items: first delay, max. delay [s] and max. number of items per attempt
+static double drvOpcua_RetryInterval = 2.0;
+static double drvOpcua_RetryMaxInterval = 60.0;
+static int drvOpcua_RetryBatchSize = 100;
+
+// On demand items: reporting is disabled after this time [s] without monitors on the record
+static double drvOpcua_OnDemandHold = 10.0;
+#define ON_DEMAND_SCAN 1.0      // s, interval of the interest scan
+
+// Item slots reserved for records added after OpcUaSetupMonitors()
+static int drvOpcua_ItemReserve = 1000;
+
+// Register string, GUID and opaque nodes of OUT records for the write templates
+static int drvOpcua_RegisterNodes = 1;
+
+// Session parameters, 0 = SDK default
+static double drvOpcua_SessionTimeout = 0.0;    // ms
+static int drvOpcua_WatchdogTime = 0;           // ms, interval of the connection check
+static int drvOpcua_WatchdogTimeout = 0;        // ms, timeout of the connection check
+static int drvOpcua_ConnectTimeout = 0;         // ms
+static int drvOpcua_PublishRequests = 0;        // max. outstanding publish requests
+static int drvOpcua_CallTimeout = 0;            // ms, timeout of service calls
+// Message security with policy Basic256Sha256: 0 = None, 1 = Sign, 2 = SignAndEncrypt
+static int drvOpcua_SecurityMode = 0;
+
+extern "C" {
+    epicsExportAddress(double, drvOpcua_SessionTimeout);
+    epicsExportAddress(int, drvOpcua_WatchdogTime);
+    epicsExportAddress(int, drvOpcua_WatchdogTimeout);
+    epicsExportAddress(int, drvOpcua_ConnectTimeout);
+    epicsExportAddress(int, drvOpcua_PublishRequests);
+    epicsExportAddress(int, drvOpcua_CallTimeout);
+    epicsExportAddress(int, drvOpcua_SecurityMode);
+    epicsExportAddress(int, drvOpcua_RegroupSubscriptions);
+    epicsExportAddress(double, drvOpcua_RetryInterval);
+    epicsExportAddress(double, drvOpcua_RetryMaxInterval);
+    epicsExportAddress(int, drvOpcua_RetryBatchSize);
+    epicsExportAddress(double, drvOpcua_OnDemandHold);
+    epicsExportAddress(int, drvOpcua_RegisterNodes);
+    epicsExportAddress(int, drvOpcua_ItemReserve);
+}
+
+void initServiceSettings(ServiceSettings &settings)
+{
+    if(drvOpcua_CallTimeout > 0)
+        settings.callTimeout = drvOpcua_CallTimeout;
+}
+
+const char *connStateStrings(int state)
+{
+    switch (state) {
+    case connNone:      return "none";
+    case connMonitored: return "monitored";
+    case connFailed:    return "failed";
+    case connInvalid:   return "invalid";
+    default:            return "unknown";
+    }
+}
+
 inline const char *serverStatusStrings(UaClient::ServerStatus type)
 {
     switch (type) {
@@ -53,12 +129,21 @@ DevUaClient::DevUaClient(int autoCon=1,int debug=0,double opcua_AutoConnectInter
     : debug(debug)
     , serverConnectionStatus(UaClient::Disconnected)
     , initialSubscriptionOver(false)
-    , queue (epicsTimerQueueActive::allocate(true))
+    , queue (epicsTimerQueueActive::allocate(false))  // own thread, see opcuaThreadSched
 {
     drvOpcua_AutoConnectInterval = opcua_AutoConnectInterval; // Configurable default for auto connection attempt interval
     m_pSession            = new UaSession();
     m_pDevUaSubscription  = new DevUaSubscription(getDebug());
+    m_pWriteScheduler     = new DevUaWriteScheduler(this);
     autoConnect = autoCon;
+    autoConnector = NULL;
+    monitorsActive = false;
+    retryTimer            = new failedItemRetry(this, queue);
+    onDemandTimer         = new onDemandScan(this, queue);
+    nModeChanges = 0;
+    nextTransaction = 0;
+    transactionLock = epicsMutexMustCreate();
+    itemLock = epicsMutexMustCreate();
     if(autoConnect)
         autoConnector     = new autoSessionConnect(this, drvOpcua_AutoConnectInterval, queue);
 }
@@ -66,11 +151,15 @@ DevUaClient::DevUaClient(int autoCon=1,int debug=0,double opcua_AutoConnectInter
 DevUaClient::~DevUaClient()
 {
     delete m_pDevUaSubscription;
+    delete m_pWriteScheduler;
+    delete retryTimer;
+    delete onDemandTimer;
     if (m_pSession)
     {
         if (m_pSession->isConnected())
         {
             ServiceSettings serviceSettings;
+            initServiceSettings(serviceSettings);
             m_pSession->disconnect(serviceSettings, OpcUa_True);
         }
         delete m_pSession;
@@ -79,6 +168,8 @@ DevUaClient::~DevUaClient()
     queue.release();
     if(autoConnect)
         delete autoConnector;
+    epicsMutexDestroy(transactionLock);
+    epicsMutexDestroy(itemLock);
 }
 
 void DevUaClient::connectionStatusChanged(
@@ -88,6 +179,7 @@ void DevUaClient::connectionStatusChanged(
     OpcUa_ReferenceParameter(clientConnectionId);
     char timeBuffer[30];
 
+    uaThreadSched(thrPublish);
     if(debug)
         errlogPrintf("%s opcUaClient: Connection status changed to %d (%s)\n",
                  getTime(timeBuffer),
@@ -125,29 +217,125 @@ void DevUaClient::setBadQuality()
     epicsTimeStamp	 now;
     epicsTimeGetCurrent(&now);
 
+    epicsMutexLock(itemLock);
     for(OpcUa_UInt32 bpItem=0;bpItem<vUaItemInfo.size();bpItem++) {
         OPCUA_ItemINFO *uaItem = vUaItemInfo[bpItem];
+        if(!uaItem)
+            continue;
         uaItem->prec->time = now;
         uaItem->stat = OpcUa_BadServerNotConnected;
-        if(uaItem->inpDataType) // is OUT Record
+        if(pProcessPool && (uaItem->inpDataType || uaItem->prec->scan == SCAN_IO_EVENT))
+            pProcessPool->request(uaItem);
+        else if(uaItem->inpDataType) // is OUT Record
             callbackRequest(&(uaItem->callback));
         else
             scanIoRequest( uaItem->ioscanpvt );
     }
+    epicsMutexUnlock(itemLock);
 }
 
-// add OPCUA_ItemINFO to vUaItemInfo. Setup nodes is done by getNodes()
-void DevUaClient::addOPCUA_Item(OPCUA_ItemINFO *h)
+/* add OPCUA_ItemINFO to vUaItemInfo. Setup nodes is done by getNodes(), for items added
+ * after OpcUaSetupMonitors() by OpcUaSetupItems(). The index is the client handle of the
+ * item, slots of removed items are reused once their hold time is over. Once monitored,
+ * the vectors are not reallocated, see reserveItems(). Return 1 if there is no slot left.
+ * Call with itemLock. */
+long DevUaClient::addOPCUA_Item(OPCUA_ItemINFO *h)
 {
-    vUaItemInfo.push_back(h);
-    h->itemIdx = vUaItemInfo.size()-1;
+    bool reuse = freeHandles.size() && epicsTime::getCurrent() - freeHandles.front().freed > freeHandles.front().hold;
+
+    if(!reuse && monitorsActive && vUaItemInfo.size() >= vUaItemInfo.capacity()) {
+        errlogPrintf("%s: no free item slot, increase drvOpcua_ItemReserve (%d)\n", h->prec->name, drvOpcua_ItemReserve);
+        return 1;
+    }
+    for(OpcUa_UInt32 i=0; i<removedItems.size(); i++) {
+        if(removedItems[i] == h) {
+            removedItems.erase(removedItems.begin() + i);
+            break;
+        }
+    }
+    if(reuse) {
+        h->itemIdx = freeHandles.front().handle;
+        freeHandles.pop_front();
+        vUaItemInfo[h->itemIdx] = h;
+    }
+    else {
+        vUaItemInfo.push_back(h);
+        h->itemIdx = vUaItemInfo.size()-1;
+    }
+    if(vUaNodeId.size() > (size_t) h->itemIdx)
+        vUaNodeId[h->itemIdx] = UaNodeId();
+    if(pShmRing)                // not open yet for the items of iocInit
+        pShmRing->setName(h->itemIdx, h);
     if((h->debug >= 4) || (debug >= 4))
         errlogPrintf("%s\tDevUaClient::addOPCUA_ItemINFO: idx=%d\n", h->prec->name, h->itemIdx);
+    return 0;
+}
+
+/* Reserve the item slots for records added at runtime before the items are monitored:
+ * the subscription callbacks, timers and replay index vUaItemInfo and vUaNodeId without
+ * lock, so the vectors must not be reallocated afterwards. */
+void DevUaClient::reserveItems()
+{
+    size_t n = vUaItemInfo.size() + ((drvOpcua_ItemReserve > 0) ? drvOpcua_ItemReserve : 0);
+    vUaItemInfo.reserve(n);
+    vUaNodeId.reserve(n);
+}
+
+/* Stop monitoring an item and free its handle. The record keeps its OPCUA_ItemINFO,
+ * it is not processed by the driver any more. Notifications of the deleted monitored
+ * item may still be queued, so the handle is reused only after two publishing intervals
+ * and a second. Call with itemLock. */
+long DevUaClient::removeOPCUA_Item(OPCUA_ItemINFO *h)
+{
+    OpcUa_UInt32 idx = h->itemIdx;
+    std::vector<OpcUa_UInt32> handles(1, idx);
+    FreeHandle f;
+
+    if(idx >= vUaItemInfo.size() || vUaItemInfo[idx] != h)
+        return 1;
+    f.handle = idx;
+    f.hold = 1.0 + (h->subscription ? 2 * h->subscription->publishingInterval / 1000.0 : 0.0);
+    if(h->subscription && isConnected())
+        h->subscription->deleteMonitoredItems(handles);
+    releaseWrites(handles);
+    h->subscription = NULL;
+    h->monitoredItemId = 0;
+    h->connState = connNone;
+    vUaItemInfo[idx] = NULL;
+    if(idx < vUaNodeId.size())
+        vUaNodeId[idx] = UaNodeId();
+    f.freed = epicsTime::getCurrent();
+    freeHandles.push_back(f);
+    removedItems.push_back(h);
+    if((h->debug >= 4) || (debug >= 4))
+        errlogPrintf("%s\tDevUaClient::removeOPCUA_Item: idx=%d\n", h->prec->name, idx);
+    return 0;
+}
+
+/* Find the item of a record, also a removed one (*removed set then). Call with itemLock. */
+OPCUA_ItemINFO *DevUaClient::findItem(const char *recName, bool *removed)
+{
+    OpcUa_UInt32 i;
+
+    *removed = false;
+    for(i=0; i<vUaItemInfo.size(); i++) {
+        if(vUaItemInfo[i] && !strcmp(vUaItemInfo[i]->prec->name, recName))
+            return vUaItemInfo[i];
+    }
+    for(i=0; i<removedItems.size(); i++) {
+        if(!strcmp(removedItems[i]->prec->name, recName)) {
+            *removed = true;
+            return removedItems[i];
+        }
+    }
+    return NULL;
 }
 
 void DevUaClient::setDebug(int d)
 {
     m_pDevUaSubscription->debug = d;
+    for(unsigned int i=0; i<vRegroupSubscriptions.size(); i++)
+        vRegroupSubscriptions[i]->debug = d;
     this->debug = d;
 }
 
@@ -157,6 +345,76 @@ int DevUaClient::getDebug()
 }
 
 
+/* Prepare the security info for drvOpcua_SecurityMode: Initialize the PKI of the
+ * certificate store, load the client certificate and take the server certificate from
+ * the Basic256Sha256 endpoint with the requested mode. The server certificate must be
+ * in the trust list. With drvOpcua_SecurityMode 0 the info is left empty (no security).
+ */
+UaStatus DevUaClient::setupSecurity(SessionSecurityInfo &securityInfo)
+{
+    static const OpcUa_MessageSecurityMode modes[] = {
+        OpcUa_MessageSecurityMode_None, OpcUa_MessageSecurityMode_Sign, OpcUa_MessageSecurityMode_SignAndEncrypt };
+    static const char *modeNames[] = { "None", "Sign", "SignAndEncrypt" };
+    UaStatus result;
+    OpcUa_MessageSecurityMode mode;
+    UaDiscovery discovery;
+    UaEndpointDescriptions endpoints;
+    ServiceSettings serviceSettings;
+    initServiceSettings(serviceSettings);
+    OpcUa_UInt32 i;
+
+    if(drvOpcua_SecurityMode <= 0)
+        return result;
+    if(drvOpcua_SecurityMode > 2) {
+        errlogPrintf("DevUaClient::setupSecurity() drvOpcua_SecurityMode must be 0..2\n");
+        return OpcUa_BadConfigurationError;
+    }
+    mode = modes[drvOpcua_SecurityMode];
+    if(certificateStorePath.isEmpty()) {
+        errlogPrintf("DevUaClient::setupSecurity() security mode %s needs the certificate store path of drvOpcuaSetup\n",
+                     modeNames[drvOpcua_SecurityMode]);
+        return OpcUa_BadConfigurationError;
+    }
+    result = securityInfo.initializePkiProviderOpenSSL(certificateStorePath + "/trusted/crl", certificateStorePath + "/trusted/certs",
+                                                       certificateStorePath + "/issuers/crl", certificateStorePath + "/issuers/certs");
+    if(result.isBad()) {
+        errlogPrintf("DevUaClient::setupSecurity() failed to initialize the PKI in '%s': %s\n",
+                     certificateStorePath.toUtf8(), result.toString().toUtf8());
+        return result;
+    }
+    result = securityInfo.loadClientCertificateOpenSSL(applicationCertificate, applicationPrivateKey);
+    if(result.isBad()) {
+        errlogPrintf("DevUaClient::setupSecurity() failed to load the client certificate '%s': %s\n",
+                     applicationCertificate.toUtf8(), result.toString().toUtf8());
+        return result;
+    }
+    result = discovery.getEndpoints(serviceSettings, url, securityInfo, endpoints);
+    if(result.isBad()) {
+        errlogPrintf("DevUaClient::setupSecurity() getEndpoints failed: %s\n", result.toString().toUtf8());
+        return result;
+    }
+    for(i=0; i<endpoints.length(); i++) {
+        if(UaString(&endpoints[i].SecurityPolicyUri) == OpcUa_SecurityPolicy_Basic256Sha256 && endpoints[i].SecurityMode == mode)
+            break;
+    }
+    if(i == endpoints.length()) {
+        errlogPrintf("DevUaClient::setupSecurity() server has no endpoint Basic256Sha256 %s\n", modeNames[drvOpcua_SecurityMode]);
+        return OpcUa_BadSecurityPolicyRejected;
+    }
+    securityInfo.serverCertificate   = endpoints[i].ServerCertificate;
+    securityInfo.sSecurityPolicy     = OpcUa_SecurityPolicy_Basic256Sha256;
+    securityInfo.messageSecurityMode = mode;
+    result = securityInfo.verifyServerCertificate();
+    if(result.isBad()) {
+        errlogPrintf("DevUaClient::setupSecurity() server certificate not trusted: %s. Copy it to '%s/trusted/certs'\n",
+                     result.toString().toUtf8(), certificateStorePath.toUtf8());
+        return result;
+    }
+    if(debug)
+        errlogPrintf("DevUaClient::setupSecurity() Basic256Sha256 %s\n", modeNames[drvOpcua_SecurityMode]);
+    return result;
+}
+
 UaStatus DevUaClient::connect()
 {
     UaStatus result;
@@ -168,20 +426,36 @@ UaStatus DevUaClient::connect()
     sessionConnectInfo.sApplicationUri  = UaString("urn:HelmholtzGesellschaftBerlin:opcuaEpicsDeviceSupport").arg(hostName);
     sessionConnectInfo.sProductUri      = "urn:HelmholtzGesellschaftBerlin:opcuaEpicsDeviceSupport";
     sessionConnectInfo.sSessionName     = sessionConnectInfo.sApplicationUri;
+    if(drvOpcua_SessionTimeout > 0.0)
+        sessionConnectInfo.nSessionTimeout = drvOpcua_SessionTimeout;
+    if(drvOpcua_WatchdogTime > 0)
+        sessionConnectInfo.nWatchdogTime = drvOpcua_WatchdogTime;
+    if(drvOpcua_WatchdogTimeout > 0)
+        sessionConnectInfo.nWatchdogTimeout = drvOpcua_WatchdogTimeout;
+    if(drvOpcua_ConnectTimeout > 0)
+        sessionConnectInfo.nConnectTimeout = drvOpcua_ConnectTimeout;
+    if(drvOpcua_PublishRequests > 0)
+        sessionConnectInfo.nMaxPublishRequestCount = drvOpcua_PublishRequests;
 
-    // Security settings are not initialized - we connect without security for now
     SessionSecurityInfo sessionSecurityInfo;
     char buf[256];
-    if(debug) printf("%s DevUaClient::connect() connecting to '%s'\n",getTime(buf), url.toUtf8());
-    result = m_pSession->connect(url, sessionConnectInfo, sessionSecurityInfo, this);
+    result = setupSecurity(sessionSecurityInfo);
+    if(result.isGood()) {
+        if(debug) printf("%s DevUaClient::connect() connecting to '%s'\n",getTime(buf), url.toUtf8());
+        result = m_pSession->connect(url, sessionConnectInfo, sessionSecurityInfo, this);
+    }
 
     if (result.isBad())
     {
         errlogPrintf("DevUaClient::connect() connection attempt failed with status %#8x (%s)\n",
                      result.statusCode(),
                      result.toString().toUtf8());
-        autoConnector->start();
+        if(autoConnector)
+            autoConnector->start();
     }
+    else if(debug || (drvOpcua_SessionTimeout > 0.0 && m_pSession->revisedSessionTimeout() != drvOpcua_SessionTimeout))
+        errlogPrintf("DevUaClient::connect() session timeout %g ms (requested %g)\n",
+                     m_pSession->revisedSessionTimeout(), drvOpcua_SessionTimeout);
 
     return result;
 }
@@ -192,6 +466,7 @@ UaStatus DevUaClient::disconnect()
 
     // Default settings like timeout
     ServiceSettings serviceSettings;
+    initServiceSettings(serviceSettings);
     char buf[30];
     if(debug) errlogPrintf("%s Disconnecting the session\n",getTime(buf));
     result = m_pSession->disconnect(serviceSettings,OpcUa_True);
@@ -213,7 +488,26 @@ UaStatus DevUaClient::subscribe()
 
 UaStatus DevUaClient::unsubscribe()
 {
-    return m_pDevUaSubscription->deleteSubscription();
+    retryTimer->cancel();   // before itemLock: waits for a running retry, which takes it
+    epicsMutexLock(itemLock);
+    monitorsActive = false;
+    m_pDevUaSubscription->unlinkShared();
+    for(unsigned int i=0; i<vRegroupSubscriptions.size(); i++)
+        vRegroupSubscriptions[i]->unlinkShared();
+    for(unsigned int i=0; i<vUaItemInfo.size(); i++) {
+        if(vUaItemInfo[i]) {
+            vUaItemInfo[i]->subscription = NULL;
+            vUaItemInfo[i]->sharedPrimary = NULL;   // items without subscription
+            vUaItemInfo[i]->sharedNext = NULL;
+            vUaItemInfo[i]->connState = connNone;
+        }
+    }
+    for(unsigned int i=0; i<vRegroupSubscriptions.size(); i++)
+        delete vRegroupSubscriptions[i];   // deletes the subscription on the server
+    vRegroupSubscriptions.clear();
+    UaStatus status = m_pDevUaSubscription->deleteSubscription();
+    epicsMutexUnlock(itemLock);
+    return status;
 }
 
 void split(std::vector<std::string> &sOut,std::string &str, const char delimiter) {
@@ -321,25 +615,41 @@ bool parseLink(char *lnk,UaNodeId &nodeId)
 }
 
 
-/* clear vUaNodeId and recreate all nodes from uaItem->ItemPath data.
- *    vUaItemInfo:  input link is either
+/* Recreate the nodes of all items, see resolveNodes() */
+long DevUaClient::getNodes()
+{
+    vUaNodeId.assign(vUaItemInfo.size(), UaNodeId());
+    return resolveNodes(itemHandles());
+}
+
+// Handles of all items in use
+std::vector<OpcUa_UInt32> DevUaClient::itemHandles()
+{
+    std::vector<OpcUa_UInt32> handles;
+    for(OpcUa_UInt32 i=0; i<vUaItemInfo.size(); i++) {
+        if(vUaItemInfo[i])
+            handles.push_back(i);
+    }
+    return handles;
+}
+
+/* Recreate the nodes of the items with the given handles from uaItem->ItemPath data.
+ *    input link is either
  *    NODE_ID    or      BROWSEPATH
  *       |                   |
  *    getNodeId          getBrowsePathItem()
  *       |                   |
  *       |               translateBrowsePathsToNodeIds()
  *       |                   |
- *    vUaNodeId holds all nodes.
+ *    vUaNodeId[handle] holds the node, a null node for a bad link.
  * Index of vUaItemInfo has to match index of vUaNodeId to get record
  * access in DevUaSubscription::dataChange callback!
+ * A bad link disables its item only. Return 1 if the session is not connected.
  */
-long DevUaClient::getNodes()
+long DevUaClient::resolveNodes(const std::vector<OpcUa_UInt32> &handles)
 {
-    long ret=0;
-    long isIdType = 1;  /* flag to make shure consistency of itemPath types id==1 or browsepath==0. First item defines type!  */
     OpcUa_UInt32    i;
-    OpcUa_UInt32    nrOfItems = vUaItemInfo.size();
-    OpcUa_UInt32    nrOfBrowsePathItems=0;
+    int             nBad = 0;
     char delim;
     char isNodeIdDelim = ',';
     char isNameSpaceDelim = ':';
@@ -347,8 +657,10 @@ long DevUaClient::getNodes()
     UaStatus status;
     UaDiagnosticInfos       diagnosticInfos;
     ServiceSettings         serviceSettings;
+    initServiceSettings(serviceSettings);
     UaBrowsePathResults     browsePathResults;
     UaBrowsePaths           browsePaths;
+    std::vector<OpcUa_UInt32> browsePathHandles;  // item handle of each browsePaths entry
     char buf[256];
 
     std::ostringstream ss;
@@ -357,7 +669,8 @@ long DevUaClient::getNodes()
 
     ss <<"([a-z0-9_-]+)(["<< isNodeIdDelim << isNameSpaceDelim<<"])(.*)";
     rex = ss.str();  // ="([a-z0-9_-]+)([,:])(.*)";
-    vUaNodeId.clear();
+    if(vUaNodeId.size() < vUaItemInfo.size())
+        vUaNodeId.resize(vUaItemInfo.size());
 
     // Defer initialization if server is down when the IOC boots
     if (!m_pSession->isConnected()) {
@@ -366,19 +679,25 @@ long DevUaClient::getNodes()
          return 1;
     }
 
-    browsePaths.create(nrOfItems);
-    for(i=0;i<nrOfItems;i++) {
-        OPCUA_ItemINFO        *uaItem = vUaItemInfo[i];
+    browsePaths.create(handles.size());
+    for(i=0;i<handles.size();i++) {
+        OpcUa_UInt32 h = handles[i];
+        OPCUA_ItemINFO        *uaItem = vUaItemInfo[h];
         std::string ItemPath = uaItem->ItemPath;
         int  ns;    // namespace
         UaNodeId    tempNode;
+
+        vUaNodeId[h] = UaNodeId();
+        if (uaItem->ItemPath[0] == 0)   // unlinked by opcuaRetarget
+            continue;
         if (! boost::regex_match( uaItem->ItemPath, matches, rex) || (matches.size() != 4)) {
             if(parseLink(uaItem->ItemPath,tempNode) == true) {
-                vUaNodeId.push_back(tempNode);
+                vUaNodeId[h] = tempNode;
             }
             else {
                 errlogPrintf("%s getNodes() SKIP for bad link. Can't parse '%s'\n",uaItem->prec->name,ItemPath.c_str());
-                ret=1;
+                uaItem->stat = OpcUa_BadNodeIdInvalid;
+                nBad++;
             }
             continue;
         }
@@ -394,32 +713,21 @@ long DevUaClient::getNodes()
         }
         if( isStr ) {      // later versions: string tag to specify a subscription group
             errlogPrintf("%s getNodes() SKIP for bad link. Illegal string type namespace tag in '%s'\n",uaItem->prec->name,ItemPath.c_str());
-            ret=1;
+            uaItem->stat = OpcUa_BadNodeIdInvalid;
+            nBad++;
             continue;
         }
 
-        //errlogPrintf("%20s:ns=%d, delim='%c', path='%s'\n",uaItem->prec->name,ns,delim,path.c_str());
         if(delim == isNameSpaceDelim) {
-            if(!i)  // set for first element
-                isIdType = 0;
-            if (isIdType != 0){
-                if(debug) errlogPrintf("%s %s SKIP for bad link: Illegal Browsepath link in ID links\n",getTime(buf),uaItem->prec->name);
-                ret = 1;
+           if(getBrowsePathItem( browsePaths[browsePathHandles.size()],ItemPath,isNameSpaceDelim,pathDelim)){  // ItemPath: 'namespace:path' may include other namespaces within the path
+                errlogPrintf("%s %s SKIP for bad link: Illegal or Missing namespace in '%s'\n",getTime(buf),uaItem->prec->name,ItemPath.c_str());
+                uaItem->stat = OpcUa_BadNodeIdInvalid;
+                nBad++;
                 continue;
             }
-           if(getBrowsePathItem( browsePaths[nrOfBrowsePathItems],ItemPath,isNameSpaceDelim,pathDelim)){  // ItemPath: 'namespace:path' may include other namespaces within the path
-                if(debug) errlogPrintf("%s %s SKIP for bad link: Illegal or Missing namespace in '%s'\n",getTime(buf),uaItem->prec->name,ItemPath.c_str());
-                ret = 1;
-                continue;
-            }
-            nrOfBrowsePathItems++;
+            browsePathHandles.push_back(h);
         }
         else if(delim == isNodeIdDelim) {
-            if (isIdType != 1){
-                if(debug) errlogPrintf("%s %s SKIP for bad link: Illegal ID link in Browsepath links\n",getTime(buf),uaItem->prec->name);
-                ret = 1;
-                continue;
-            }
            // test identifier for number
             OpcUa_UInt32 itemId;
             char         *endptr;
@@ -431,20 +739,19 @@ long DevUaClient::getNodes()
             else {                 // string id
                 tempNode.setNodeId(UaString(path.c_str()), ns);
             }
-            if(debug>2) errlogPrintf("%3u %s\tNODE: '%s'\n",i,uaItem->prec->name,tempNode.toString().toUtf8());
-            vUaNodeId.push_back(tempNode);
+            if(debug>2) errlogPrintf("%3u %s\tNODE: '%s'\n",h,uaItem->prec->name,tempNode.toString().toUtf8());
+            vUaNodeId[h] = tempNode;
         }
         else {
             errlogPrintf("%s SKIP for bad link: '%s' unknown delimiter\n",uaItem->prec->name,ItemPath.c_str());
-            ret = 1;
+            uaItem->stat = OpcUa_BadNodeIdInvalid;
+            nBad++;
             continue;
         }
     }
-    if(ret) /* if there are illegal links: stop here! May be improved by del item in vUaItemInfo, but need same index for vUaItemInfo and vUaNodeId */
-        return ret;
 
-    if(nrOfBrowsePathItems) {
-        browsePaths.resize(nrOfBrowsePathItems);
+    if(browsePathHandles.size()) {
+        browsePaths.resize(browsePathHandles.size());
         status = m_pSession->translateBrowsePathsToNodeIds(
             serviceSettings, // Use default settings
             browsePaths,
@@ -452,59 +759,454 @@ long DevUaClient::getNodes()
             diagnosticInfos);
 
         if(debug>=2) errlogPrintf("translateBrowsePathsToNodeIds stat=%d (%s). nrOfItems:%d\n",status.statusCode(),status.toString().toUtf8(),browsePathResults.length());
-        for(i=0; i<browsePathResults.length(); i++) {
-            UaNodeId tempNode;
-            if ( OpcUa_IsGood(browsePathResults[i].StatusCode) ) {
-                tempNode = UaNodeId(browsePathResults[i].Targets[0].TargetId.NodeId);
-                vUaNodeId.push_back(tempNode);
+        for(i=0; i<browsePathResults.length() && i<browsePathHandles.size(); i++) {
+            OpcUa_UInt32 h = browsePathHandles[i];
+            if ( OpcUa_IsGood(browsePathResults[i].StatusCode) && browsePathResults[i].NoOfTargets > 0) {
+                vUaNodeId[h] = UaNodeId(browsePathResults[i].Targets[0].TargetId.NodeId);
             }
             else {
-                tempNode = UaNodeId();
-                vUaNodeId.push_back(tempNode);
+                vUaItemInfo[h]->stat = browsePathResults[i].StatusCode;
+                nBad++;
             }
-            if(debug>=2) errlogPrintf("Node: idx=%d node=%s\n",i,tempNode.toString().toUtf8());
+            if(debug>=2) errlogPrintf("Node: idx=%d node=%s\n",h,vUaNodeId[h].toString().toUtf8());
         }
-
     }
-    return ret;
+    if(nBad)
+        errlogPrintf("DevUaClient::getNodes() %d of %lu items have bad links, see opcuaStat(1)\n", nBad, (unsigned long) handles.size());
+    prepareWrites(handles);
+    return 0;
 }
 
 UaStatus DevUaClient::createMonitoredItems()
 {
-    return m_pDevUaSubscription->createMonitoredItems(vUaNodeId,&vUaItemInfo);
+    UaStatus result = m_pDevUaSubscription->createMonitoredItems(vUaNodeId,&vUaItemInfo);
+    if(result.isGood() && drvOpcua_RegroupSubscriptions)
+        regroupMonitoredItems();
+    return result;
 }
 
+// Add items to the main subscription, used for items set up after OpcUaSetupMonitors()
+UaStatus DevUaClient::createMonitoredItems(const std::vector<OpcUa_UInt32> &handles)
+{
+    std::vector<OpcUa_UInt32> valid;
+    for(OpcUa_UInt32 i=0; i<handles.size(); i++) {
+        if(vUaItemInfo[handles[i]] && !vUaNodeId[handles[i]].isNull())
+            valid.push_back(handles[i]);
+    }
+    if(valid.empty())
+        return OpcUa_Good;
+    return m_pDevUaSubscription->createMonitoredItems(vUaNodeId,&vUaItemInfo,valid);
+}
 
-UaStatus DevUaClient::writeFunc(OPCUA_ItemINFO *uaItem, UaVariant &tempValue)
+/* Set the connection state of the items after a setup attempt. Items that are not
+ * monitored are retried by the retry timer, except those with a bad link. */
+void DevUaClient::updateConnState(const std::vector<OpcUa_UInt32> &handles)
+{
+    int nFailed = 0;
+
+    for(OpcUa_UInt32 i=0; i<handles.size(); i++) {
+        OPCUA_ItemINFO *uaItem = vUaItemInfo[handles[i]];
+        if(!uaItem)
+            continue;
+        if(uaItem->ItemPath[0] == 0) {
+            uaItem->connState = connNone;
+        }
+        else if(uaItem->subscription) {
+            if(uaItem->connState == connFailed && (debug || uaItem->debug))
+                errlogPrintf("%s: recovered after %u retries\n", uaItem->prec->name, uaItem->nRetries);
+            uaItem->connState = connMonitored;
+            uaItem->nRetries = 0;
+        }
+        else if(uaItem->stat == OpcUa_BadNodeIdInvalid) {   // see resolveNodes()
+            uaItem->connState = connInvalid;
+        }
+        else {
+            if(uaItem->connState == connFailed)
+                uaItem->nRetries++;
+            uaItem->connState = connFailed;
+            nFailed++;
+        }
+    }
+    if(nFailed && monitorsActive)
+        retryTimer->start(drvOpcua_RetryInterval);
+}
+
+/* Set up the next batch of failed items again. Return the number of items still failed.
+ * Runs on the timer thread, under itemLock like the setup and retarget. */
+long DevUaClient::retryFailedItems(int *nRecovered)
 {
-    ServiceSettings     serviceSettings;    // Use default settings
-    UaWriteValues       nodesToWrite;       // Array of nodes to write
-    UaStatusCodeArray   results;            // Returns an array of status codes
-    UaDiagnosticInfos   diagnosticInfos;    // Returns an array of diagnostic info
+    std::vector<OpcUa_UInt32> handles;
+    long nFailed = 0;
+    OpcUa_UInt32 i;
 
+    *nRecovered = 0;
+    epicsMutexLock(itemLock);
+    if(!monitorsActive || !isConnected()) {
+        epicsMutexUnlock(itemLock);
+        return 0;
+    }
+    for(i=0; i<vUaItemInfo.size(); i++) {
+        if(vUaItemInfo[i] && vUaItemInfo[i]->connState == connFailed && (int) handles.size() < drvOpcua_RetryBatchSize)
+            handles.push_back(i);
+    }
+    if(debug)
+        errlogPrintf("DevUaClient: retry %lu failed items\n", (unsigned long) handles.size());
+    OpcUaSetupItems(handles);
+    for(i=0; i<vUaItemInfo.size(); i++) {
+        if(!vUaItemInfo[i])
+            continue;
+        if(vUaItemInfo[i]->connState == connFailed)
+            nFailed++;
+    }
+    for(i=0; i<handles.size(); i++) {
+        if(vUaItemInfo[handles[i]] && vUaItemInfo[handles[i]]->connState == connMonitored)
+            (*nRecovered)++;
+    }
+    epicsMutexUnlock(itemLock);
+    return nFailed;
+}
+
+epicsTimerNotify::expireStatus failedItemRetry::expire(const epicsTime &/*currentTime*/)
+{
+    int nRecovered;
+    long nFailed;
+
+    uaThreadSched(thrTimer);
+    epicsMutexLock(lock);
+    again = false;
+    epicsMutexUnlock(lock);
+    nFailed = client->retryFailedItems(&nRecovered);
+
+    epicsMutexLock(lock);
+    if(nFailed == 0 && !again) {
+        active = false;
+        epicsMutexUnlock(lock);
+        return expireStatus(noRestart);
+    }
+    if(nRecovered || nFailed == 0)  // server is making progress, keep polling fast
+        delay = drvOpcua_RetryInterval;
+    else if(delay < drvOpcua_RetryMaxInterval)
+        delay = (2*delay < drvOpcua_RetryMaxInterval) ? 2*delay : drvOpcua_RetryMaxInterval;
+    if(delay <= 0.0)
+        delay = 1.0;
+    double next = delay;
+    epicsMutexUnlock(lock);
+    return expireStatus(restart, next);
+}
+
+// Start the interest scan if there are on demand items. Call with itemLock, it guards onDemandScan::start().
+void DevUaClient::startOnDemand()
+{
+    for(OpcUa_UInt32 i=0; i<vUaItemInfo.size(); i++) {
+        if(vUaItemInfo[i] && vUaItemInfo[i]->onDemand) {
+            onDemandTimer->start(ON_DEMAND_SCAN);
+            return;
+        }
+    }
+}
+
+epicsTimerNotify::expireStatus onDemandScan::expire(const epicsTime &/*currentTime*/)
+{
+    uaThreadSched(thrTimer);
+    client->scanInterest();
+    return expireStatus(restart, ON_DEMAND_SCAN);
+}
+
+/* Monitored items whose records are all on demand report only while one of the records
+ * has a monitor (CA client, CP link) or was processed since the last scan (periodic
+ * scan, DB link with PP). Reporting is switched on at the next scan and
+ * off after drvOpcua_OnDemandHold without monitors, in one SetMonitoringMode call per
+ * subscription and mode. */
+void DevUaClient::scanInterest()
+{
+    typedef std::map<DevUaSubscription *, std::vector<OpcUa_UInt32> > ModeMap;
+    ModeMap toReport, toDisable;
+    epicsUInt32 holdScans = (epicsUInt32) (drvOpcua_OnDemandHold / ON_DEMAND_SCAN);
+
+    epicsMutexLock(itemLock);       // not while a reconnect subscribes again
+    if(!monitorsActive || !isConnected()) {
+        epicsMutexUnlock(itemLock);
+        return;
+    }
+    for(OpcUa_UInt32 i=0; i<vUaItemInfo.size(); i++) {
+        OPCUA_ItemINFO *uaItem = vUaItemInfo[i];
+        bool onDemand = true, interest = false;
+        if(!uaItem || uaItem->sharedPrimary || !uaItem->subscription || !uaItem->monitoredItemId
+                || uaItem->triggeredBy)     // reports by its trigger
+            continue;
+        for(OPCUA_ItemINFO *s = uaItem; s; s = s->sharedNext) {
+            onDemand = onDemand && s->onDemand;
+            epicsMutexLock(s->prec->mlok);     // guards mlis, see dbEvent
+            interest = interest || ellCount(&s->prec->mlis) > 0;
+            epicsMutexUnlock(s->prec->mlok);
+            if(epicsAtomicGetIntT(&s->readInterest)) {
+                epicsAtomicSetIntT(&s->readInterest, 0);
+                interest = true;
+            }
+        }
+        if(interest || !onDemand) {
+            uaItem->idleScans = 0;
+            if(uaItem->monitoringMode != OpcUa_MonitoringMode_Reporting)
+                toReport[uaItem->subscription].push_back(i);
+        }
+        else if(uaItem->monitoringMode == OpcUa_MonitoringMode_Reporting && ++uaItem->idleScans > holdScans)
+            toDisable[uaItem->subscription].push_back(i);
+    }
+    for(ModeMap::iterator it=toReport.begin(); it!=toReport.end(); ++it) {
+        if(it->first->setMonitoringMode(OpcUa_MonitoringMode_Reporting, it->second).isGood())
+            nModeChanges += it->second.size();
+    }
+    for(ModeMap::iterator it=toDisable.begin(); it!=toDisable.end(); ++it) {
+        if(it->first->setMonitoringMode(OpcUa_MonitoringMode_Disabled, it->second).isGood())
+            nModeChanges += it->second.size();
+    }
+    epicsMutexUnlock(itemLock);
+}
+
+/* The server may revise the requested sampling interval to a slower one. Publishing
+ * such items faster than they are sampled is wasted, so move them to subscriptions
+ * with a publishing interval equal to their revised sampling interval. The items are
+ * created in the new subscription before their monitored items in the main subscription
+ * are deleted, those that fail there are created in the main subscription again. */
+void DevUaClient::regroupMonitoredItems()
+{
+    std::map<double, std::vector<OpcUa_UInt32> > groups;
+    std::map<double, std::vector<OpcUa_UInt32> >::iterator it;
+    std::set<std::string> moved;       // records now monitored by a regroup subscription
+
+    for(OpcUa_UInt32 i=0; i<vUaItemInfo.size(); i++) {
+        OPCUA_ItemINFO *uaItem = vUaItemInfo[i];
+        if(uaItem && uaItem->subscription == m_pDevUaSubscription
+                && uaItem->revisedSamplingInterval > m_pDevUaSubscription->publishingInterval)
+            groups[uaItem->revisedSamplingInterval].push_back(i);
+    }
+    for(it = groups.begin(); it != groups.end(); it++) {
+        DevUaSubscription *pSub = new DevUaSubscription(debug);
+        if(pSub->createSubscription(m_pSession, it->first).isBad()) {
+            delete pSub;
+            continue;
+        }
+        std::vector<OpcUa_UInt32> oldIds = m_pDevUaSubscription->releaseMonitoredItems(it->second, NULL);
+        std::vector<OpcUa_UInt32> back;
+        pSub->createMonitoredItems(vUaNodeId, &vUaItemInfo, it->second);
+        for(OpcUa_UInt32 i=0; i<it->second.size(); i++) {
+            OPCUA_ItemINFO *uaItem = vUaItemInfo[it->second[i]];
+            if(uaItem->subscription == pSub)
+                moved.insert(uaItem->prec->name);
+            else
+                back.push_back(it->second[i]);
+        }
+        m_pDevUaSubscription->deleteMonitoredItemIds(oldIds);
+        if(back.size()) {
+            errlogPrintf("DevUaClient: %lu items could not be moved to publishing interval %g ms, kept in the main subscription\n",
+                         (unsigned long) back.size(), pSub->publishingInterval);
+            m_pDevUaSubscription->createMonitoredItems(vUaNodeId, &vUaItemInfo, back);
+        }
+        if(back.size() == it->second.size()) {
+            delete pSub;    // deletes the subscription on the server
+            continue;
+        }
+        vRegroupSubscriptions.push_back(pSub);
+        if(debug)
+            errlogPrintf("DevUaClient: %lu items moved to subscription with publishing interval %g ms\n",
+                         (unsigned long) (it->second.size() - back.size()), pSub->publishingInterval);
+    }
+    /* Deleting a moved trigger item dropped its links: the triggered items left in the
+     * main subscription report on their own. Moved triggered items were linked again or
+     * switched to Reporting by createMonitoredItems(). */
+    std::vector<OpcUa_UInt32> unlinked;
+    for(OpcUa_UInt32 i=0; i<vUaItemInfo.size(); i++) {
+        OPCUA_ItemINFO *uaItem = vUaItemInfo[i];
+        if(uaItem && uaItem->triggeredBy && !uaItem->sharedPrimary
+                && uaItem->subscription == m_pDevUaSubscription && moved.count(uaItem->triggeredBy)) {
+            errlogPrintf("%s: trigger '%s' moved to another subscription, reporting on its own\n",
+                         uaItem->prec->name, uaItem->triggeredBy);
+            unlinked.push_back(i);
+        }
+    }
+    m_pDevUaSubscription->setMonitoringMode(OpcUa_MonitoringMode_Reporting, unlinked);
+}
+
+
+UaStatus DevUaClient::writeFunc(OPCUA_ItemINFO *uaItem, UaVariant &tempValue)
+{
     if (!pMyClient->isConnected())
         return OpcUa_BadServerNotConnected;
+    if (vUaItemInfo[uaItem->itemIdx] != uaItem)  // removed, the handle may belong to another record
+        return OpcUa_BadNodeIdUnknown;
+    UA_TRACE("write", uaItem->prec->name, uaItem->itemIdx, uaItem->writePrio);
+    if(pCapture)
+        pCapture->write(uaItem, tempValue);
+    return m_pWriteScheduler->submit(uaItem, tempValue);
+}
+
+static UaWriteValues *newWriteTemplate(const UaNodeId &node)
+{
+    UaWriteValues *tmpl = new UaWriteValues;
+    tmpl->create(1);
+    node.copyTo(&(*tmpl)[0].NodeId);
+    (*tmpl)[0].AttributeId = OpcUa_Attributes_Value;
+    return tmpl;
+}
+
+/* Build the write templates of the OUT records with the given handles: the request
+ * with node, attribute and index range is set up once, sendWrite() only puts the
+ * value in. String, GUID and opaque nodes are registered for the session, the
+ * template then holds the numeric node id the server returned. Called by
+ * resolveNodes(), so the nodes are registered again after a reconnect. */
+void DevUaClient::prepareWrites(const std::vector<OpcUa_UInt32> &handles)
+{
+    std::vector<OPCUA_ItemINFO *> regItems;
+    UaNodeIdArray       nodesToRegister;
+    UaNodeIdArray       registeredNodes;
+    ServiceSettings     serviceSettings;
+    initServiceSettings(serviceSettings);
+
+    releaseWrites(handles);
+    for(OpcUa_UInt32 i=0; i<handles.size(); i++) {
+        OpcUa_UInt32 h = handles[i];
+        OPCUA_ItemINFO *uaItem = vUaItemInfo[h];
+        if(!uaItem || !uaItem->inpDataType || uaItem->member || vUaNodeId[h].isNull())
+            continue;
+        UaWriteValues *tmpl = newWriteTemplate(vUaNodeId[h]);
+        epicsMutexLock(uaItem->flagLock);
+        uaItem->writeTemplate = tmpl;
+        uaItem->writeTemplateElems = -1;
+        epicsMutexUnlock(uaItem->flagLock);
+        if(drvOpcua_RegisterNodes && vUaNodeId[h].identifierType() != OpcUa_IdentifierType_Numeric)
+            regItems.push_back(uaItem);
+    }
+    if(regItems.empty() || !m_pSession->isConnected())
+        return;
 
-    nodesToWrite.create(1);
-    UaNodeId tempNode(vUaNodeId[uaItem->itemIdx]);
-    tempNode.copyTo(&nodesToWrite[0].NodeId);
-    nodesToWrite[0].AttributeId = OpcUa_Attributes_Value;
-    tempValue.copyTo(&nodesToWrite[0].Value.Value);
+    nodesToRegister.create(regItems.size());
+    for(OpcUa_UInt32 i=0; i<regItems.size(); i++)
+        vUaNodeId[regItems[i]->itemIdx].copyTo(&nodesToRegister[i]);
+    UaStatus status = m_pSession->registerNodes(serviceSettings, nodesToRegister, registeredNodes);
+    if(status.isBad() || registeredNodes.length() != regItems.size()) {
+        errlogPrintf("DevUaClient::prepareWrites() registerNodes failed: %s, writing by node id\n", status.toString().toUtf8());
+        return;
+    }
+    for(OpcUa_UInt32 i=0; i<regItems.size(); i++) {
+        OPCUA_ItemINFO *uaItem = regItems[i];
+        epicsMutexLock(uaItem->flagLock);
+        OpcUa_NodeId_Clear(&(*uaItem->writeTemplate)[0].NodeId);
+        OpcUa_NodeId_CopyTo(&registeredNodes[i], &(*uaItem->writeTemplate)[0].NodeId);
+        uaItem->nodeRegistered = 1;
+        epicsMutexUnlock(uaItem->flagLock);
+        if(uaItem->debug >= 2)
+            errlogPrintf("%s: registered node %s as %s\n", uaItem->prec->name,
+                         vUaNodeId[uaItem->itemIdx].toString().toUtf8(), UaNodeId(registeredNodes[i]).toString().toUtf8());
+    }
+    if(debug)
+        errlogPrintf("DevUaClient::prepareWrites() %lu nodes registered\n", (unsigned long) regItems.size());
+}
 
-    // Writes variable value synchronous to OPC server
-    //    return m_pSession->write(serviceSettings,nodesToWrite,results,diagnosticInfos);
+// Drop the write templates of the items, unregister their nodes
+void DevUaClient::releaseWrites(const std::vector<OpcUa_UInt32> &handles)
+{
+    std::vector<UaWriteValues *> registered;
+    ServiceSettings     serviceSettings;
+    initServiceSettings(serviceSettings);
 
+    for(OpcUa_UInt32 i=0; i<handles.size(); i++) {
+        OPCUA_ItemINFO *uaItem = (handles[i] < vUaItemInfo.size()) ? vUaItemInfo[handles[i]] : NULL;
+        if(!uaItem || !uaItem->writeTemplate)
+            continue;
+        epicsMutexLock(uaItem->flagLock);
+        UaWriteValues *tmpl = uaItem->writeTemplate;
+        uaItem->writeTemplate = NULL;
+        epicsMutexUnlock(uaItem->flagLock);
+        if(uaItem->nodeRegistered)
+            registered.push_back(tmpl);
+        else
+            delete tmpl;
+        uaItem->nodeRegistered = 0;
+    }
+    if(registered.empty())
+        return;
+    if(m_pSession->isConnected()) {     // registrations of a lost session are gone anyway
+        UaNodeIdArray nodesToUnregister;
+        nodesToUnregister.create(registered.size());
+        for(OpcUa_UInt32 i=0; i<registered.size(); i++)
+            OpcUa_NodeId_CopyTo(&(*registered[i])[0].NodeId, &nodesToUnregister[i]);
+        UaStatus status = m_pSession->unregisterNodes(serviceSettings, nodesToUnregister);
+        if(status.isBad() && debug)
+            errlogPrintf("DevUaClient::releaseWrites() unregisterNodes failed: %s\n", status.toString().toUtf8());
+    }
+    for(OpcUa_UInt32 i=0; i<registered.size(); i++)
+        delete registered[i];
+}
+
+// Called by the write scheduler
+UaStatus DevUaClient::sendWrite(OPCUA_ItemINFO *uaItem, UaVariant &tempValue)
+{
+    ServiceSettings     serviceSettings;
+    initServiceSettings(serviceSettings);
+    OpcUa_UInt32 transactionId;
+    UaStatus status;
+
+    epicsMutexLock(transactionLock);
+    do {                        // unique among the writes in flight, never 0
+        transactionId = ++nextTransaction;
+    } while(!transactionId || writeTransactions.count(transactionId));
+    writeTransactions[transactionId] = uaItem;
+    epicsMutexUnlock(transactionLock);
+
+    epicsMutexLock(uaItem->flagLock);
+    if(!uaItem->writeTemplate) {    // node not resolved by prepareWrites()
+        uaItem->writeTemplate = newWriteTemplate(vUaNodeId[uaItem->itemIdx]);
+        uaItem->writeTemplateElems = -1;
+    }
+    OpcUa_WriteValue &nodeToWrite = (*uaItem->writeTemplate)[0];
+    if(uaItem->rangeCount) {    // partial write of as many elements as the record has
+        int n = tempValue.isArray() ? tempValue.arraySize() : 0;
+        if(n != uaItem->writeTemplateElems) {
+            OpcUa_String_Clear(&nodeToWrite.IndexRange);
+            uaItem->indexRange(n).copyTo(&nodeToWrite.IndexRange);
+            uaItem->writeTemplateElems = n;
+        }
+    }
+    // The value is borrowed, not copied: beginWrite() encodes the request before it returns
+    nodeToWrite.Value.Value = *(const OpcUa_Variant *) tempValue;
     // Writes variable values asynchronous to OPC server
-    OpcUa_UInt32 transactionId=uaItem->itemIdx;
-    return m_pSession->beginWrite(serviceSettings,nodesToWrite,transactionId);
+    status = m_pSession->beginWrite(serviceSettings, *uaItem->writeTemplate, transactionId);
+    OpcUa_Variant_Initialize(&nodeToWrite.Value.Value);
+    if(status.isBad()) {        // no writeComplete will follow
+        epicsMutexLock(transactionLock);
+        writeTransactions.erase(transactionId);
+        epicsMutexUnlock(transactionLock);
+    }
+    if(drvOpcua_SuppressEcho && status.isGood()) {  // keep the value to recognize its echo
+        OpcUa_Variant_Clear(&uaItem->echoVal);
+        OpcUa_Variant_CopyTo(tempValue, &uaItem->echoVal);
+        uaItem->echoArmed = 1;
+    }
+    epicsMutexUnlock(uaItem->flagLock);
+    return status;
 }
 
 void DevUaClient::writeComplete( OpcUa_UInt32 transactionId,const UaStatus& result,const UaStatusCodeArray& results,const UaDiagnosticInfos& diagnosticInfos)
 {
     char timeBuffer[30];
     OpcUa_UInt32 i;
-    OPCUA_ItemINFO *uaItem = vUaItemInfo[transactionId];
-
+    OPCUA_ItemINFO *uaItem = NULL;
+    std::map<OpcUa_UInt32, OPCUA_ItemINFO *>::iterator it;
+
+    uaThreadSched(thrPublish);
+    epicsMutexLock(transactionLock);
+    it = writeTransactions.find(transactionId);
+    if(it != writeTransactions.end()) {
+        uaItem = it->second;
+        writeTransactions.erase(it);
+    }
+    epicsMutexUnlock(transactionLock);
+    if(!uaItem)
+        return;
+    if((size_t) uaItem->itemIdx >= vUaItemInfo.size() || vUaItemInfo[uaItem->itemIdx] != uaItem) {
+        m_pWriteScheduler->complete(uaItem);    // removed while the write was in flight
+        return;
+    }
     if(result.isBad() ) {
         errlogPrintf("writeComplete failed! result: %#8x '%s'",UaStatusCode(result).statusCode(),result.toString().toUtf8());
         uaItem->stat = UaStatusCode(result).statusCode();
@@ -521,31 +1223,56 @@ void DevUaClient::writeComplete( OpcUa_UInt32 transactionId,const UaStatus& resu
         }
 
     }
+    if(OpcUa_IsBad(uaItem->stat)) {    // the value was not written, there is no echo
+        epicsMutexLock(uaItem->flagLock);
+        uaItem->echoArmed = 0;
+        epicsMutexUnlock(uaItem->flagLock);
+    }
+    UA_TRACE("writeDone", uaItem->prec->name, uaItem->itemIdx, uaItem->stat);
     if(uaItem->debug >= 2) errlogPrintf("writeComplete %s: %s STAT: %#8x (%s)\n",uaItem->prec->name, getTime(timeBuffer), uaItem->stat,UaStatus(uaItem->stat).toString().toUtf8());
-    callbackRequest(&(uaItem->callback));
+    if(uaItem->bitWord && uaItem->bitWord->isCarrier(uaItem))
+        uaItem->bitWord->complete(uaItem, uaItem->stat);
+    else if(uaItem->outQueue)
+        uaItem->outQueue->complete(uaItem, uaItem->stat);
+    else
+        callbackRequest(&(uaItem->callback));
+    m_pWriteScheduler->complete(uaItem);
+}
+
+/* Replayed notifications: without a server the data type of the items is taken
+ * from the recorded values. */
+void DevUaClient::replayDataChange(const UaDataNotifications &notifications)
+{
+    for(OpcUa_UInt32 i=0; i<notifications.length(); i++) {
+        OPCUA_ItemINFO *uaItem = vUaItemInfo[notifications[i].ClientHandle];
+        if(uaItem && !uaItem->member && uaItem->itemDataType != notifications[i].Value.Value.Datatype) {
+            epicsMutexLock(uaItem->flagLock);
+            uaItem->itemDataType = notifications[i].Value.Value.Datatype;
+            uaItem->bindConverters();
+            epicsMutexUnlock(uaItem->flagLock);
+        }
+    }
+    m_pDevUaSubscription->replay(&vUaItemInfo, notifications);
 }
 
-UaStatus DevUaClient::readFunc(UaDataValues &values,ServiceSettings &serviceSettings,UaDiagnosticInfos &diagnosticInfos, int attribute)
+/* Read an attribute of the items with the given handles. values[i] belongs to handles[i],
+ * items without a valid node get a bad status from the server. */
+UaStatus DevUaClient::readFunc(const std::vector<OpcUa_UInt32> &handles, UaDataValues &values,ServiceSettings &serviceSettings,UaDiagnosticInfos &diagnosticInfos, int attribute)
 {
     UaStatus          result;
     UaReadValueIds nodeToRead;
-    OpcUa_UInt32        i,j;
+    OpcUa_UInt32        i;
     char buf[256];
 
     if(debug>=2) errlogPrintf("%s CALL DevUaClient::readFunc()\n" ,getTime(buf));
-    nodeToRead.create(pMyClient->vUaNodeId.size());
-    for (i=0,j=0; i <pMyClient->vUaNodeId.size(); i++ )
+    nodeToRead.create(handles.size());
+    for (i=0; i <handles.size(); i++ )
     {
-        if ( !vUaNodeId[i].isNull() ) {
-            nodeToRead[j].AttributeId = attribute;
-            (pMyClient->vUaNodeId[i]).copyTo(&(nodeToRead[j].NodeId)) ;
-            j++;
-        }
-        else if (debug){
-            errlogPrintf("%s %s DevUaClient::readValues: Skip illegal node: \n" ,getTime(buf),vUaItemInfo[i]->prec->name);
-        }
+        nodeToRead[i].AttributeId = attribute;
+        vUaNodeId[handles[i]].copyTo(&(nodeToRead[i].NodeId)) ;
+        if(attribute == OpcUa_Attributes_Value && vUaItemInfo[handles[i]]->rangeCount)
+            vUaItemInfo[handles[i]]->indexRange().copyTo(&(nodeToRead[i].IndexRange));
     }
-    nodeToRead.resize(j);
     result = m_pSession->read(
         serviceSettings,
         0,
@@ -553,6 +1280,8 @@ UaStatus DevUaClient::readFunc(UaDataValues &values,ServiceSettings &serviceSett
         nodeToRead,
         values,
         diagnosticInfos);
+    if(result.isGood() && values.length() != handles.size())
+        result = OpcUa_BadUnexpectedError;
     if(result.isBad() && debug) {
         errlogPrintf("%s FAILED: DevUaClient::readFunc()\n" ,getTime(buf));
         if(diagnosticInfos.noOfStringTable() > 0) {
@@ -565,7 +1294,76 @@ UaStatus DevUaClient::readFunc(UaDataValues &values,ServiceSettings &serviceSett
 
 void DevUaClient::itemStat(int verb)
 {
-    errlogPrintf("OpcUa driver: Connected items: %lu\n", (unsigned long)vUaItemInfo.size());
+    epicsMutexLock(itemLock);
+    itemStatLocked(verb);
+    epicsMutexUnlock(itemLock);
+}
+
+void DevUaClient::itemStatLocked(int verb)
+{
+    errlogPrintf("OpcUa driver: Connected items: %lu\n", (unsigned long)(vUaItemInfo.size() - freeHandles.size()));
+    {
+        unsigned int nShared = 0, nOnDemand = 0, nDisabled = 0, nRegistered = 0;
+        unsigned int nQueues = 0, nDropped = 0, nRejected = 0;
+        for(OpcUa_UInt32 i=0; i<vUaItemInfo.size(); i++) {
+            if(vUaItemInfo[i] && vUaItemInfo[i]->sharedPrimary)
+                nShared++;
+            if(vUaItemInfo[i] && vUaItemInfo[i]->nodeRegistered)
+                nRegistered++;
+            if(vUaItemInfo[i] && vUaItemInfo[i]->outQueue) {
+                nQueues++;
+                nDropped += vUaItemInfo[i]->outQueue->nDropped;
+                nRejected += vUaItemInfo[i]->outQueue->nRejected;
+            }
+            if(vUaItemInfo[i] && vUaItemInfo[i]->onDemand) {
+                nOnDemand++;
+                if(vUaItemInfo[i]->subscription && !vUaItemInfo[i]->sharedPrimary
+                        && vUaItemInfo[i]->monitoringMode != OpcUa_MonitoringMode_Reporting)
+                    nDisabled++;
+            }
+        }
+        if(nShared)
+            errlogPrintf("Items sharing the monitored item of another item: %u\n", nShared);
+        if(nOnDemand)
+            errlogPrintf("On demand items: %u, not reporting: %u, monitoring mode changes: %u\n", nOnDemand, nDisabled, nModeChanges);
+        if(nRegistered)
+            errlogPrintf("Nodes registered for writing: %u\n", nRegistered);
+        if(nQueues)
+            errlogPrintf("Records with output queue: %u, writes in flight: %lu, dropped: %u, rejected: %u\n",
+                         nQueues, (unsigned long) writeTransactions.size(), nDropped, nRejected);
+    }
+    if(m_pDevUaSubscription)
+        errlogPrintf("Notifications: %u, values put on the heap: %u copy decode, %u direct decode, write echoes not processed: %u\n",
+                     m_pDevUaSubscription->nNotifications, m_pDevUaSubscription->nAllocs[0],
+                     m_pDevUaSubscription->nAllocs[1], m_pDevUaSubscription->nEchoes);
+    if(verb > 1 && m_pSession->isConnected()) {
+        static const char *modeNames[] = { "Invalid", "None", "Sign", "SignAndEncrypt" };
+        int mode = m_pSession->currentlyUsedSecurityMode();
+        errlogPrintf("Session timeout %g ms, call timeout %d ms, publish requests %d\n", m_pSession->revisedSessionTimeout(),
+                     drvOpcua_CallTimeout, drvOpcua_PublishRequests);
+        errlogPrintf("Endpoint %s, security %s, max. message size request %u response %u\n",
+                     m_pSession->currentlyUsedEndpointUrl().toUtf8(), (mode >= 0 && mode <= 3) ? modeNames[mode] : "?",
+                     m_pSession->maxRequestMessageSize(), m_pSession->maxResponseMessageSize());
+    }
+    if(verb > 1 && m_pDevUaSubscription)
+        errlogPrintf("Subscription: publishing interval %g ms, lifetime count %u, keep alive count %u\n",
+                     m_pDevUaSubscription->publishingInterval, m_pDevUaSubscription->lifetimeCount,
+                     m_pDevUaSubscription->maxKeepAliveCount);
+    m_pWriteScheduler->report(verb);
+    if(pProcessPool)
+        pProcessPool->report(verb);
+    {
+        unsigned int nFailed = 0;
+        for(unsigned int i=0; i<vUaItemInfo.size(); i++) {
+            if(vUaItemInfo[i] && vUaItemInfo[i]->connState == connFailed)
+                nFailed++;
+        }
+        if(nFailed)
+            errlogPrintf("Failed items retried in background: %u\n", nFailed);
+    }
+    for(unsigned int i=0; i<vRegroupSubscriptions.size(); i++)
+        errlogPrintf("Regrouped subscription %u: publishing interval %g ms, notifications: %u\n", i+1,
+                     vRegroupSubscriptions[i]->publishingInterval, vRegroupSubscriptions[i]->nNotifications);
 
     if(verb<1)
         return;
@@ -575,26 +1373,42 @@ void DevUaClient::itemStat(int verb)
     case 1: errlogPrintf("Signals with connection status BAD only:\n");
     case 2: errlogPrintf("idx record Name           epics Type         opcUa Type      Stat NS:PATH\n");
             break;
-    default:errlogPrintf("idx record Name           epics Type         opcUa Type      Stat Sampl QSiz Drop NS:PATH\n");
+    default:errlogPrintf("idx record Name           epics Type         opcUa Type      Stat Sampl(revised) QSiz(revised) Drop NS:PATH\n");
     }
 
     for (unsigned int i=0; i< vUaItemInfo.size(); i++) {
         OPCUA_ItemINFO* uaItem = vUaItemInfo[i];
+        if(!uaItem)
+            continue;
         switch(verb){
         case 1: if(OpcUa_IsGood(uaItem->stat))  // only the bad
                 break;
-        case 2: errlogPrintf("%3d %-20s %2d,%-15s %2d:%-15s %#8x '%s' %s\n",
+                if(uaItem->connState == connFailed)
+                    errlogPrintf("    %s: %s, retries %u\n", uaItem->prec->name, connStateStrings(uaItem->connState), uaItem->nRetries);
+        case 2: errlogPrintf("%3d %-20s %2d,%-15s %2d:%-15s %#8x '%s' %s%s%s\n",
                     uaItem->itemIdx,uaItem->prec->name,
                     uaItem->recDataType,epicsTypeNames[uaItem->recDataType],
                     uaItem->itemDataType,variantTypeStrings(uaItem->itemDataType),
-                    UaStatusCode(uaItem->stat).statusCode(),UaStatus(uaItem->stat).toString().toUtf8(),uaItem->ItemPath );
+                    UaStatusCode(uaItem->stat).statusCode(),UaStatus(uaItem->stat).toString().toUtf8(),uaItem->ItemPath,
+                    uaItem->member ? "|" : "", uaItem->member ? uaItem->member : "" );
                 break;
-        default:errlogPrintf("%3d %-20s %2d,%-15s %2d:%-15s %#8x '%s' %5g %4u %4s %s\n",
+        default:errlogPrintf("%3d %-20s %2d,%-15s %2d:%-15s %#8x '%s' %5g(%5g) %4u(%4u) %4s %s%s%s\n",
                     uaItem->itemIdx,uaItem->prec->name,
                     uaItem->recDataType,epicsTypeNames[uaItem->recDataType],
                     uaItem->itemDataType,variantTypeStrings(uaItem->itemDataType),
-                    UaStatusCode(uaItem->stat).statusCode(),UaStatus(uaItem->stat).toString().toUtf8(), uaItem->samplingInterval,
-                    uaItem->queueSize,( uaItem->discardOldest ? "old" : "new" ), uaItem->ItemPath );
+                    UaStatusCode(uaItem->stat).statusCode(),UaStatus(uaItem->stat).toString().toUtf8(),
+                    uaItem->samplingInterval, uaItem->revisedSamplingInterval,
+                    uaItem->queueSize, uaItem->revisedQueueSize, ( uaItem->discardOldest ? "old" : "new" ), uaItem->ItemPath,
+                    uaItem->member ? "|" : "", uaItem->member ? uaItem->member : "" );
+                if(uaItem->aggregate) {
+                    if(uaItem->aggregate->local)
+                        errlogPrintf("    aggregate %s %g ms, computed by the driver\n", uaItem->aggregate->name(), uaItem->aggregate->interval);
+                    else
+                        errlogPrintf("    aggregate %s %g ms, revised %g ms\n", uaItem->aggregate->name(), uaItem->aggregate->interval,
+                                     uaItem->aggregate->revisedInterval);
+                }
+                if(uaItem->outQueue)
+                    uaItem->outQueue->report();
         }
 
     }
@@ -3,8 +3,14 @@
 
 #include "drvOpcUa.h"
 #include "devUaSubscription.h"
+#include "devUaThreadSched.h"
 #include <string>
+#include <map>
+#include <deque>
 class autoSessionConnect;
+class failedItemRetry;
+class onDemandScan;
+class DevUaWriteScheduler;
 
 class DevUaClient : public UaClientSdk::UaSessionCallback
 {
@@ -19,42 +25,84 @@ public:
 
     UaString applicationCertificate;
     UaString applicationPrivateKey;
+    UaString certificateStorePath;  // PKI: trusted/certs, trusted/crl, issuers/certs, issuers/crl
     UaString hostName;
     UaString url;
     UaStatus connect();
+    UaStatus setupSecurity(UaClientSdk::SessionSecurityInfo &securityInfo);
     UaStatus disconnect();
     UaStatus subscribe();
     UaStatus unsubscribe();
     void setBadQuality();
     bool isConnected() const { return m_pSession->isConnected(); }
-    void addOPCUA_Item(OPCUA_ItemINFO *h);
+    UaClientSdk::UaSession *session() const { return m_pSession; }
+    long addOPCUA_Item(OPCUA_ItemINFO *h);
+    void reserveItems();
+    long removeOPCUA_Item(OPCUA_ItemINFO *h);
+    OPCUA_ItemINFO *findItem(const char *recName, bool *removed);
+    std::vector<OpcUa_UInt32> itemHandles();
     long getNodes();
+    long resolveNodes(const std::vector<OpcUa_UInt32> &handles);
     long getBrowsePathItem(OpcUa_BrowsePath &browsePaths,std::string &ItemPath,const char nameSpaceDelim,const char pathDelimiter);
     UaStatus createMonitoredItems();
+    UaStatus createMonitoredItems(const std::vector<OpcUa_UInt32> &handles);
+    void regroupMonitoredItems();
+    void updateConnState(const std::vector<OpcUa_UInt32> &handles);
+    long retryFailedItems(int *nRecovered);
+    void startOnDemand();
+    void scanInterest();
 
-    UaStatus readFunc(UaDataValues &values,UaClientSdk::ServiceSettings &serviceSettings,UaDiagnosticInfos &diagnosticInfos,int Attribute);
+    UaStatus readFunc(const std::vector<OpcUa_UInt32> &handles, UaDataValues &values,UaClientSdk::ServiceSettings &serviceSettings,UaDiagnosticInfos &diagnosticInfos,int Attribute);
     UaStatus writeFunc(OPCUA_ItemINFO *uaItem, UaVariant &tempValue);
+    UaStatus sendWrite(OPCUA_ItemINFO *uaItem, UaVariant &tempValue);
+    void prepareWrites(const std::vector<OpcUa_UInt32> &handles);
+    void releaseWrites(const std::vector<OpcUa_UInt32> &handles);
 
     void writeComplete(OpcUa_UInt32 transactionId,const UaStatus&result,const UaStatusCodeArray& results,const UaDiagnosticInfos& diagnosticInfos);
 
+    void replayDataChange(const UaDataNotifications &notifications);
+
     void itemStat(int v);
     void setDebug(int debug);
     int  getDebug();
 
     /* To allow record access within the callback function need same index of node-id and itemInfo */
     std::vector<UaNodeId>         vUaNodeId;    // array of node ids as to be used within the opcua library
-    std::vector<OPCUA_ItemINFO *> vUaItemInfo;  // array of record data including the link with the node description
+    std::vector<OPCUA_ItemINFO *> vUaItemInfo;  // array of record data including the link with the node description, NULL for a free slot
+    struct FreeHandle {
+        OpcUa_UInt32 handle;
+        epicsTime freed;
+        double hold;        // s, until late notifications of the deleted monitored item are over
+    };
+    std::deque<FreeHandle>        freeHandles;  // slots of removed items, reused by addOPCUA_Item() after hold
+    std::vector<OPCUA_ItemINFO *> removedItems; // by removeOPCUA_Item(), opcuaRetarget adds them again
+    /* Guards the item tables above, the share maps and trigger links of the subscriptions
+     * against setup, retarget, retry, interest scan and reconnect running on the iocsh,
+     * SDK and timer threads. Held across service calls, never taken in dataChange(). */
+    epicsMutexId itemLock;
 
+    bool monitorsActive;                       // OpcUaSetupMonitors() done, new items are set up one by one
     double drvOpcua_AutoConnectInterval;       // Configurable default for auto connection attempt interval
 
 private:
+    void itemStatLocked(int v);
+
     int debug;
     int autoConnect;
     UaClientSdk::UaSession* m_pSession;
     DevUaSubscription* m_pDevUaSubscription;
+    DevUaWriteScheduler* m_pWriteScheduler;
+    std::vector<DevUaSubscription*> vRegroupSubscriptions; // items moved here by regroupMonitoredItems()
     UaClientSdk::UaClient::ServerStatus serverConnectionStatus;
     bool initialSubscriptionOver;
     autoSessionConnect *autoConnector;
+    failedItemRetry *retryTimer;
+    onDemandScan *onDemandTimer;
+    epicsUInt32 nModeChanges;   // monitored items switched by scanInterest()
+    // writes in flight by transaction id, an item with an output queue has several
+    std::map<OpcUa_UInt32, OPCUA_ItemINFO *> writeTransactions;
+    OpcUa_UInt32 nextTransaction;
+    epicsMutexId transactionLock;
     epicsTimerQueueActive &queue;
 };
 
@@ -69,6 +117,7 @@ public:
     virtual ~autoSessionConnect() { timer.destroy(); }
     void start() { timer.start(*this, delay); }
     virtual expireStatus expire(const epicsTime &/*currentTime*/) {
+        uaThreadSched(thrTimer);
         UaStatus result = client->connect();
         if (result.isBad()) {
             return expireStatus(restart, delay);
@@ -81,4 +130,62 @@ private:
     DevUaClient *client;
     const double delay;
 };
+/* Timer to set up failed items again, e.g. nodes created on the server after the IOC
+ * subscribed. The delay doubles while no item recovers, up to drvOpcua_RetryMaxInterval. */
+class failedItemRetry : public epicsTimerNotify {
+public:
+    failedItemRetry(DevUaClient *client, epicsTimerQueueActive &queue)
+        : timer(queue.createTimer())
+        , client(client)
+        , delay(0.0)
+        , active(false)
+        , again(false)
+        , lock(epicsMutexMustCreate())
+    {}
+    virtual ~failedItemRetry() { timer.destroy(); epicsMutexDestroy(lock); }
+    void start(double minDelay) {
+        epicsMutexLock(lock);
+        if(active) {
+            again = true;       // failed meanwhile, don't let expire() stop
+            epicsMutexUnlock(lock);
+            return;
+        }
+        active = true;
+        again = false;
+        delay = minDelay;
+        epicsMutexUnlock(lock);
+        timer.start(*this, minDelay);
+    }
+    void cancel() {
+        timer.cancel();
+        epicsMutexLock(lock);
+        active = false;
+        epicsMutexUnlock(lock);
+    }
+    virtual expireStatus expire(const epicsTime &/*currentTime*/);
+private:
+    epicsTimer &timer;
+    DevUaClient *client;
+    double delay;
+    bool active;
+    bool again;
+    epicsMutexId lock;      // guards active, again and delay: start() runs on other threads
+};
+/* Timer to switch the monitoring mode of on demand items by the interest in their records,
+ * see DevUaClient::scanInterest() */
+class onDemandScan : public epicsTimerNotify {
+public:
+    onDemandScan(DevUaClient *client, epicsTimerQueueActive &queue)
+        : timer(queue.createTimer())
+        , client(client)
+        , running(false)
+    {}
+    virtual ~onDemandScan() { timer.destroy(); }
+    void start(double delay) { if(!running) timer.start(*this, delay); running = true; }
+    virtual expireStatus expire(const epicsTime &/*currentTime*/);
+private:
+    epicsTimer &timer;
+    DevUaClient *client;
+    bool running;           // started once, restarts itself. Guarded by DevUaClient::itemLock
+};
 #endif // DEVUACLIENT_H
@@ -0,0 +1,124 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include "devUaConvert.h"
+
+// Table columns. Don't index by epicsType, its numbering differs between EPICS versions.
+enum { colInt8, colUInt8, colInt16, colUInt16, colInt32, colUInt32, colFloat32, colFloat64, nCols };
+
+static int epicsColumn(epicsType type)
+{
+    switch(type) {
+    case epicsInt8T:    return colInt8;
+    case epicsUInt8T:   return colUInt8;
+    case epicsInt16T:   return colInt16;
+    case epicsEnum16T:
+    case epicsUInt16T:  return colUInt16;
+    case epicsInt32T:   return colInt32;
+    case epicsUInt32T:  return colUInt32;
+    case epicsFloat32T: return colFloat32;
+    case epicsFloat64T: return colFloat64;
+    default:            return -1;
+    }
+}
+
+#define READ_ROW(UATYPE) { \
+    UaReadConv<UATYPE, epicsInt8>::conv,    UaReadConv<UATYPE, epicsUInt8>::conv, \
+    UaReadConv<UATYPE, epicsInt16>::conv,   UaReadConv<UATYPE, epicsUInt16>::conv, \
+    UaReadConv<UATYPE, epicsInt32>::conv,   UaReadConv<UATYPE, epicsUInt32>::conv, \
+    UaReadConv<UATYPE, epicsFloat32>::conv, UaReadConv<UATYPE, epicsFloat64>::conv }
+
+#define WRITE_ROW(UATYPE) { \
+    UaWriteConv<epicsInt8, UATYPE>::conv,    UaWriteConv<epicsUInt8, UATYPE>::conv, \
+    UaWriteConv<epicsInt16, UATYPE>::conv,   UaWriteConv<epicsUInt16, UATYPE>::conv, \
+    UaWriteConv<epicsInt32, UATYPE>::conv,   UaWriteConv<epicsUInt32, UATYPE>::conv, \
+    UaWriteConv<epicsFloat32, UATYPE>::conv, UaWriteConv<epicsFloat64, UATYPE>::conv }
+
+#define ARRAY_ROW(UATYPE) { \
+    UaArrayConv<UATYPE, epicsInt8>::conv,    UaArrayConv<UATYPE, epicsUInt8>::conv, \
+    UaArrayConv<UATYPE, epicsInt16>::conv,   UaArrayConv<UATYPE, epicsUInt16>::conv, \
+    UaArrayConv<UATYPE, epicsInt32>::conv,   UaArrayConv<UATYPE, epicsUInt32>::conv, \
+    UaArrayConv<UATYPE, epicsFloat32>::conv, UaArrayConv<UATYPE, epicsFloat64>::conv }
+
+// Rows: OpcUaType_Boolean .. OpcUaType_Double
+static const UaReadConverter readTable[OpcUaType_Double][nCols] = {
+    READ_ROW(OpcUaType_Boolean),
+    READ_ROW(OpcUaType_SByte),
+    READ_ROW(OpcUaType_Byte),
+    READ_ROW(OpcUaType_Int16),
+    READ_ROW(OpcUaType_UInt16),
+    READ_ROW(OpcUaType_Int32),
+    READ_ROW(OpcUaType_UInt32),
+    READ_ROW(OpcUaType_Int64),
+    READ_ROW(OpcUaType_UInt64),
+    READ_ROW(OpcUaType_Float),
+    READ_ROW(OpcUaType_Double)
+};
+
+static const UaWriteConverter writeTable[OpcUaType_Double][nCols] = {
+    WRITE_ROW(OpcUaType_Boolean),
+    WRITE_ROW(OpcUaType_SByte),
+    WRITE_ROW(OpcUaType_Byte),
+    WRITE_ROW(OpcUaType_Int16),
+    WRITE_ROW(OpcUaType_UInt16),
+    WRITE_ROW(OpcUaType_Int32),
+    WRITE_ROW(OpcUaType_UInt32),
+    WRITE_ROW(OpcUaType_Int64),
+    WRITE_ROW(OpcUaType_UInt64),
+    WRITE_ROW(OpcUaType_Float),
+    WRITE_ROW(OpcUaType_Double)
+};
+
+static const UaArrayConverter arrayTable[OpcUaType_Double][nCols] = {
+    ARRAY_ROW(OpcUaType_Boolean),
+    ARRAY_ROW(OpcUaType_SByte),
+    ARRAY_ROW(OpcUaType_Byte),
+    ARRAY_ROW(OpcUaType_Int16),
+    ARRAY_ROW(OpcUaType_UInt16),
+    ARRAY_ROW(OpcUaType_Int32),
+    ARRAY_ROW(OpcUaType_UInt32),
+    ARRAY_ROW(OpcUaType_Int64),
+    ARRAY_ROW(OpcUaType_UInt64),
+    ARRAY_ROW(OpcUaType_Float),
+    ARRAY_ROW(OpcUaType_Double)
+};
+
+// NULL if there is no compiled converter for the pair, e.g. for strings
+UaReadConverter uaReadConverter(int opcUaType, epicsType recType)
+{
+    int col = epicsColumn(recType);
+    if (opcUaType < OpcUaType_Boolean || opcUaType > OpcUaType_Double || col < 0)
+        return NULL;
+    return readTable[opcUaType - OpcUaType_Boolean][col];
+}
+
+UaWriteConverter uaWriteConverter(epicsType recType, int opcUaType)
+{
+    int col = epicsColumn(recType);
+    if (opcUaType < OpcUaType_Boolean || opcUaType > OpcUaType_Double || col < 0)
+        return NULL;
+    return writeTable[opcUaType - OpcUaType_Boolean][col];
+}
+
+UaArrayConverter uaArrayConverter(int opcUaType, epicsType recType)
+{
+    int col = epicsColumn(recType);
+    if (opcUaType < OpcUaType_Boolean || opcUaType > OpcUaType_Double || col < 0)
+        return NULL;
+    return arrayTable[opcUaType - OpcUaType_Boolean][col];
+}
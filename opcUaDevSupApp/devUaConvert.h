@@ -0,0 +1,112 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUACONVERT_H
+#define DEVUACONVERT_H
+
+#include <limits>
+#include <epicsTypes.h>
+#include <uavariant.h>
+
+/* Scalar converters between OPC UA built-in types and EPICS types.
+ *
+ * The converters are generated from templates for each pair of OPC UA numeric
+ * type x EPICS numeric type and bound to an item once its node data type is
+ * known (OpcUaSetupMonitors). Record processing then calls the bound function
+ * directly instead of walking the UaVariant conversion switches.
+ */
+
+// OPC UA scalar -> EPICS value at dst. Return 0 ok, 1 out of range
+typedef long (*UaReadConverter)(const OpcUa_Variant &val, void *dst);
+// EPICS value at src -> UaVariant of the node data type. Return 0 ok
+typedef long (*UaWriteConverter)(const void *src, UaVariant &var);
+
+// n elements of an OPC UA array -> n elements of the EPICS type
+typedef void (*UaArrayConverter)(const void *src, void *dst, epicsUInt32 n);
+
+UaReadConverter  uaReadConverter(int opcUaType, epicsType recType);
+UaWriteConverter uaWriteConverter(epicsType recType, int opcUaType);
+UaArrayConverter uaArrayConverter(int opcUaType, epicsType recType);
+
+template<int UaType> struct UaScalar;
+
+#define UA_SCALAR(UATYPE, CTYPE, MEMBER, SETTER) \
+template<> struct UaScalar<UATYPE> { \
+    typedef CTYPE type; \
+    static type get(const OpcUa_Variant &val) { return val.Value.MEMBER; } \
+    static void set(UaVariant &var, type x)   { var.SETTER(x); } \
+};
+UA_SCALAR(OpcUaType_Boolean, OpcUa_Boolean, Boolean, setBool)
+UA_SCALAR(OpcUaType_SByte,   OpcUa_SByte,   SByte,   setSByte)
+UA_SCALAR(OpcUaType_Byte,    OpcUa_Byte,    Byte,    setByte)
+UA_SCALAR(OpcUaType_Int16,   OpcUa_Int16,   Int16,   setInt16)
+UA_SCALAR(OpcUaType_UInt16,  OpcUa_UInt16,  UInt16,  setUInt16)
+UA_SCALAR(OpcUaType_Int32,   OpcUa_Int32,   Int32,   setInt32)
+UA_SCALAR(OpcUaType_UInt32,  OpcUa_UInt32,  UInt32,  setUInt32)
+UA_SCALAR(OpcUaType_Int64,   OpcUa_Int64,   Int64,   setInt64)
+UA_SCALAR(OpcUaType_UInt64,  OpcUa_UInt64,  UInt64,  setUInt64)
+UA_SCALAR(OpcUaType_Float,   OpcUa_Float,   Float,   setFloat)
+UA_SCALAR(OpcUaType_Double,  OpcUa_Double,  Double,  setDouble)
+#undef UA_SCALAR
+
+// value fits into the EPICS type. Floating point targets take everything.
+template<typename EP, typename UA>
+inline bool uaInRange(UA v)
+{
+    return !std::numeric_limits<EP>::is_integer
+        || ((double) v >= (double) std::numeric_limits<EP>::min()
+            && (double) v <= (double) std::numeric_limits<EP>::max());
+}
+
+template<int UaType, typename EP>
+struct UaReadConv {
+    static long conv(const OpcUa_Variant &val, void *dst) {
+        typename UaScalar<UaType>::type v = UaScalar<UaType>::get(val);
+        if (!uaInRange<EP>(v))
+            return 1;
+        *(EP *) dst = (EP) v;
+        return 0;
+    }
+};
+
+template<typename EP, int UaType>
+struct UaWriteConv {
+    static long conv(const void *src, UaVariant &var) {
+        UaScalar<UaType>::set(var, (typename UaScalar<UaType>::type) *(const EP *) src);
+        return 0;
+    }
+};
+
+template<typename EP>
+struct UaWriteConv<EP, OpcUaType_Boolean> {
+    static long conv(const void *src, UaVariant &var) {
+        var.setBool((0 != *(const EP *) src) ? OpcUa_True : OpcUa_False);
+        return 0;
+    }
+};
+
+template<int UaType, typename EP>
+struct UaArrayConv {
+    static void conv(const void *src, void *dst, epicsUInt32 n) {
+        const typename UaScalar<UaType>::type *s = (const typename UaScalar<UaType>::type *) src;
+        EP *d = (EP *) dst;
+        for (epicsUInt32 i = 0; i < n; i++)
+            d[i] = (EP) s[i];
+    }
+};
+
+#endif // DEVUACONVERT_H
@@ -0,0 +1,142 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <string.h>
+#include <vector>
+
+#include <epicsMutex.h>
+#include <errlog.h>
+#include <epicsExport.h>
+#include <uabase.h>
+
+#include "devUaLatency.h"
+
+// Record latency histograms, see opcuaStat
+int drvOpcua_LatencyStats = 1;
+
+extern "C" {
+    epicsExportAddress(int, drvOpcua_LatencyStats);
+}
+
+static std::vector<DevUaLatency *> latencySets;
+static epicsMutexId latencyLock = NULL;
+
+DevUaLatencyHist::DevUaLatencyHist()
+{
+    reset();
+}
+
+void DevUaLatencyHist::reset()
+{
+    memset(count, 0, sizeof(count));
+    n = 0;
+    nNegative = 0;
+    sumUs = 0;
+}
+
+double DevUaLatencyHist::bucketLow(int b)
+{
+    if(b < OPCUA_LAT_SUB)
+        return b;
+    int e = b / OPCUA_LAT_SUB + 2;
+    int sub = b % OPCUA_LAT_SUB;
+    return (double)(1ULL << e) + sub * (double)(1ULL << (e-3));
+}
+
+double DevUaLatencyHist::percentile(double p) const
+{
+    double total = 0, sum = 0;
+    int b;
+
+    for(b=0; b<OPCUA_LAT_BUCKETS; b++)
+        total += count[b];
+    if(total == 0)
+        return 0.0;
+    for(b=0; b<OPCUA_LAT_BUCKETS; b++) {
+        sum += count[b];
+        if(sum >= p * total)
+            break;
+    }
+    if(b >= OPCUA_LAT_BUCKETS - 1)
+        return bucketLow(OPCUA_LAT_BUCKETS - 1);
+    return bucketLow(b+1);      // upper bound of the bucket
+}
+
+void DevUaLatencyHist::report(const char *name, const char *what) const
+{
+    int max;
+
+    if(n == 0)
+        return;
+    for(max=OPCUA_LAT_BUCKETS-1; max>0 && count[max]==0; max--)
+        ;
+    errlogPrintf("  %-20s %-12s %9d %10.3f %10.3f %10.3f %10.3f %10.3f %6d\n", name, what, n,
+                 sumUs / 1000.0 / n, percentile(0.5) / 1000.0, percentile(0.9) / 1000.0,
+                 percentile(0.99) / 1000.0, bucketLow(max+1 < OPCUA_LAT_BUCKETS ? max+1 : max) / 1000.0, nNegative);
+}
+
+uint64_t uaTicksNow()
+{
+    OpcUa_DateTime now = UaDateTime::now();
+    return uaTicks(now);
+}
+
+DevUaLatency *latencyFind(const char *name, int create)
+{
+    DevUaLatency *pLat = NULL;
+
+    if(!latencyLock)        // first call is from init_record, single threaded
+        latencyLock = epicsMutexMustCreate();
+    epicsMutexLock(latencyLock);
+    for(unsigned int i=0; i<latencySets.size(); i++) {
+        if(!strcmp(latencySets[i]->name, name)) {
+            pLat = latencySets[i];
+            break;
+        }
+    }
+    if(!pLat && create) {
+        pLat = new DevUaLatency;
+        strncpy(pLat->name, name, sizeof(pLat->name)-1);
+        pLat->name[sizeof(pLat->name)-1] = 0;
+        latencySets.push_back(pLat);
+    }
+    epicsMutexUnlock(latencyLock);
+    return pLat;
+}
+
+void latencyReport(int verb)
+{
+    if(!drvOpcua_LatencyStats || !latencyLock)
+        return;
+    epicsMutexLock(latencyLock);
+    errlogPrintf("Latency [ms]:          path             count       mean        p50        p90        p99        max clock<0\n");
+    for(unsigned int i=0; i<latencySets.size(); i++) {
+        latencySets[i]->srvToRcv.report(latencySets[i]->name, "server->rcv");
+        latencySets[i]->rcvToProc.report(latencySets[i]->name, "rcv->proc");
+        if(verb >= 3) {
+            DevUaLatencyHist *h[2] = { &latencySets[i]->srvToRcv, &latencySets[i]->rcvToProc };
+            for(int k=0; k<2; k++) {
+                for(int b=0; b<OPCUA_LAT_BUCKETS; b++) {
+                    if(h[k]->count[b])
+                        errlogPrintf("    %s >=%gus: %d\n", k ? "rcv->proc" : "server->rcv", DevUaLatencyHist::bucketLow(b), h[k]->count[b]);
+                }
+            }
+        }
+    }
+    epicsMutexUnlock(latencyLock);
+}
@@ -0,0 +1,88 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUALATENCY_H
+#define DEVUALATENCY_H
+
+#include <stdint.h>
+#include <epicsTypes.h>
+#include <epicsAtomic.h>
+#include <opcua_proxystub.h>
+
+#define OPCUA_LAT_SUB     8     // sub-buckets per power of 2
+#define OPCUA_LAT_BUCKETS 240   // covers 0 .. 2^32 us
+
+/* Log-linear latency histogram in microseconds. Values below 8us have their own
+ * bucket, above there are OPCUA_LAT_SUB buckets per power of 2, so the relative
+ * error is below 12.5%. add() only does atomic increments, no lock, it may be
+ * called from any thread. The sum is a size_t, it wraps after 71 minutes of summed
+ * latency on 32 bit targets. Readers see a consistent enough snapshot for statistics.
+ */
+class DevUaLatencyHist
+{
+public:
+    DevUaLatencyHist();
+    void add(int64_t usec) {
+        if(usec < 0) {          // clocks of server and IOC differ
+            epicsAtomicIncrIntT(&nNegative);
+            usec = 0;
+        }
+        if(usec > 0xffffffffLL)
+            usec = 0xffffffffLL;
+        epicsAtomicIncrIntT(&count[bucket((epicsUInt32) usec)]);
+        epicsAtomicIncrIntT(&n);
+        epicsAtomicAddSizeT(&sumUs, (size_t) usec);
+    }
+    static int bucket(epicsUInt32 usec) {
+        if(usec < OPCUA_LAT_SUB)
+            return usec;
+        int e = 3;                          // highest bit set
+        while(usec >> (e+1))
+            e++;
+        return (e-2)*OPCUA_LAT_SUB + ((usec >> (e-3)) & (OPCUA_LAT_SUB-1));
+    }
+    static double bucketLow(int b);         // lower bound of bucket b, us
+    double percentile(double p) const;      // us, 0 if empty
+    void reset();
+    void report(const char *name, const char *what) const;
+
+    int count[OPCUA_LAT_BUCKETS];
+    int n;
+    int nNegative;
+    size_t sumUs;
+};
+
+// Latencies of a subscription or of a record type
+struct DevUaLatency {
+    char name[40];
+    DevUaLatencyHist srvToRcv;      // server timestamp -> dataChange
+    DevUaLatencyHist rcvToProc;     // dataChange -> record processed
+};
+
+// 100ns ticks since 1601 as OPC UA DateTime
+inline uint64_t uaTicks(const OpcUa_DateTime &t) {
+    return ((uint64_t) t.dwHighDateTime << 32) | t.dwLowDateTime;
+}
+uint64_t uaTicksNow();
+
+// Find the latency set by name, create it if create is set. Sets are never deleted.
+DevUaLatency *latencyFind(const char *name, int create);
+void latencyReport(int verb);
+
+extern int drvOpcua_LatencyStats;
+
+#endif // DEVUALATENCY_H
@@ -0,0 +1,190 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <stdlib.h>
+#include <epicsString.h>
+#include <epicsExport.h>
+
+#include "devUaOutQueue.h"
+#include "devUaClient.h"
+
+// Max. writes of a record with an output queue in flight at a time
+static int drvOpcua_WritePipeline = 4;
+
+extern "C" {
+    epicsExportAddress(int, drvOpcua_WritePipeline);
+}
+
+DevUaOutQueue::DevUaOutQueue(int size, int keepLast)
+    : size(size)
+    , keepLast(keepLast)
+    , nWrites(0)
+    , nDropped(0)
+    , nRejected(0)
+    , nFailed(0)
+    , inFlight(0)
+    , nBusy(0)
+    , failed(0)
+    , rdbkSkipped(0)
+    , sending(0)
+    , lock(epicsMutexMustCreate())
+{
+}
+
+DevUaOutQueue::~DevUaOutQueue()
+{
+    epicsMutexDestroy(lock);
+}
+
+DevUaOutQueue *DevUaOutQueue::create(const char *size, const char *policy, const char *recName)
+{
+    char *end;
+    long n = strtol(size, &end, 10);
+    int keepLast = 0;
+
+    if(end == size || *end || n < 1) {
+        errlogPrintf("%s: info(opcua:WQUEUE) '%s' must be the number of waiting writes, ignored\n", recName, size);
+        return NULL;
+    }
+    if(policy) {
+        if(epicsStrCaseCmp(policy, "LAST") == 0)
+            keepLast = 1;
+        else if(epicsStrCaseCmp(policy, "ALL") != 0) {
+            errlogPrintf("%s: info(opcua:WPOLICY) '%s' must be ALL or LAST, ignored\n", recName, policy);
+            return NULL;
+        }
+    }
+    return new DevUaOutQueue((int) n, keepLast);
+}
+
+/* Send waiting writes while the pipeline has room. Call with lock held, it is released
+ * while a write is sent: a failing write may complete writes of other records, see
+ * DevUaWriteScheduler::failWrite(). Only one thread sends, so the order is kept. */
+void DevUaOutQueue::sendNext(OPCUA_ItemINFO *uaItem)
+{
+    int window = (drvOpcua_WritePipeline > 0) ? drvOpcua_WritePipeline : 1;
+
+    if(sending)     // the sending thread picks up the new value
+        return;
+    sending = 1;
+    while(inFlight < window && !waiting.empty()) {
+        UaVariant value = waiting.front();
+        waiting.pop_front();
+        inFlight++;
+        nBusy = inFlight + (int) waiting.size();
+        epicsMutexUnlock(lock);
+        // the write scheduler keeps the order: all writes of the record are in its class
+        UaStatus status = pMyClient->writeFunc(uaItem, value);
+        epicsMutexLock(lock);
+        if(status.isBad()) {    // no writeComplete will follow
+            inFlight--;
+            failed = 1;
+            nFailed++;
+            uaItem->stat = status.statusCode();
+            if(uaItem->debug >= 1)
+                errlogPrintf("%s: queued write failed: %s\n", uaItem->prec->name, status.toString().toUtf8());
+        }
+    }
+    sending = 0;
+    nBusy = inFlight + (int) waiting.size();
+}
+
+long DevUaOutQueue::put(OPCUA_ItemINFO *uaItem, UaVariant &value)
+{
+    long ret = 0;
+
+    epicsMutexLock(lock);
+    nWrites++;
+    if((int) waiting.size() >= size) {
+        if(keepLast) {
+            waiting.pop_front();
+            nDropped++;
+        }
+        else {
+            nRejected++;
+            uaItem->stat = OpcUa_BadTooManyOperations;
+            if(uaItem->debug >= 1)
+                errlogPrintf("%s: output queue full, write rejected\n", uaItem->prec->name);
+            epicsMutexUnlock(lock);
+            return 1;
+        }
+    }
+    waiting.push_back(value);
+    if(uaItem->debug >= 2)
+        errlogPrintf("%s: write queued, %d in flight, %lu waiting\n", uaItem->prec->name, inFlight, (unsigned long) waiting.size());
+    sendNext(uaItem);
+    if(failed) {
+        failed = 0;
+        ret = 1;
+    }
+    epicsMutexUnlock(lock);
+    return ret;
+}
+
+void DevUaOutQueue::complete(OPCUA_ItemINFO *uaItem, OpcUa_StatusCode stat)
+{
+    int readback;
+
+    epicsMutexLock(lock);
+    if(inFlight > 0)
+        inFlight--;
+    if(OpcUa_IsBad(stat)) {
+        failed = 1;
+        nFailed++;
+    }
+    sendNext(uaItem);
+    readback = (failed || rdbkSkipped) && !nBusy;
+    if(readback)
+        rdbkSkipped = 0;
+    epicsMutexUnlock(lock);
+    if(readback) {  // show the alarm and the value the server has now
+        epicsMutexLock(uaItem->flagLock);
+        uaItem->echoArmed = 0;  // the echo of the last write may still come, process it
+        epicsMutexUnlock(uaItem->flagLock);
+        callbackRequest(&(uaItem->callback));
+    }
+}
+
+int DevUaOutQueue::skipReadback(int echo)
+{
+    int skip;
+
+    epicsMutexLock(lock);
+    skip = (nBusy != 0);
+    if(skip)
+        rdbkSkipped = !echo;
+    epicsMutexUnlock(lock);
+    return skip;
+}
+
+int DevUaOutQueue::takeFailed()
+{
+    int f;
+
+    epicsMutexLock(lock);
+    f = failed;
+    failed = 0;
+    epicsMutexUnlock(lock);
+    return f;
+}
+
+void DevUaOutQueue::report() const
+{
+    errlogPrintf("    output queue %d %s: %d in flight, %d waiting, writes %u, dropped %u, rejected %u, failed %u\n",
+                 size, policyName(), inFlight, nBusy - inFlight, nWrites, nDropped, nRejected, nFailed);
+}
@@ -0,0 +1,77 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUAOUTQUEUE_H
+#define DEVUAOUTQUEUE_H
+
+#include <deque>
+#include <epicsMutex.h>
+#include "drvOpcUa.h"
+
+/* Output queue of a record: An OUT record with an info item like info(opcua:WQUEUE, "8")
+ * doesn't wait for the completion of its write. Its writes are queued at the item, up to
+ * drvOpcua_WritePipeline of them are in flight at a time in the order they were written.
+ * If more than 8 writes wait, the policy from info(opcua:WPOLICY, "ALL") applies: ALL
+ * rejects the new write with a WRITE alarm, LAST drops the oldest waiting value, so a
+ * setpoint stream always ends with its newest value. A failed write sets a WRITE alarm
+ * at the next processing of the record, which is requested when the queue is empty.
+ * So is the readback of a data change that came while writes were queued.
+ */
+class DevUaOutQueue
+{
+    UA_DISABLE_COPY(DevUaOutQueue);
+public:
+    // Parse size and policy from the info items, NULL on error
+    static DevUaOutQueue *create(const char *size, const char *policy, const char *recName);
+    ~DevUaOutQueue();
+
+    // queue a write of the record and send what the pipeline allows, 1 if a write failed
+    long put(OPCUA_ItemINFO *uaItem, UaVariant &value);
+    // a write of the item is done, send the next one
+    void complete(OPCUA_ItemINFO *uaItem, OpcUa_StatusCode stat);
+    // writes waiting or in flight, read without lock
+    int busy() const { return nBusy; }
+    /* data change of the item: return 1 if writes are waiting or in flight, the
+     * readback is then done when the queue is empty unless the last data change
+     * was the echo of the last write */
+    int skipReadback(int echo);
+    // 1 if a write failed since the last call
+    int takeFailed();
+    const char *policyName() const { return keepLast ? "LAST" : "ALL"; }
+    void report() const;
+
+    int size;                   // max. writes waiting
+    int keepLast;               // full queue: drop the oldest waiting value instead of the new one
+    epicsUInt32 nWrites;        // writes of the record
+    epicsUInt32 nDropped;       // waiting values dropped by policy LAST
+    epicsUInt32 nRejected;      // writes rejected by policy ALL
+    epicsUInt32 nFailed;        // writes failed at the server or not sent
+
+private:
+    DevUaOutQueue(int size, int keepLast);
+    void sendNext(OPCUA_ItemINFO *uaItem);
+
+    std::deque<UaVariant> waiting;
+    int inFlight;
+    volatile int nBusy;
+    int failed;
+    int rdbkSkipped;        // the last data change while busy was not the echo of the last write
+    int sending;            // a thread is in sendNext(), it sends what the others queue
+    epicsMutexId lock;
+};
+
+#endif // DEVUAOUTQUEUE_H
@@ -0,0 +1,158 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <stdio.h>
+
+#include <epicsExport.h>
+#include <dbAccess.h>
+#include <dbScan.h>
+
+#include "devUaProcessPool.h"
+
+// Number of worker threads to process records, 0 = scanIoRequest and callback threads
+static int drvOpcua_ProcessThreads = 0;
+
+extern "C" {
+    epicsExportAddress(int, drvOpcua_ProcessThreads);
+}
+
+DevUaProcessPool *pProcessPool = NULL;
+
+long processPoolSetup(size_t nItems)
+{
+    if(drvOpcua_ProcessThreads <= 0 || pProcessPool)
+        return 0;
+    pProcessPool = new DevUaProcessPool(drvOpcua_ProcessThreads, nItems);
+    return 0;
+}
+
+// The workers block on their event until the IOC exits, the pool is never deleted
+DevUaProcessPool::DevUaProcessPool(int nThreads, size_t nItems)
+    : started(epicsTime::getCurrent())
+{
+    rangeSize = (nItems + nThreads - 1) / nThreads;
+    if(rangeSize == 0)
+        rangeSize = 1;
+    for(int i=0; i<nThreads; i++) {
+        char name[20];
+        Worker *w = new Worker;
+        w->index      = i;
+        w->lock       = epicsMutexMustCreate();
+        w->event      = epicsEventMustCreate(epicsEventEmpty);
+        w->nProcessed = 0;
+        w->nCoalesced = 0;
+        w->nBatches   = 0;
+        w->maxBatch   = 0;
+        w->busy       = 0.0;
+        workers.push_back(w);
+        sprintf(name, "opcuaProc%d", i);
+        w->tid = epicsThreadMustCreate(name, epicsThreadPriorityScanHigh,
+                                       epicsThreadGetStackSize(epicsThreadStackBig), workerThread, w);
+    }
+}
+
+void DevUaProcessPool::request(OPCUA_ItemINFO *uaItem)
+{
+    Worker *w = workers[(uaItem->itemIdx / rangeSize) % workers.size()];
+    bool wake;
+
+    epicsMutexLock(w->lock);
+    if(uaItem->procQueued) {
+        w->nCoalesced++;
+        epicsMutexUnlock(w->lock);
+        return;
+    }
+    uaItem->procQueued = 1;
+    wake = w->queue.empty();
+    w->queue.push_back(uaItem);
+    epicsMutexUnlock(w->lock);
+    if(wake)
+        epicsEventSignal(w->event);
+}
+
+// Same as the callback threads for OUT records and the I/O Intr scan for IN records do
+void DevUaProcessPool::process(OPCUA_ItemINFO *uaItem)
+{
+    dbCommon *prec = uaItem->prec;
+
+    UA_TRACE("procPool", prec->name, uaItem->itemIdx, 0);
+    if(uaItem->inpDataType) {   // OUT record: readback, see outRecordCallback()
+        uaItem->callback.callback(&(uaItem->callback));
+        return;
+    }
+    dbScanLock(prec);
+    dbProcess(prec);
+    dbScanUnlock(prec);
+}
+
+void DevUaProcessPool::workerThread(void *arg)
+{
+    Worker *w = (Worker *) arg;
+    std::vector<OPCUA_ItemINFO *> batch;
+
+    for(;;) {
+        epicsEventMustWait(w->event);
+        uaThreadSched(thrWorker);
+        epicsMutexLock(w->lock);
+        batch.swap(w->queue);
+        for(size_t i=0; i<batch.size(); i++)
+            batch[i]->procQueued = 0;   // an update from now on queues the record again
+        epicsMutexUnlock(w->lock);
+        if(batch.empty())
+            continue;
+
+        epicsTime start = epicsTime::getCurrent();
+        for(size_t i=0; i<batch.size(); i++)
+            process(batch[i]);
+        double t = epicsTime::getCurrent() - start;
+
+        epicsMutexLock(w->lock);
+        w->nProcessed += batch.size();
+        w->nBatches++;
+        if(batch.size() > w->maxBatch)
+            w->maxBatch = batch.size();
+        w->busy += t;
+        epicsMutexUnlock(w->lock);
+        batch.clear();
+    }
+}
+
+void DevUaProcessPool::report(int verb)
+{
+    double elapsed = epicsTime::getCurrent() - started;
+    epicsUInt32 total = 0;
+    double busy = 0.0;
+
+    errlogPrintf("Process pool: %u threads, %lu item handles each\n", (unsigned) workers.size(), (unsigned long) rangeSize);
+    if(verb > 1)
+        errlogPrintf("    thread  processed  coalesced  batches  maxBatch  queued  busy[s]  records/s busy\n");
+    for(size_t i=0; i<workers.size(); i++) {
+        Worker *w = workers[i];
+        epicsMutexLock(w->lock);
+        total += w->nProcessed;
+        busy  += w->busy;
+        if(verb > 1)
+            errlogPrintf("    %6d %10u %10u %8u %9lu %7lu %8.3f %15.0f\n", w->index, w->nProcessed, w->nCoalesced,
+                         w->nBatches, (unsigned long) w->maxBatch, (unsigned long) w->queue.size(), w->busy,
+                         w->busy > 0.0 ? w->nProcessed / w->busy : 0.0);
+        epicsMutexUnlock(w->lock);
+    }
+    errlogPrintf("    %u records in %.3f s: %.0f records/s, utilization %.1f%% of %u threads\n", total, elapsed,
+                 elapsed > 0.0 ? total / elapsed : 0.0, elapsed > 0.0 ? 100.0 * busy / elapsed / workers.size() : 0.0,
+                 (unsigned) workers.size());
+}
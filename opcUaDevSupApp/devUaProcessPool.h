@@ -0,0 +1,70 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUAPROCESSPOOL_H
+#define DEVUAPROCESSPOOL_H
+
+#include <vector>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+#include <epicsThread.h>
+#include <epicsTime.h>
+#include "drvOpcUa.h"
+
+/* Process pool: Records updated by a notification batch are processed by a pool of
+ * worker threads instead of the scanIoRequest queue and the callback threads. Each
+ * worker owns a contiguous range of item handles, so a record is always processed by
+ * the same worker and the order of its updates is kept. A record queued again before
+ * its worker got to it is processed once with the latest value.
+ * Enabled by drvOpcua_ProcessThreads > 0 before OpcUaSetupMonitors().
+ */
+class DevUaProcessPool
+{
+    UA_DISABLE_COPY(DevUaProcessPool);
+public:
+    DevUaProcessPool(int nThreads, size_t nItems);
+
+    // queue the record of the item on the worker of its handle range
+    void request(OPCUA_ItemINFO *uaItem);
+    void report(int verb);
+
+private:
+    struct Worker {
+        int index;
+        epicsThreadId tid;
+        epicsMutexId lock;
+        epicsEventId event;
+        std::vector<OPCUA_ItemINFO *> queue;
+        epicsUInt32 nProcessed;
+        epicsUInt32 nCoalesced;     // requests for records already queued
+        epicsUInt32 nBatches;       // wakeups
+        size_t maxBatch;
+        double busy;                // s, spent processing records
+    };
+    static void workerThread(void *arg);
+    static void process(OPCUA_ItemINFO *uaItem);
+
+    std::vector<Worker *> workers;
+    size_t rangeSize;               // item handles per worker
+    epicsTime started;
+};
+
+extern DevUaProcessPool *pProcessPool;
+// Create the pool if drvOpcua_ProcessThreads > 0. nItems: number of item handles to partition
+long processPoolSetup(size_t nItems);
+
+#endif // DEVUAPROCESSPOOL_H
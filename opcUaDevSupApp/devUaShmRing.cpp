@@ -0,0 +1,248 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <epicsAtomic.h>
+
+#include "devUaShmRing.h"
+
+DevUaShmRing *pShmRing = NULL;
+
+// size of one element of a fixed size built-in type, 0 for variable size types
+static epicsUInt32 rawElementSize(int type)
+{
+    switch(type) {
+    case OpcUaType_Boolean:    return sizeof(OpcUa_Boolean);
+    case OpcUaType_SByte:      return sizeof(OpcUa_SByte);
+    case OpcUaType_Byte:       return sizeof(OpcUa_Byte);
+    case OpcUaType_Int16:      return sizeof(OpcUa_Int16);
+    case OpcUaType_UInt16:     return sizeof(OpcUa_UInt16);
+    case OpcUaType_Int32:      return sizeof(OpcUa_Int32);
+    case OpcUaType_UInt32:     return sizeof(OpcUa_UInt32);
+    case OpcUaType_Int64:      return sizeof(OpcUa_Int64);
+    case OpcUaType_UInt64:     return sizeof(OpcUa_UInt64);
+    case OpcUaType_Float:      return sizeof(OpcUa_Float);
+    case OpcUaType_Double:     return sizeof(OpcUa_Double);
+    case OpcUaType_DateTime:   return sizeof(OpcUa_DateTime);
+    case OpcUaType_StatusCode: return sizeof(OpcUa_StatusCode);
+    default:                   return 0;
+    }
+}
+
+epicsUInt32 encodeRawValue(const OpcUa_Variant &val, char *buf, epicsUInt32 maxLen, int *truncated)
+{
+    epicsUInt32 elemSize = rawElementSize(val.Datatype);
+    epicsUInt32 len = 0;
+    const void *src = NULL;
+
+    *truncated = 0;
+    if (val.ArrayType == OpcUa_VariantArrayType_Scalar) {
+        if (val.Datatype == OpcUaType_String) {
+            OpcUa_String *pStr = (OpcUa_String *) &val.Value.String;
+            src = OpcUa_String_GetRawString(pStr);
+            len = src ? OpcUa_String_StrSize(pStr) : 0;
+        }
+        else {
+            src = &val.Value;       // union: all fixed size scalars start at its address
+            len = elemSize;
+        }
+    }
+    else if (val.ArrayType == OpcUa_VariantArrayType_Array && elemSize && val.Value.Array.Length > 0) {
+        src = val.Value.Array.Value.Array;
+        len = elemSize * val.Value.Array.Length;
+    }
+    if (len > maxLen) {
+        *truncated = 1;
+        len = elemSize ? (maxLen / elemSize) * elemSize : maxLen;
+    }
+    if (len)
+        memcpy(buf, src, len);
+    return len;
+}
+
+long decodeRawValue(const char *buf, epicsUInt32 len, int dataType, int isArray, OpcUa_Variant *val)
+{
+    epicsUInt32 elemSize = rawElementSize(dataType);
+
+    val->Datatype = dataType;
+    if (!isArray) {
+        val->ArrayType = OpcUa_VariantArrayType_Scalar;
+        if (dataType == OpcUaType_String) {
+            std::string str(buf, len);
+            OpcUa_String_AttachCopy(&val->Value.String, str.c_str());
+            return 0;
+        }
+        if (!elemSize || len != elemSize)
+            return 1;
+        memcpy(&val->Value, buf, len);
+        return 0;
+    }
+    if (!elemSize)
+        return 1;
+    val->ArrayType = OpcUa_VariantArrayType_Array;
+    val->Value.Array.Length = len / elemSize;
+    val->Value.Array.Value.Array = NULL;
+    if (len) {
+        val->Value.Array.Value.Array = OpcUa_Memory_Alloc(len);
+        if (!val->Value.Array.Value.Array) {
+            val->Value.Array.Length = 0;
+            return 1;
+        }
+        memcpy(val->Value.Array.Value.Array, buf, len);
+    }
+    return 0;
+}
+
+DevUaShmRing::DevUaShmRing(const char *file, epicsUInt32 slots, epicsUInt32 maxData, int all)
+    : fileName(file)
+    , nSlots(1)
+    , allItems(all)
+    , mapSize(0)
+    , pBase(NULL)
+    , pHdr(NULL)
+    , lock(epicsMutexMustCreate())
+    , nTruncated(0)
+{
+    while (nSlots < slots)  // round up to a power of 2
+        nSlots <<= 1;
+    // keep the 64 bit slot header fields aligned
+    slotSize = (sizeof(opcUaShmSlot) + maxData + 7) & ~7u;
+}
+
+DevUaShmRing::~DevUaShmRing()
+{
+#ifndef _WIN32
+    if (pBase)
+        munmap(pBase, mapSize);
+#endif
+    epicsMutexDestroy(lock);
+}
+
+long DevUaShmRing::open(std::vector<OPCUA_ItemINFO *> &vUaItemInfo)
+{
+#ifdef _WIN32
+    errlogPrintf("DevUaShmRing: shared memory ring not supported on this platform\n");
+    return 1;
+#else
+    epicsUInt32 nItems = vUaItemInfo.capacity();    // incl. reserved handles
+    epicsUInt32 dataOffset = (sizeof(opcUaShmHeader) + nItems * OPCUA_SHM_NAMELEN + 63) & ~63u;
+    size_t size = (size_t) dataOffset + (size_t) nSlots * slotSize;
+    int fd;
+
+    if (pBase)
+        return 0;
+    fd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size)) {
+        errlogPrintf("DevUaShmRing: can't create '%s': %s\n", fileName.c_str(), strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+    pBase = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pBase == MAP_FAILED) {
+        errlogPrintf("DevUaShmRing: can't map '%s': %s\n", fileName.c_str(), strerror(errno));
+        pBase = NULL;
+        return 1;
+    }
+    mapSize = size;
+    memset(pBase, 0, dataOffset);   // slots are zero from ftruncate
+
+    for (epicsUInt32 i = 0; i < vUaItemInfo.size(); i++) {
+        if (!vUaItemInfo[i])
+            continue;
+        if (allItems)
+            vUaItemInfo[i]->shmPublish = 1;
+        strncpy(pBase + sizeof(opcUaShmHeader) + i * OPCUA_SHM_NAMELEN,
+                vUaItemInfo[i]->prec->name, OPCUA_SHM_NAMELEN - 1);
+    }
+    opcUaShmHeader *hdr = (opcUaShmHeader *) pBase;
+    hdr->nItems     = nItems;
+    hdr->nSlots     = nSlots;
+    hdr->slotSize   = slotSize;
+    hdr->dataOffset = dataOffset;
+    hdr->head       = 0;
+    hdr->version    = OPCUA_SHM_VERSION;
+    epicsAtomicWriteMemoryBarrier();
+    hdr->magic      = OPCUA_SHM_MAGIC;  // readers check magic last
+    pHdr = hdr;
+    return 0;
+#endif
+}
+
+void DevUaShmRing::setName(OpcUa_UInt32 handle, OPCUA_ItemINFO *uaItem)
+{
+    if (!pHdr || handle >= pHdr->nItems)
+        return;
+    epicsMutexLock(lock);
+    if (allItems)
+        uaItem->shmPublish = 1;
+    char *name = pBase + sizeof(opcUaShmHeader) + (size_t) handle * OPCUA_SHM_NAMELEN;
+    memset(name, 0, OPCUA_SHM_NAMELEN);
+    strncpy(name, uaItem->prec->name, OPCUA_SHM_NAMELEN - 1);
+    epicsAtomicWriteMemoryBarrier();
+    epicsMutexUnlock(lock);
+}
+
+void DevUaShmRing::append(OpcUa_UInt32 handle, const OpcUa_DataValue &value)
+{
+    int truncated;
+
+    if (!pHdr)
+        return;
+    epicsMutexLock(lock);
+    uint64_t n = pHdr->head;
+    opcUaShmSlot *pSlot = (opcUaShmSlot *) (pBase + pHdr->dataOffset + (size_t) (n & (nSlots - 1)) * slotSize);
+
+    pSlot->seq = 2 * n + 1;         // mark busy
+    epicsAtomicWriteMemoryBarrier();
+    pSlot->handle     = handle;
+    pSlot->status     = value.StatusCode;
+    pSlot->serverTime = ((uint64_t) value.ServerTimestamp.dwHighDateTime << 32) | value.ServerTimestamp.dwLowDateTime;
+    pSlot->sourceTime = ((uint64_t) value.SourceTimestamp.dwHighDateTime << 32) | value.SourceTimestamp.dwLowDateTime;
+    pSlot->dataType   = value.Value.Datatype;
+    pSlot->length     = encodeRawValue(value.Value, (char *) pSlot + sizeof(opcUaShmSlot),
+                                       slotSize - sizeof(opcUaShmSlot), &truncated);
+    pSlot->flags      = (value.Value.ArrayType ? OPCUA_SHM_FLAG_ARRAY : 0) | (truncated ? OPCUA_SHM_FLAG_TRUNCATED : 0);
+    if (truncated)
+        nTruncated++;
+    epicsAtomicWriteMemoryBarrier();
+    pSlot->seq = 2 * n + 2;         // mark complete
+    pHdr->head = n + 1;
+    epicsMutexUnlock(lock);
+}
+
+void DevUaShmRing::report(int verb)
+{
+    if (!pHdr) {
+        errlogPrintf("Shared memory ring '%s': not open\n", fileName.c_str());
+        return;
+    }
+    errlogPrintf("Shared memory ring '%s': %u slots of %u bytes, %llu written, %u truncated\n",
+                 fileName.c_str(), nSlots, slotSize, (unsigned long long) pHdr->head, nTruncated);
+    if (verb > 1)
+        errlogPrintf("  version %u, %u item names, slots at offset %u, %llu bytes mapped\n", pHdr->version,
+                     pHdr->nItems, pHdr->dataOffset, (unsigned long long) mapSize);
+}
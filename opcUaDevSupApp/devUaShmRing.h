@@ -0,0 +1,67 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUASHMRING_H
+#define DEVUASHMRING_H
+
+#include <string>
+#include <vector>
+#include <epicsMutex.h>
+#include "drvOpcUa.h"
+#include "opcUaShm.h"
+
+// Copy the raw value of a scalar or a one dimensional array of fixed size elements
+// or of a string to buf. Returns the number of bytes written, sets *truncated if
+// the value did not fit into maxLen.
+epicsUInt32 encodeRawValue(const OpcUa_Variant &val, char *buf, epicsUInt32 maxLen, int *truncated);
+// Inverse of encodeRawValue: build *val from raw data. val must be initialized and
+// empty, it owns allocated array or string data afterwards. Returns 0 on success.
+long decodeRawValue(const char *buf, epicsUInt32 len, int dataType, int isArray, OpcUa_Variant *val);
+
+// Writer side of the shared memory notification ring, see opcUaShm.h
+class DevUaShmRing
+{
+    UA_DISABLE_COPY(DevUaShmRing);
+public:
+    DevUaShmRing(const char *fileName, epicsUInt32 nSlots, epicsUInt32 maxData, int allItems);
+    ~DevUaShmRing();
+
+    // create and map the file, fill the name table. Call when all items are known, the
+    // table has room for the reserved handles of items added at runtime.
+    // With allItems set, all items are published, otherwise those with info(opcua:SHM).
+    long open(std::vector<OPCUA_ItemINFO *> &vUaItemInfo);
+    // name the handle of an item added at runtime, before its first notification
+    void setName(OpcUa_UInt32 handle, OPCUA_ItemINFO *uaItem);
+    void append(OpcUa_UInt32 handle, const OpcUa_DataValue &value);
+    void report(int verb);
+    bool isOpen() const { return pHdr != NULL; }
+
+private:
+    std::string fileName;
+    epicsUInt32 nSlots;
+    int allItems;
+    epicsUInt32 slotSize;
+    size_t mapSize;
+    char *pBase;
+    opcUaShmHeader *pHdr;
+    epicsMutexId lock;      // serializes writers from concurrent subscription callbacks
+    epicsUInt32 nTruncated;
+};
+
+extern DevUaShmRing *pShmRing;
+
+#endif // DEVUASHMRING_H
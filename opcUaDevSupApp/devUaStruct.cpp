@@ -0,0 +1,335 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+
+#include <errlog.h>
+#include <epicsMutex.h>
+#include <epicsString.h>
+#include <epicsEndian.h>
+
+#include "devUaStruct.h"
+
+#define STRUCT_MAX_DEPTH 8      // nesting of structure types
+
+namespace {
+
+// Cursor on the binary encoded body of an ExtensionObject, OPC UA binary is little endian
+class BinReader
+{
+public:
+    BinReader(const OpcUa_ByteString &body)
+        : p(body.Data), end(body.Data + (body.Length > 0 ? body.Length : 0)) {}
+    bool skip(size_t n) {
+        if((size_t)(end - p) < n)
+            return false;
+        p += n;
+        return true;
+    }
+    bool get(void *dst, size_t n) {
+        if((size_t)(end - p) < n)
+            return false;
+#if EPICS_BYTE_ORDER == EPICS_ENDIAN_LITTLE
+        memcpy(dst, p, n);
+#else
+        for(size_t i=0; i<n; i++)
+            ((OpcUa_Byte *) dst)[i] = p[n-1-i];
+#endif
+        p += n;
+        return true;
+    }
+    bool length(OpcUa_Int32 &n) { return get(&n, sizeof(n)); }
+
+    const OpcUa_Byte *p;
+    const OpcUa_Byte *end;
+};
+
+}
+
+// Size of a fixed size built-in type, 0 if variable or not supported
+static size_t fixedSize(OpcUa_BuiltInType type)
+{
+    switch(type) {
+    case OpcUaType_Boolean:
+    case OpcUaType_SByte:
+    case OpcUaType_Byte:        return 1;
+    case OpcUaType_Int16:
+    case OpcUaType_UInt16:      return 2;
+    case OpcUaType_Int32:
+    case OpcUaType_UInt32:
+    case OpcUaType_Float:
+    case OpcUaType_StatusCode:  return 4;
+    case OpcUaType_Int64:
+    case OpcUaType_UInt64:
+    case OpcUaType_Double:
+    case OpcUaType_DateTime:    return 8;
+    case OpcUaType_Guid:        return 16;
+    default:                    return 0;
+    }
+}
+
+static bool isByteString(OpcUa_BuiltInType type)
+{
+    return type == OpcUaType_String || type == OpcUaType_ByteString || type == OpcUaType_XmlElement;
+}
+
+static bool isSkippable(const DevUaStructField &f)
+{
+    if(f.type == OpcUaType_ExtensionObject)
+        return f.sub && f.sub->skippable;
+    return fixedSize(f.type) || isByteString(f.type);
+}
+
+static bool isReadable(const DevUaStructField &f)
+{
+    if(f.type < OpcUaType_Boolean || f.type > OpcUaType_String)
+        return false;
+    if(f.isArray)
+        return f.type != OpcUaType_Byte && f.type != OpcUaType_String;
+    return true;
+}
+
+static bool skipField(BinReader &r, const DevUaStructField &f);
+
+static bool skipOne(BinReader &r, const DevUaStructField &f)
+{
+    size_t size = fixedSize(f.type);
+    if(size)
+        return r.skip(size);
+    if(isByteString(f.type)) {
+        OpcUa_Int32 n;
+        return r.length(n) && (n <= 0 || r.skip(n));
+    }
+    for(size_t i=0; i<f.sub->fields.size(); i++) {
+        if(!skipField(r, f.sub->fields[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool skipField(BinReader &r, const DevUaStructField &f)
+{
+    OpcUa_Int32 n;
+    size_t size;
+
+    if(!f.isArray)
+        return skipOne(r, f);
+    if(!r.length(n))
+        return false;
+    size = fixedSize(f.type);
+    if(size)
+        return n <= 0 || r.skip((size_t) n * size);
+    for(OpcUa_Int32 i=0; i<n; i++) {
+        if(!skipOne(r, f))
+            return false;
+    }
+    return true;
+}
+
+long DevUaStructPlan::decode(const OpcUa_Variant &value, UaVariant &result) const
+{
+    if(value.Datatype != OpcUaType_ExtensionObject || value.ArrayType != OpcUa_VariantArrayType_Scalar
+            || !value.Value.ExtensionObject || value.Value.ExtensionObject->Encoding != OpcUa_ExtensionObjectEncoding_Binary)
+        return 1;
+    BinReader r(value.Value.ExtensionObject->Body.Binary);
+
+    for(size_t i=0; i<skip.size(); i++) {
+        if(!skipField(r, skip[i]))
+            return 1;
+    }
+    if(!member.isArray) {
+        switch(member.type) {
+#define SCALAR(T, SET) case OpcUaType_##T: { OpcUa_##T v; if(!r.get(&v, sizeof(v))) return 1; result.SET(v); return 0; }
+        SCALAR(Boolean, setBool)
+        SCALAR(SByte,   setSByte)
+        SCALAR(Byte,    setByte)
+        SCALAR(Int16,   setInt16)
+        SCALAR(UInt16,  setUInt16)
+        SCALAR(Int32,   setInt32)
+        SCALAR(UInt32,  setUInt32)
+        SCALAR(Int64,   setInt64)
+        SCALAR(UInt64,  setUInt64)
+        SCALAR(Float,   setFloat)
+        SCALAR(Double,  setDouble)
+#undef SCALAR
+        case OpcUaType_String: {
+            OpcUa_Int32 n;
+            if(!r.length(n))
+                return 1;
+            if(n <= 0) {
+                result.setString(UaString(""));
+                return 0;
+            }
+            if(r.end - r.p < n)
+                return 1;
+            result.setString(UaString(std::string((const char *) r.p, n).c_str()));
+            return 0;
+        }
+        default:
+            return 1;
+        }
+    }
+    OpcUa_Int32 n;
+    if(!r.length(n))
+        return 1;
+    if(n < 0)
+        n = 0;
+    if((size_t)(r.end - r.p) < (size_t) n * fixedSize(member.type))
+        return 1;
+    switch(member.type) {
+#define ARRAY(T, ARR, SET) case OpcUaType_##T: { ARR a; a.create(n); \
+        for(OpcUa_Int32 i=0; i<n; i++) r.get(&a[i], sizeof(OpcUa_##T)); \
+        result.SET(a, OpcUa_True); return 0; }
+    ARRAY(Boolean, UaBooleanArray, setBoolArray)
+    ARRAY(SByte,   UaSByteArray,   setSByteArray)
+    ARRAY(Int16,   UaInt16Array,   setInt16Array)
+    ARRAY(UInt16,  UaUInt16Array,  setUInt16Array)
+    ARRAY(Int32,   UaInt32Array,   setInt32Array)
+    ARRAY(UInt32,  UaUInt32Array,  setUInt32Array)
+    ARRAY(Int64,   UaInt64Array,   setInt64Array)
+    ARRAY(UInt64,  UaUInt64Array,  setUInt64Array)
+    ARRAY(Float,   UaFloatArray,   setFloatArray)
+    ARRAY(Double,  UaDoubleArray,  setDoubleArray)
+#undef ARRAY
+    default:
+        return 1;
+    }
+}
+
+typedef std::map<std::string, DevUaStructType *> StructTypeMap;
+static StructTypeMap structTypes;       // compiled types by data type id, never deleted
+static epicsMutexId structTypesLock = epicsMutexMustCreate();
+
+// Compile the definition of a structure type, call with structTypesLock held
+static const DevUaStructType *compileType(const UaStructureDefinition &def, int depth)
+{
+    if(def.isNull() || depth > STRUCT_MAX_DEPTH)
+        return NULL;
+    std::string key = def.dataTypeId().toXmlString().toUtf8();
+    StructTypeMap::iterator it = structTypes.find(key);
+    if(it != structTypes.end())
+        return it->second;
+
+    DevUaStructType *type = new DevUaStructType;
+    type->name = def.name().toUtf8();
+    type->supported = !def.isUnion();
+    for(int i=0; i<def.childrenCount(); i++) {
+        UaStructureField field = def.child(i);
+        DevUaStructField f;
+        f.type    = field.valueType();
+        f.isArray = field.valueRank() != -1;
+        f.sub     = NULL;
+        if(field.isOptional() || field.valueRank() > 1)
+            type->supported = false;   // encoding mask, multi dimensional arrays
+        if(f.type == OpcUaType_ExtensionObject)
+            f.sub = compileType(field.structureDefinition(), depth+1);
+        type->names.push_back(field.name().toUtf8());
+        type->fields.push_back(f);
+    }
+    type->skippable = type->supported;
+    for(size_t i=0; i<type->fields.size() && type->skippable; i++)
+        type->skippable = isSkippable(type->fields[i]);
+    structTypes[key] = type;
+    return type;
+}
+
+void structSplitLink(OPCUA_ItemINFO *uaItem)
+{
+    char *sep = strrchr(uaItem->ItemPath, '|');
+
+    free(uaItem->member);
+    uaItem->member = NULL;
+    if(!sep)
+        return;
+    *sep = 0;
+    if(sep[1])
+        uaItem->member = epicsStrDup(sep+1);
+}
+
+long structPlanSetup(OPCUA_ItemINFO *uaItem, const UaNodeId &dataTypeId)
+{
+    DevUaStructPlan *plan = NULL, *old;
+    const char *err = NULL;
+
+    UaStructureDefinition def = pMyClient->session()->structureDefinition(dataTypeId);
+    if(def.isNull()) {
+        err = "no structure definition";
+    }
+    else {
+        std::string path = uaItem->member;
+        size_t pos = 0;
+
+        plan = new DevUaStructPlan;
+        epicsMutexLock(structTypesLock);
+        const DevUaStructType *type = compileType(def, 0);
+        for(;;) {
+            size_t dot = path.find('.', pos);
+            std::string name = path.substr(pos, (dot == std::string::npos) ? dot : dot - pos);
+            size_t k;
+
+            if(!type || !type->supported) {
+                err = "structure type not supported";
+                break;
+            }
+            for(k=0; k<type->names.size() && type->names[k] != name; k++)
+                ;
+            if(k == type->names.size()) {
+                err = "no such member";
+                break;
+            }
+            for(size_t j=0; j<k && !err; j++) {
+                if(!isSkippable(type->fields[j]))
+                    err = "can't decode a member before";
+                plan->skip.push_back(type->fields[j]);
+            }
+            if(err)
+                break;
+            if(dot == std::string::npos) {
+                if(!isReadable(type->fields[k]))
+                    err = "member type not supported";
+                plan->member = type->fields[k];
+                break;
+            }
+            if(type->fields[k].type != OpcUaType_ExtensionObject || type->fields[k].isArray) {
+                err = "not a structure";
+                break;
+            }
+            type = type->fields[k].sub;
+            pos = dot + 1;
+        }
+        epicsMutexUnlock(structTypesLock);
+    }
+    if(err) {
+        errlogPrintf("%s: member '%s' of data type %s: %s\n", uaItem->prec->name, uaItem->member,
+                     dataTypeId.toXmlString().toUtf8(), err);
+        delete plan;
+        plan = NULL;
+    }
+    else if(uaItem->debug >= 2)
+        errlogPrintf("%s: member '%s' decoded after %lu fields\n", uaItem->prec->name, uaItem->member,
+                     (unsigned long) plan->skip.size());
+
+    epicsMutexLock(uaItem->flagLock);
+    old = uaItem->structPlan;
+    uaItem->structPlan = plan;
+    epicsMutexUnlock(uaItem->flagLock);
+    delete old;
+    return plan ? 0 : 1;
+}
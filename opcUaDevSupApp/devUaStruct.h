@@ -0,0 +1,67 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUASTRUCT_H
+#define DEVUASTRUCT_H
+
+#include <string>
+#include <vector>
+#include "drvOpcUa.h"
+
+/* Structure members: A link "node|member.sub" reads one member of a node with a
+ * structured data type (UDT). The data type definition is taken from the server once
+ * per type and compiled to a list of fields. For each record a plan lists the fields
+ * to skip in the binary body of the ExtensionObject and the member to decode, so a
+ * notification is decoded without building the whole structure. Records of the same
+ * node share one monitored item, see DevUaSubscription::shareKey().
+ * Supported are built-in members Boolean..Double and String, scalar or array, in
+ * structures without optional fields. Members are read only.
+ */
+class DevUaStructType;
+
+struct DevUaStructField {
+    OpcUa_BuiltInType type;         // OpcUaType_ExtensionObject: nested structure sub
+    bool isArray;
+    const DevUaStructType *sub;
+};
+
+class DevUaStructType
+{
+public:
+    std::string name;
+    std::vector<std::string> names;
+    std::vector<DevUaStructField> fields;
+    bool supported;                 // no optional fields, not a union
+    bool skippable;                 // all fields can be skipped
+};
+
+class DevUaStructPlan
+{
+public:
+    // decode the member from the structure value, return 1 on error
+    long decode(const OpcUa_Variant &value, UaVariant &member) const;
+
+    std::vector<DevUaStructField> skip;     // fields before the member, nested structures inlined
+    DevUaStructField member;
+};
+
+// Split a link "node|member": ItemPath keeps the node, the member path goes to uaItem->member
+void structSplitLink(OPCUA_ItemINFO *uaItem);
+// Compile the plan of the items member for the data type of its node, return 1 on error
+long structPlanSetup(OPCUA_ItemINFO *uaItem, const UaNodeId &dataTypeId);
+
+#endif // DEVUASTRUCT_H
@@ -16,9 +16,19 @@
 *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 \*************************************************************************/
 
+#include <string.h>
+#include <set>
+#include <epicsStdio.h>
+
 #include "drvOpcUa.h"
 #include "devUaClient.h"
 #include "devUaSubscription.h"
+#include "devUaShmRing.h"
+#include "devUaCapture.h"
+#include "devUaProcessPool.h"
+#include "devUaStruct.h"
+#include "devUaAggregate.h"
+#include "devUaOutQueue.h"
 #include <epicsExport.h>
 
 using namespace UaClientSdk;
@@ -26,17 +36,45 @@ using namespace UaClientSdk;
 // Configurable default for publishing interval
 static double drvOpcua_DefaultPublishInterval = 100.0;  // ms
 
+// Subscription parameters, 0 = SDK default
+static int drvOpcua_LifetimeCount = 0;
+static int drvOpcua_KeepAliveCount = 0;
+static int drvOpcua_MaxNotificationsPerPublish = 0;
+// Items with the same node and monitoring parameters share one monitored item
+static int drvOpcua_ShareItems = 1;
+// OUT records: don't process the readback of a value the record has just written
+int drvOpcua_SuppressEcho = 1;
+
 extern "C" {
     epicsExportAddress(double, drvOpcua_DefaultPublishInterval);
+    epicsExportAddress(int, drvOpcua_LifetimeCount);
+    epicsExportAddress(int, drvOpcua_KeepAliveCount);
+    epicsExportAddress(int, drvOpcua_MaxNotificationsPerPublish);
+    epicsExportAddress(int, drvOpcua_ShareItems);
+    epicsExportAddress(int, drvOpcua_SuppressEcho);
 }
 
 DevUaSubscription::DevUaSubscription(int debug=0)
     : debug(debug)
-{}
+    , nNotifications(0)
+    , nEchoes(0)
+    , publishingInterval(0.0)
+    , lifetimeCount(0)
+    , maxKeepAliveCount(0)
+    , latency(NULL)
+    , m_pSession(NULL)
+    , m_pSubscription(NULL)
+    , m_vectorUaItemInfo(NULL)
+    , m_vUaNodeId(NULL)
+    , shareLock(epicsMutexMustCreate())
+{
+    nAllocs[0] = nAllocs[1] = 0;
+}
 
 DevUaSubscription::~DevUaSubscription()
 {
     deleteSubscription();
+    epicsMutexDestroy(shareLock);
 }
 
 void DevUaSubscription::subscriptionStatusChanged(
@@ -57,66 +95,190 @@ void DevUaSubscription::dataChange(
     OpcUa_ReferenceParameter(clientSubscriptionHandle); // We use the callback only for this subscription
     OpcUa_ReferenceParameter(diagnosticInfos);
     OpcUa_UInt32 i = 0;
-    char timeBuf[30];
-    getTime(timeBuf);
-    if(debug>2) errlogPrintf("dataChange     %s\n",timeBuf);
+    char timeBuf[30];       // formatted only for debug output
+    uint64_t rcvTicks = (drvOpcua_LatencyStats || pCapture) ? uaTicksNow() : 0;
+    uaThreadSched(thrPublish);
+    UA_TRACE("dataChange", NULL, dataNotifications.length(), clientSubscriptionHandle);
+    if(debug>2) errlogPrintf("dataChange     %s\n",getTime(timeBuf));
+    if(pCapture)
+        pCapture->batch(dataNotifications, rcvTicks);
+    epicsMutexLock(shareLock);
     for ( i=0; i<dataNotifications.length(); i++ )
     {
-        struct dataChangeError {};
         OPCUA_ItemINFO* uaItem = m_vectorUaItemInfo->at(dataNotifications[i].ClientHandle);
+        OPCUA_ItemINFO* decoded = NULL;
 
-        if(uaItem->debug >= 2)
-            errlogPrintf("dataChange  %s %s\n",timeBuf,uaItem->prec->name);
-        epicsMutexLock(uaItem->flagLock);
-        try {
-            if (OpcUa_IsBad(dataNotifications[i].Value.StatusCode) )
-            {
-                if(debug)
-                    errlogPrintf("%s %s dataChange FAILED with status %s, Handle=%d\n",timeBuf,uaItem->prec->name,
-                                UaStatus(dataNotifications[i].Value.StatusCode).toString().toUtf8(),dataNotifications[i].ClientHandle);
-                uaItem->stat = dataNotifications[i].Value.StatusCode;
-                throw dataChangeError();
+        if(!uaItem)     // item removed, notification was already queued
+            continue;
+        // once per monitored item, under the handle of the first publishing record
+        for(OPCUA_ItemINFO *s = uaItem; s && pShmRing; s = s->sharedNext) {
+            if(s->shmPublish) {
+                pShmRing->append(s->itemIdx, dataNotifications[i].Value);
+                break;
             }
-            uaItem->varVal = dataNotifications[i].Value.Value;
+        }
+        // the item and the items sharing its monitored item, decoded once where they can
+        for( ; uaItem; uaItem = uaItem->sharedNext) {
+            if(itemDataChange(uaItem, dataNotifications[i].Value, rcvTicks, false, decoded) && !decoded)
+                decoded = uaItem;
+        }
+    } //end for
+    epicsMutexUnlock(shareLock);
+    return;
+}
 
-            if((uaItem->inpDataType)){ // is OUT Record
-                if(!uaItem->flagRdbkOff && !uaItem->prec->pact) {   // readback not switched off  and record not pact
-                    if(uaItem->debug >= 2) errlogPrintf("\tcallbackRequest\n");
-                    callbackRequest(&(uaItem->callback));
-                }
+// The value keeps data on the heap: arrays, strings and all not fixed size scalars
+static bool onHeap(const OpcUa_Variant &v)
+{
+    if(v.ArrayType != OpcUa_VariantArrayType_Scalar)
+        return true;
+    return v.Datatype > OpcUaType_Double && v.Datatype != OpcUaType_DateTime && v.Datatype != OpcUaType_StatusCode;
+}
+
+/* Store the value of a data change notification in the item and request processing of the
+ * record. If decoded is an item of the same monitored item that decodes the same way, its
+ * decoded value is copied instead of decoding again. Return true if the item has a new
+ * decoded value of its own. */
+bool DevUaSubscription::itemDataChange(OPCUA_ItemINFO *uaItem, const OpcUa_DataValue &value, uint64_t rcvTicks,
+                                       bool aggregated, const OPCUA_ItemINFO *decoded)
+{
+    struct dataChangeError {};
+    char timeBuf[30];       // formatted only for debug output
+    bool ok = false;
+
+    if(decoded && !uaItem->sameDecode(decoded))
+        decoded = NULL;
+    if(pShmRing && uaItem->shmPublish && aggregated)
+        pShmRing->append(uaItem->itemIdx, value);
+
+    UA_TRACE("notify", uaItem->prec->name, uaItem->itemIdx, value.StatusCode);
+    if(uaItem->debug >= 2)
+        errlogPrintf("dataChange  %s %s\n",getTime(timeBuf),uaItem->prec->name);
+    epicsMutexLock(uaItem->flagLock);
+    try {
+        if (OpcUa_IsBad(value.StatusCode) )
+        {
+            if(debug)
+                errlogPrintf("%s %s dataChange FAILED with status %s, Handle=%d\n",getTime(timeBuf),uaItem->prec->name,
+                            UaStatus(value.StatusCode).toString().toUtf8(),uaItem->itemIdx);
+            uaItem->stat = value.StatusCode;
+            throw dataChangeError();
+        }
+        nNotifications++;
+        const OpcUa_Variant *pValue = &value.Value;
+        UaVariant memberVal;
+        // copying a member: pValue stays the structure, members are read only and have no echo
+        if(uaItem->structPlan && !aggregated && !decoded) {
+            if(uaItem->structPlan->decode(value.Value, memberVal)) {
+                uaItem->stat = OpcUa_BadDecodingError;
+                throw dataChangeError();
             }
-            else {                                          // is IN Record
-                if(uaItem->prec->scan <= SCAN_IO_EVENT) {
-                    scanIoRequest( uaItem->ioscanpvt );     // Update the record immediatly,
-                }                                           // for scan>SCAN_IO_EVENT update by periodic scan.
+            pValue = memberVal;
+            if(onHeap(*pValue))
+                nAllocs[uaItem->directDecode]++;
+        }
+        else if(uaItem->member && !aggregated && !decoded) {   // no decode plan for the data type
+            uaItem->stat = OpcUa_BadDataTypeIdUnknown;
+            throw dataChangeError();
+        }
+        OpcUa_Variant aggVal;
+        if(uaItem->aggregate && uaItem->aggregate->local && !aggregated) {
+            if(onHeap(*pValue))     // the aggregate reads it through a UaVariant copy
+                nAllocs[uaItem->directDecode]++;
+            if(!uaItem->aggregate->add(*pValue, value, aggVal)) {   // interval still open
+                epicsMutexUnlock(uaItem->flagLock);
+                return false;
             }
+            pValue = &aggVal;
         }
-        catch(dataChangeError) {
-            if(debug || (uaItem->debug>= 1)) errlogPrintf("%s %s\tdataChange exception '%s'\n",timeBuf,uaItem->prec->name,epicsTypeNames[uaItem->recDataType]);
+        if(rcvTicks && drvOpcua_LatencyStats) {
+            uint64_t srvTicks = uaTicks(value.ServerTimestamp);
+            if(srvTicks) {
+                int64_t usec = ((int64_t) (rcvTicks - srvTicks)) / 10;
+                if(latency && !uaItem->sharedPrimary)   // once per notification
+                    latency->srvToRcv.add(usec);
+                if(uaItem->latency)
+                    uaItem->latency->srvToRcv.add(usec);
+            }
+            uaItem->rcvTicks = rcvTicks;
+        }
+        if(decoded) {
+            epicsMutexLock(decoded->flagLock);
+            uaItem->copyDecoded(*decoded);
+            epicsMutexUnlock(decoded->flagLock);
+            if(!uaItem->directDecode && onHeap(*(const OpcUa_Variant *) uaItem->varVal))
+                nAllocs[0]++;
+        }
+        else if(uaItem->directDecode) {
+            if(uaItem->decodeValue(*pValue)) {
+                uaItem->stat = OpcUa_BadTypeMismatch;
+                throw dataChangeError();
+            }
         }
-        // I'm not shure about the posibility of another exception but of the damage it could do!
-        catch(...) {
-            uaItem->stat = OpcUa_BadUnexpectedError;
-            if(debug || (uaItem->debug>= 1)) errlogPrintf("%s %s\tdataChange: unexpected exception '%s'\n",timeBuf,uaItem->prec->name,epicsTypeNames[uaItem->recDataType]);
-            uaItem->debug = 4;
+        else {
+            uaItem->varVal = *pValue;
+            if(onHeap(*pValue))
+                nAllocs[0]++;
         }
+        ok = true;
 
-        // set Timestamp if specified by TSE field
-        UaDateTime dt = UaDateTime(dataNotifications[i].Value.ServerTimestamp);
-        if(uaItem->prec->tse == epicsTimeEventDeviceTime ) {
-            uaItem->prec->time.secPastEpoch = dt.toTime_t() - POSIX_TIME_AT_EPICS_EPOCH;
-            uaItem->prec->time.nsec         = dt.msec()*1000000L; // msec is 100ns steps
+        if((uaItem->inpDataType)){ // is OUT Record
+            bool echo = false;
+            if(uaItem->echoArmed)       // the first notification after a write tells if it is the echo
+                echo = OpcUa_IsGood(value.StatusCode) && !OpcUa_Variant_Compare(pValue, &uaItem->echoVal);
+            // writes still to come: the queue does the readback when it is empty
+            bool queued = uaItem->outQueue && uaItem->outQueue->skipReadback(echo);
+            if(uaItem->echoArmed) {
+                if(echo || !queued)     // echoes of the earlier queued writes come first
+                    uaItem->echoArmed = 0;
+                if(echo) {
+                    nEchoes++;
+                    if(uaItem->debug >= 2) errlogPrintf("\techo of the last write, no readback\n");
+                }
+            }
+            if(!echo && !queued && !uaItem->flagRdbkOff && !uaItem->prec->pact) {   // readback not switched off  and record not pact
+                if(uaItem->debug >= 2) errlogPrintf("\tcallbackRequest\n");
+                if(pProcessPool)
+                    pProcessPool->request(uaItem);
+                else
+                    callbackRequest(&(uaItem->callback));
+            }
         }
-        if(uaItem->debug >= 4) {
-            errlogPrintf("\tepicsType: %2d,%s opcType%2d:%s\n\tValue: %s item stat: %#8x\n\tserver timestamp:%s, TSE:%2d\n",
-                         uaItem->recDataType,epicsTypeNames[uaItem->recDataType],
-                         uaItem->itemDataType,variantTypeStrings(uaItem->itemDataType),
-                         uaItem->varVal.toString().toUtf8(),uaItem->stat,
-                         dt.toString().toUtf8(),uaItem->prec->tse);
+        else {                                          // is IN Record
+            if(pProcessPool) {
+                if(uaItem->prec->scan == SCAN_IO_EVENT)
+                    pProcessPool->request(uaItem);
+            }
+            else if(uaItem->prec->scan <= SCAN_IO_EVENT) {
+                scanIoRequest( uaItem->ioscanpvt );     // Update the record immediatly,
+            }                                           // for scan>SCAN_IO_EVENT update by periodic scan.
         }
-        epicsMutexUnlock(uaItem->flagLock);
-    } //end for
-    return;
+    }
+    catch(dataChangeError) {
+        if(debug || (uaItem->debug>= 1)) errlogPrintf("%s %s\tdataChange exception '%s'\n",getTime(timeBuf),uaItem->prec->name,epicsTypeNames[uaItem->recDataType]);
+    }
+    // I'm not shure about the posibility of another exception but of the damage it could do!
+    catch(...) {
+        uaItem->stat = OpcUa_BadUnexpectedError;
+        if(debug || (uaItem->debug>= 1)) errlogPrintf("%s %s\tdataChange: unexpected exception '%s'\n",getTime(timeBuf),uaItem->prec->name,epicsTypeNames[uaItem->recDataType]);
+        uaItem->debug = 4;
+    }
+
+    // set Timestamp if specified by TSE field
+    UaDateTime dt = UaDateTime(value.ServerTimestamp);
+    if(uaItem->prec->tse == epicsTimeEventDeviceTime ) {
+        uaItem->prec->time.secPastEpoch = dt.toTime_t() - POSIX_TIME_AT_EPICS_EPOCH;
+        uaItem->prec->time.nsec         = dt.msec()*1000000L; // msec is 100ns steps
+    }
+    if(uaItem->debug >= 4) {
+        errlogPrintf("\tepicsType: %2d,%s opcType%2d:%s\n\tValue: %s item stat: %#8x\n\tserver timestamp:%s, TSE:%2d\n",
+                     uaItem->recDataType,epicsTypeNames[uaItem->recDataType],
+                     uaItem->itemDataType,variantTypeStrings(uaItem->itemDataType),
+                     uaItem->valueToString().toUtf8(),uaItem->stat,
+                     dt.toString().toUtf8(),uaItem->prec->tse);
+    }
+    epicsMutexUnlock(uaItem->flagLock);
+    return ok && !decoded;
 }
 
 void DevUaSubscription::newEvents(
@@ -128,14 +290,21 @@ void DevUaSubscription::newEvents(
     if(debug) errlogPrintf("DevUaSubscription::newEvents called\n");
 }
 
-UaStatus DevUaSubscription::createSubscription(UaSession *pSession)
+UaStatus DevUaSubscription::createSubscription(UaSession *pSession, double interval)
 {
     m_pSession = pSession;
 
     UaStatus result;
     ServiceSettings serviceSettings;
+    initServiceSettings(serviceSettings);
     SubscriptionSettings subscriptionSettings;
-    subscriptionSettings.publishingInterval = drvOpcua_DefaultPublishInterval;
+    subscriptionSettings.publishingInterval = (interval > 0.0) ? interval : drvOpcua_DefaultPublishInterval;
+    if(drvOpcua_LifetimeCount > 0)
+        subscriptionSettings.lifetimeCount = drvOpcua_LifetimeCount;
+    if(drvOpcua_KeepAliveCount > 0)
+        subscriptionSettings.maxKeepAliveCount = drvOpcua_KeepAliveCount;
+    if(drvOpcua_MaxNotificationsPerPublish > 0)
+        subscriptionSettings.maxNotificationsPerPublish = drvOpcua_MaxNotificationsPerPublish;
     if(debug) errlogPrintf("Creating subscription\n");
     result = pSession->createSubscription(
         serviceSettings,
@@ -144,6 +313,20 @@ UaStatus DevUaSubscription::createSubscription(UaSession *pSession)
         subscriptionSettings,
         OpcUa_True,
         &m_pSubscription);
+    publishingInterval = subscriptionSettings.publishingInterval;   // as revised by the server
+    lifetimeCount      = subscriptionSettings.lifetimeCount;
+    maxKeepAliveCount  = subscriptionSettings.maxKeepAliveCount;
+    if(debug && result.isGood())
+        errlogPrintf("DevUaSubscription: publishing interval %g ms, lifetime count %u, keep alive count %u\n",
+                     publishingInterval, lifetimeCount, maxKeepAliveCount);
+    if(!latency) {
+        char name[40];
+        if(interval > 0.0)
+            epicsSnprintf(name, sizeof(name), "subscription %gms", interval);
+        else
+            strcpy(name, "subscription");
+        latency = latencyFind(name, 1);
+    }
     if (result.isBad())
     {
         errlogPrintf("DevUaSubscription::createSubscription failed with status %#8x (%s)\n",
@@ -157,6 +340,9 @@ UaStatus DevUaSubscription::deleteSubscription()
 {
     UaStatus result;
     ServiceSettings serviceSettings;
+    initServiceSettings(serviceSettings);
+    if(!m_pSubscription)
+        return result;
     // let the SDK cleanup the resources for the existing subscription
     if(debug) errlogPrintf("Deleting subscription\n");
     result = m_pSession->deleteSubscription(
@@ -169,14 +355,36 @@ UaStatus DevUaSubscription::deleteSubscription()
                      result.toString().toUtf8());
     }
     //TODO: setting the pointer NULL if delete failed might be a memory leak?
+    sharedItems.clear();
+    sharedKeys.clear();
     return result;
 }
 
 UaStatus DevUaSubscription::createMonitoredItems(std::vector<UaNodeId> &vUaNodeId,std::vector<OPCUA_ItemINFO *> *uaItemInfo)
+{
+    std::vector<OpcUa_UInt32> handles;
+    for(OpcUa_UInt32 i=0; i<vUaNodeId.size() && i<uaItemInfo->size(); i++) {
+        if(!uaItemInfo->at(i))
+            continue;
+        if(vUaNodeId[i].isNull()) {
+            if(uaItemInfo->at(i)->ItemPath[0])
+                errlogPrintf("%s Skip illegal node: %s\n",uaItemInfo->at(i)->prec->name,uaItemInfo->at(i)->ItemPath);
+        }
+        else
+            handles.push_back(i);
+    }
+    return createMonitoredItems(vUaNodeId, uaItemInfo, handles);
+}
+
+// Create the monitored items for the given client handles (= index in vUaNodeId, uaItemInfo)
+UaStatus DevUaSubscription::createMonitoredItems(std::vector<UaNodeId> &vUaNodeId,std::vector<OPCUA_ItemINFO *> *uaItemInfo,
+                                                 const std::vector<OpcUa_UInt32> &handles)
 {
     if(debug) errlogPrintf("DevUaSubscription::createMonitoredItems\n");
-    if( uaItemInfo->size() == vUaNodeId.size())
+    if( uaItemInfo->size() == vUaNodeId.size()) {
         m_vectorUaItemInfo = uaItemInfo;
+        m_vUaNodeId = &vUaNodeId;
+    }
     else
     {
         errlogPrintf("\nDevUaSubscription::createMonitoredItems Error: Nr of uaItems %i != nr of browsepathItems %i\n",(int)uaItemInfo->size(),(int)vUaNodeId.size());
@@ -188,30 +396,152 @@ UaStatus DevUaSubscription::createMonitoredItems(std::vector<UaNodeId> &vUaNodeI
 
     }
 
+    UaStatus result;
+    OpcUa_UInt32 i;
+    OPCUA_ItemINFO *info;
+    std::vector<OpcUa_UInt32> own;      // items that get a monitored item of their own
+    std::vector<OpcUa_UInt32> fallback; // aggregates the server rejected, monitored unfiltered
+
+    for(i=0; i<handles.size(); i++) {
+        OpcUa_UInt32 h = handles[i];
+        info = uaItemInfo->at(h);
+        if ( vUaNodeId[h].isNull() ) {
+            errlogPrintf("%s Skip illegal node: %s\n",info->prec->name,info->ItemPath);
+            continue;
+        }
+        if(drvOpcua_ShareItems) {
+            std::string key = shareKey(vUaNodeId[h], info);
+            std::map<std::string, OpcUa_UInt32>::iterator it = sharedItems.find(key);
+            if(it != sharedItems.end()) {
+                attachShared(info, uaItemInfo->at(it->second));
+                continue;
+            }
+            sharedItems[key] = h;
+            sharedKeys[h] = key;
+        }
+        own.push_back(h);
+    }
+    if(own.empty())
+        return OpcUa_Good;
+    result = createOwnItems(own, fallback);
+    if(!fallback.empty()) {
+        std::vector<OpcUa_UInt32> none;
+        createOwnItems(fallback, none);
+    }
+    // the items sharing a monitored item follow the result of its owner
+    for(i=0; i<own.size(); i++) {
+        OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(own[i]);
+        if(!uaItem->subscription)
+            releaseShared(own[i], NULL);
+        for(OPCUA_ItemINFO *s = uaItem->sharedNext; s; s = s->sharedNext) {
+            s->subscription = uaItem->subscription;
+            s->monitoredItemId = uaItem->monitoredItemId;
+            s->revisedSamplingInterval = uaItem->revisedSamplingInterval;
+            s->revisedQueueSize = uaItem->revisedQueueSize;
+            if(s->aggregate && uaItem->aggregate) {     // same aggregate, see shareKey()
+                s->aggregate->local = uaItem->aggregate->local;
+                s->aggregate->revisedInterval = uaItem->aggregate->revisedInterval;
+            }
+        }
+    }
+    setTriggers(handles);
+    return result;
+}
+
+/* Link the triggered items created now, and those whose trigger item was created now,
+ * to the monitored item of their trigger record by SetTriggering, one call per trigger.
+ * Items that can't be linked are switched to Reporting so they are not silent. */
+void DevUaSubscription::setTriggers(const std::vector<OpcUa_UInt32> &handles)
+{
+    std::set<OpcUa_UInt32> created(handles.begin(), handles.end());
+    std::map<std::string, OPCUA_ItemINFO *> byName;
+    std::map<OpcUa_UInt32, std::vector<OpcUa_UInt32> > links;   // trigger monitored item -> triggered handles
+    std::vector<OpcUa_UInt32> unlinked, relinked;
+    OpcUa_UInt32 i;
+
+    for(i=0; i<m_vectorUaItemInfo->size(); i++) {
+        OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(i);
+        if(uaItem)
+            byName[uaItem->prec->name] = uaItem;
+    }
+    for(i=0; i<m_vectorUaItemInfo->size(); i++) {
+        OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(i);
+        if(!uaItem || !uaItem->triggeredBy || uaItem->sharedPrimary || uaItem->subscription != this)
+            continue;
+        std::map<std::string, OPCUA_ItemINFO *>::iterator it = byName.find(uaItem->triggeredBy);
+        OPCUA_ItemINFO *trigger = (it != byName.end()) ? it->second : NULL;
+        if(!created.count(i) && !(trigger && created.count(trigger->itemIdx)))
+            continue;
+        if(trigger && trigger->sharedPrimary)
+            trigger = trigger->sharedPrimary;
+        if(!trigger || trigger->subscription != this || !trigger->monitoredItemId) {
+            errlogPrintf("%s: trigger '%s' is no monitored item of this subscription, reporting on its own\n",
+                         uaItem->prec->name, uaItem->triggeredBy);
+            unlinked.push_back(i);
+            continue;
+        }
+        links[trigger->monitoredItemId].push_back(i);
+    }
+    for(std::map<OpcUa_UInt32, std::vector<OpcUa_UInt32> >::iterator it=links.begin(); it!=links.end(); ++it) {
+        ServiceSettings serviceSettings;
+        initServiceSettings(serviceSettings);
+        UaUInt32Array linksToAdd, linksToRemove;
+        UaStatusCodeArray addResults, removeResults;
+
+        linksToAdd.create(it->second.size());
+        for(i=0; i<it->second.size(); i++)
+            linksToAdd[i] = m_vectorUaItemInfo->at(it->second[i])->monitoredItemId;
+        UaStatus result = m_pSubscription->setTriggering(serviceSettings, it->first, linksToAdd, linksToRemove,
+                                                         addResults, removeResults);
+        for(i=0; i<it->second.size(); i++) {
+            OpcUa_StatusCode stat = result.isBad() ? result.statusCode()
+                                  : (i < addResults.length() ? addResults[i] : OpcUa_BadUnexpectedError);
+            OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(it->second[i]);
+            if(OpcUa_IsBad(stat)) {
+                errlogPrintf("%s: SetTriggering by '%s' failed: %s\n", uaItem->prec->name, uaItem->triggeredBy,
+                             UaStatus(stat).toString().toUtf8());
+                unlinked.push_back(it->second[i]);
+                continue;
+            }
+            if(uaItem->monitoringMode != OpcUa_MonitoringMode_Sampling)
+                relinked.push_back(it->second[i]);  // reported on its own while its trigger was gone
+            if(debug || uaItem->debug)
+                errlogPrintf("%s: reported on changes of '%s'\n", uaItem->prec->name, uaItem->triggeredBy);
+        }
+    }
+    setMonitoringMode(OpcUa_MonitoringMode_Reporting, unlinked);
+    setMonitoringMode(OpcUa_MonitoringMode_Sampling, relinked);
+}
+
+/* Create a monitored item for each of the items, collect aggregates the server doesn't
+ * support in fallback. These are marked for local aggregation to be created unfiltered. */
+UaStatus DevUaSubscription::createOwnItems(const std::vector<OpcUa_UInt32> &own, std::vector<OpcUa_UInt32> &fallback)
+{
     UaStatus result;
     OpcUa_UInt32 i;
     ServiceSettings serviceSettings;
+    initServiceSettings(serviceSettings);
     UaMonitoredItemCreateRequests itemsToCreate;
     UaMonitoredItemCreateResults createResults;
     OPCUA_ItemINFO *info;
-    // Configure one item to add to subscription
-    // We monitor the value of the ServerStatus -> CurrentTime
-    itemsToCreate.create(vUaNodeId.size());
-    for(i=0; i<vUaNodeId.size(); i++) {
-        info = uaItemInfo->at(i);
-        if ( !vUaNodeId[i].isNull() ) {
-            UaNodeId tempNode(vUaNodeId[i]);
-            itemsToCreate[i].ItemToMonitor.AttributeId = OpcUa_Attributes_Value;
-            tempNode.copyTo(&(itemsToCreate[i].ItemToMonitor.NodeId));
-            itemsToCreate[i].RequestedParameters.ClientHandle = i;
-            itemsToCreate[i].RequestedParameters.SamplingInterval = info->samplingInterval;
-            itemsToCreate[i].RequestedParameters.QueueSize = info->queueSize;
-            itemsToCreate[i].RequestedParameters.DiscardOldest = (info->discardOldest ? OpcUa_True : OpcUa_False);
-            itemsToCreate[i].MonitoringMode = OpcUa_MonitoringMode_Reporting;
-        }
-        else {
-            errlogPrintf("%s Skip illegal node: %s\n",info->prec->name,info->ItemPath);
-        }
+
+    itemsToCreate.create(own.size());
+    for(i=0; i<own.size(); i++) {
+        OpcUa_UInt32 h = own[i];
+        info = m_vectorUaItemInfo->at(h);
+        UaNodeId tempNode((*m_vUaNodeId)[h]);
+        itemsToCreate[i].ItemToMonitor.AttributeId = OpcUa_Attributes_Value;
+        tempNode.copyTo(&(itemsToCreate[i].ItemToMonitor.NodeId));
+        if(info->rangeCount)
+            info->indexRange().copyTo(&(itemsToCreate[i].ItemToMonitor.IndexRange));
+        itemsToCreate[i].RequestedParameters.ClientHandle = h;
+        itemsToCreate[i].RequestedParameters.SamplingInterval = info->samplingInterval;
+        itemsToCreate[i].RequestedParameters.QueueSize = info->queueSize;
+        itemsToCreate[i].RequestedParameters.DiscardOldest = (info->discardOldest ? OpcUa_True : OpcUa_False);
+        if(info->aggregate && !info->aggregate->local)
+            info->aggregate->setFilter(itemsToCreate[i].RequestedParameters.Filter);
+        // triggered items report by SetTriggering, see setTriggers()
+        itemsToCreate[i].MonitoringMode = info->triggeredBy ? OpcUa_MonitoringMode_Sampling : OpcUa_MonitoringMode_Reporting;
     }
     if(debug) errlogPrintf("\nAdd monitored items to subscription ...\n");
     result = m_pSubscription->createMonitoredItems(
@@ -221,29 +551,277 @@ UaStatus DevUaSubscription::createMonitoredItems(std::vector<UaNodeId> &vUaNodeI
         createResults);
     if (result.isGood())
     {
+        int nRevised = 0;
         // check individual results
         for (i = 0; i < createResults.length(); i++)
         {
+            OPCUA_ItemINFO* uaItem = m_vectorUaItemInfo->at(own[i]);
             if (OpcUa_IsGood(createResults[i].StatusCode))
             {
-                if(debug>1) errlogPrintf("%4d: %s\n",i,
+                uaItem->monitoredItemId = createResults[i].MonitoredItemId;
+                uaItem->revisedSamplingInterval = createResults[i].RevisedSamplingInterval;
+                uaItem->revisedQueueSize = createResults[i].RevisedQueueSize;
+                uaItem->subscription = this;
+                uaItem->monitoringMode = itemsToCreate[i].MonitoringMode;
+                uaItem->idleScans = 0;
+                if(uaItem->aggregate && !uaItem->aggregate->local) {
+                    uaItem->aggregate->setFilterResult(createResults[i].FilterResult);
+                    if(debug || uaItem->debug)
+                        errlogPrintf("%s: server aggregate %s, processing interval %g -> %g ms\n", uaItem->prec->name,
+                                     uaItem->aggregate->name(), uaItem->aggregate->interval, uaItem->aggregate->revisedInterval);
+                }
+                // requested sampling interval <= 0 means fastest practical / publishing interval: nothing to report
+                if(uaItem->samplingInterval > 0.0 && uaItem->revisedSamplingInterval > uaItem->samplingInterval) {
+                    nRevised++;
+                    if(debug || uaItem->debug)
+                        errlogPrintf("%s: server revised sampling interval %g -> %g ms\n", uaItem->prec->name,
+                                     uaItem->samplingInterval, uaItem->revisedSamplingInterval);
+                }
+                if(uaItem->revisedQueueSize != uaItem->queueSize && (debug || uaItem->debug))
+                    errlogPrintf("%s: server revised queue size %u -> %u\n", uaItem->prec->name,
+                                 uaItem->queueSize, uaItem->revisedQueueSize);
+                if(debug>1) errlogPrintf("%4d: %s\n",own[i],
                     UaNodeId(itemsToCreate[i].ItemToMonitor.NodeId).toXmlString().toUtf8());
             }
+            else if(uaItem->aggregate && !uaItem->aggregate->local && DevUaAggregate::notSupported(createResults[i].StatusCode))
+            {
+                uaItem->subscription = NULL;
+                uaItem->aggregate->local = 1;
+                fallback.push_back(own[i]);
+                errlogPrintf("%s: server rejects aggregate %s (%s), computed by the driver\n", uaItem->prec->name,
+                             uaItem->aggregate->name(), UaStatus(createResults[i].StatusCode).toString().toUtf8());
+            }
             else
             {
+                uaItem->subscription = NULL;
                 if(debug) {
-                    OPCUA_ItemINFO* uaItem = m_vectorUaItemInfo->at(i);
                     errlogPrintf("%4d %s DevUaSubscription::createMonitoredItems failed for node: %s - Status %s\n",
-                        i, uaItem->prec->name,
+                        own[i], uaItem->prec->name,
                         UaNodeId(itemsToCreate[i].ItemToMonitor.NodeId).toXmlString().toUtf8(),
                         UaStatus(createResults[i].StatusCode).toString().toUtf8());
                 }
             }
         }
+        if(nRevised)
+            errlogPrintf("DevUaSubscription: server sampling slower than requested for %d items, see opcuaStat(3)\n", nRevised);
     }
     else
     {
        if(debug)  errlogPrintf("DevUaSubscription::createMonitoredItems service call failed with status %s\n", result.toString().toUtf8());
+       for(i=0; i<own.size(); i++)
+           m_vectorUaItemInfo->at(own[i])->subscription = NULL;
     }
     return result;
 }
+
+// Set the monitoring mode of the monitored items owned by the items with the given handles
+UaStatus DevUaSubscription::setMonitoringMode(OpcUa_MonitoringMode mode, const std::vector<OpcUa_UInt32> &handles)
+{
+    UaStatus result;
+    ServiceSettings serviceSettings;
+    initServiceSettings(serviceSettings);
+    UaUInt32Array monitoredItemIds;
+    UaStatusCodeArray results;
+
+    if(handles.empty())
+        return OpcUa_Good;
+    monitoredItemIds.create(handles.size());
+    for(OpcUa_UInt32 i=0; i<handles.size(); i++)
+        monitoredItemIds[i] = m_vectorUaItemInfo->at(handles[i])->monitoredItemId;
+    result = m_pSubscription->setMonitoringMode(serviceSettings, mode, monitoredItemIds, results);
+    if(result.isBad()) {
+        if(debug) errlogPrintf("DevUaSubscription::setMonitoringMode failed with status %s\n", result.toString().toUtf8());
+        return result;
+    }
+    for(OpcUa_UInt32 i=0; i<handles.size() && i<results.length(); i++) {
+        OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(handles[i]);
+        if(OpcUa_IsGood(results[i]))
+            uaItem->monitoringMode = mode;
+        if(debug || uaItem->debug)
+            errlogPrintf("%s: monitoring mode %s: %s\n", uaItem->prec->name,
+                         (mode == OpcUa_MonitoringMode_Reporting) ? "Reporting"
+                         : (mode == OpcUa_MonitoringMode_Sampling) ? "Sampling" : "Disabled",
+                         UaStatus(results[i]).toString().toUtf8());
+    }
+    return result;
+}
+
+// Feed recorded notifications into dataChange(), see opcUaReplay()
+void DevUaSubscription::replay(std::vector<OPCUA_ItemINFO *> *uaItemInfo, const UaDataNotifications &dataNotifications)
+{
+    UaDiagnosticInfos diagnosticInfos;
+    if(!m_vectorUaItemInfo)     // no server: no monitored items were created
+        m_vectorUaItemInfo = uaItemInfo;
+    dataChange(0, dataNotifications, diagnosticInfos);
+}
+
+/* Forget the items of the given client handles in this subscription without deleting
+ * anything on the server. Returns the ids of the monitored items they own, for
+ * deleteMonitoredItemIds(). Items sharing one of them are appended to orphans. */
+std::vector<OpcUa_UInt32> DevUaSubscription::releaseMonitoredItems(const std::vector<OpcUa_UInt32> &handles,
+                                                                   std::vector<OpcUa_UInt32> *orphans)
+{
+    std::vector<OpcUa_UInt32> own, ids;
+
+    for(OpcUa_UInt32 i=0; i<handles.size(); i++) {
+        OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(handles[i]);
+        if(uaItem && uaItem->sharedPrimary)
+            detachShared(uaItem);   // the monitored item belongs to another item
+        else
+            own.push_back(handles[i]);
+    }
+    for(OpcUa_UInt32 i=0; i<own.size(); i++) {
+        releaseShared(own[i], orphans);
+        if(m_vectorUaItemInfo->at(own[i]) && m_vectorUaItemInfo->at(own[i])->monitoredItemId)
+            ids.push_back(m_vectorUaItemInfo->at(own[i])->monitoredItemId);
+    }
+    return ids;
+}
+
+// Delete monitored items on the server by their ids
+UaStatus DevUaSubscription::deleteMonitoredItemIds(const std::vector<OpcUa_UInt32> &ids)
+{
+    UaStatus result;
+    ServiceSettings serviceSettings;
+    initServiceSettings(serviceSettings);
+    UaUInt32Array monitoredItemIds;
+    UaStatusCodeArray results;
+
+    if(ids.empty())
+        return OpcUa_Good;
+    monitoredItemIds.create(ids.size());
+    for(OpcUa_UInt32 i=0; i<ids.size(); i++)
+        monitoredItemIds[i] = ids[i];
+    result = m_pSubscription->deleteMonitoredItems(serviceSettings, monitoredItemIds, results);
+    if (result.isBad())
+        errlogPrintf("DevUaSubscription::deleteMonitoredItems failed with status %s\n", result.toString().toUtf8());
+    return result;
+}
+
+/* Delete the monitored items of the given client handles from this subscription.
+ * Items triggered by a deleted monitored item lose their link and are switched to
+ * Reporting, unless their trigger record stays and is linked again. */
+UaStatus DevUaSubscription::deleteMonitoredItems(const std::vector<OpcUa_UInt32> &handles)
+{
+    std::set<OpcUa_UInt32> deleted(handles.begin(), handles.end());
+    std::set<std::string> triggers;     // records whose monitored item is deleted
+    std::vector<OpcUa_UInt32> orphans, unlinked;
+    OpcUa_UInt32 i;
+
+    for(i=0; i<handles.size(); i++) {
+        OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(handles[i]);
+        if(uaItem && !uaItem->sharedPrimary)
+            triggers.insert(uaItem->prec->name);
+    }
+    UaStatus result = deleteMonitoredItemIds(releaseMonitoredItems(handles, &orphans));
+    // items that shared a deleted monitored item and stay: monitor them on their own
+    std::vector<OpcUa_UInt32> stay;
+    for(i=0; i<orphans.size(); i++) {
+        triggers.insert(m_vectorUaItemInfo->at(orphans[i])->prec->name);
+        if(!deleted.count(orphans[i]))
+            stay.push_back(orphans[i]);
+    }
+    std::set<OpcUa_UInt32> recreated(stay.begin(), stay.end());
+    for(i=0; i<m_vectorUaItemInfo->size(); i++) {
+        OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(i);
+        if(uaItem && uaItem->triggeredBy && !uaItem->sharedPrimary && uaItem->subscription == this
+                && uaItem->monitoredItemId && !deleted.count(i) && !recreated.count(i)
+                && triggers.count(uaItem->triggeredBy)) {
+            if(debug || uaItem->debug)
+                errlogPrintf("%s: trigger '%s' deleted, reporting on its own\n", uaItem->prec->name, uaItem->triggeredBy);
+            unlinked.push_back(i);
+        }
+    }
+    setMonitoringMode(OpcUa_MonitoringMode_Reporting, unlinked);
+    if(stay.size())
+        createMonitoredItems(*m_vUaNodeId, m_vectorUaItemInfo, stay);
+    return result;
+}
+
+std::string DevUaSubscription::shareKey(const UaNodeId &node, const OPCUA_ItemINFO *uaItem)
+{
+    char buf[64];
+    char agg[48] = "";
+    sprintf(buf, "|%g|%u|%d|", uaItem->samplingInterval, uaItem->queueSize, uaItem->discardOldest);
+    if(uaItem->aggregate)
+        sprintf(agg, "|%s,%g", uaItem->aggregate->name(), uaItem->aggregate->interval);
+    return std::string(node.toXmlString().toUtf8()) + buf + uaItem->indexRange().toUtf8() + agg
+            + (uaItem->triggeredBy ? std::string("|T:") + uaItem->triggeredBy : std::string());
+}
+
+void DevUaSubscription::attachShared(OPCUA_ItemINFO *uaItem, OPCUA_ItemINFO *primary)
+{
+    uaItem->sharedPrimary = primary;
+    uaItem->subscription = primary->subscription;
+    uaItem->monitoredItemId = primary->monitoredItemId;
+    uaItem->revisedSamplingInterval = primary->revisedSamplingInterval;
+    uaItem->revisedQueueSize = primary->revisedQueueSize;
+    epicsMutexLock(shareLock);          // dataChange() may walk the list meanwhile
+    uaItem->sharedNext = primary->sharedNext;
+    primary->sharedNext = uaItem;
+    epicsMutexUnlock(shareLock);
+    if(debug > 1 || uaItem->debug)
+        errlogPrintf("%s: shares the monitored item of %s\n", uaItem->prec->name, primary->prec->name);
+}
+
+// Break up all share lists of this subscription, its monitored items are gone
+void DevUaSubscription::unlinkShared()
+{
+    if(!m_vectorUaItemInfo)
+        return;
+    epicsMutexLock(shareLock);
+    for(OpcUa_UInt32 i=0; i<m_vectorUaItemInfo->size(); i++) {
+        OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(i);
+        if(uaItem && uaItem->subscription == this) {
+            uaItem->sharedPrimary = NULL;
+            uaItem->sharedNext = NULL;
+        }
+    }
+    epicsMutexUnlock(shareLock);
+}
+
+// Remove an item from the list of the item owning the monitored item
+void DevUaSubscription::detachShared(OPCUA_ItemINFO *uaItem)
+{
+    OPCUA_ItemINFO *p = uaItem->sharedPrimary;
+
+    epicsMutexLock(shareLock);
+    while(p && p->sharedNext != uaItem)
+        p = p->sharedNext;
+    if(p)
+        p->sharedNext = uaItem->sharedNext;
+    uaItem->sharedPrimary = NULL;
+    uaItem->sharedNext = NULL;
+    epicsMutexUnlock(shareLock);
+    uaItem->subscription = NULL;
+    uaItem->monitoredItemId = 0;
+}
+
+/* The monitored item of handle is deleted or could not be created: forget its share key
+ * and detach the items sharing it. Their handles are appended to orphans if not NULL. */
+void DevUaSubscription::releaseShared(OpcUa_UInt32 handle, std::vector<OpcUa_UInt32> *orphans)
+{
+    OPCUA_ItemINFO *uaItem = m_vectorUaItemInfo->at(handle);
+    std::map<OpcUa_UInt32, std::string>::iterator it = sharedKeys.find(handle);
+
+    if(it != sharedKeys.end()) {
+        sharedItems.erase(it->second);
+        sharedKeys.erase(it);
+    }
+    if(!uaItem)
+        return;
+    epicsMutexLock(shareLock);
+    OPCUA_ItemINFO *s = uaItem->sharedNext;
+    uaItem->sharedNext = NULL;
+    epicsMutexUnlock(shareLock);
+    while(s) {
+        OPCUA_ItemINFO *next = s->sharedNext;
+        s->sharedPrimary = NULL;
+        s->sharedNext = NULL;
+        s->subscription = NULL;
+        s->monitoredItemId = 0;
+        if(orphans)
+            orphans->push_back(s->itemIdx);
+        s = next;
+    }
+}
@@ -18,7 +18,10 @@
 #ifndef DEVUASUBSCRIPTION_H
 #define DEVUASUBSCRIPTION_H
 
+#include <map>
+#include <string>
 #include "drvOpcUa.h"
+#include "devUaLatency.h"
 #include "devUaClient.h"
 #include <uasubscription.h>
 
@@ -40,14 +43,45 @@ public:
         OpcUa_UInt32                clientSubscriptionHandle,
         UaEventFieldLists&          eventFieldList);
 
-    UaStatus createSubscription(UaClientSdk::UaSession *pSession);
+    UaStatus createSubscription(UaClientSdk::UaSession *pSession, double publishingInterval = -1.0);
     UaStatus deleteSubscription();
     UaStatus createMonitoredItems(std::vector<UaNodeId> &vUaNodeId,std::vector<OPCUA_ItemINFO *> *m_vectorUaItemInfo);
+    UaStatus createMonitoredItems(std::vector<UaNodeId> &vUaNodeId,std::vector<OPCUA_ItemINFO *> *m_vectorUaItemInfo,
+                                  const std::vector<OpcUa_UInt32> &handles);
+    UaStatus deleteMonitoredItems(const std::vector<OpcUa_UInt32> &handles);
+    std::vector<OpcUa_UInt32> releaseMonitoredItems(const std::vector<OpcUa_UInt32> &handles,
+                                                    std::vector<OpcUa_UInt32> *orphans);
+    UaStatus deleteMonitoredItemIds(const std::vector<OpcUa_UInt32> &ids);
+    UaStatus setMonitoringMode(OpcUa_MonitoringMode mode, const std::vector<OpcUa_UInt32> &handles);
+    void replay(std::vector<OPCUA_ItemINFO *> *uaItemInfo, const UaDataNotifications &dataNotifications);
+    bool itemDataChange(OPCUA_ItemINFO *uaItem, const OpcUa_DataValue &value, uint64_t rcvTicks,
+                        bool aggregated = false, const OPCUA_ItemINFO *decoded = NULL);
+    void unlinkShared();
 
     int debug;              // debug output independant from single channels
+    epicsUInt32 nNotifications; // data change notifications processed
+    epicsUInt32 nAllocs[2];     // values put on the heap by the notification path, [1] direct decode items
+    epicsUInt32 nEchoes;        // readbacks of OUT records skipped as echo of their own write
+    double publishingInterval;  // ms, as revised by the server
+    OpcUa_UInt32 lifetimeCount;     // as revised by the server
+    OpcUa_UInt32 maxKeepAliveCount;
+    DevUaLatency *latency;      // server->receive latency of the notifications
 private:
+    void setTriggers(const std::vector<OpcUa_UInt32> &handles);
+    UaStatus createOwnItems(const std::vector<OpcUa_UInt32> &own, std::vector<OpcUa_UInt32> &fallback);
+    static std::string shareKey(const UaNodeId &node, const OPCUA_ItemINFO *uaItem);
+    void attachShared(OPCUA_ItemINFO *uaItem, OPCUA_ItemINFO *primary);
+    void detachShared(OPCUA_ItemINFO *uaItem);
+    void releaseShared(OpcUa_UInt32 handle, std::vector<OpcUa_UInt32> *orphans);
+
     UaClientSdk::UaSession*                  m_pSession;
     UaClientSdk::UaSubscription*             m_pSubscription;
     std::vector<OPCUA_ItemINFO *> *m_vectorUaItemInfo;
+    std::vector<UaNodeId> *m_vUaNodeId;
+    std::map<std::string, OpcUa_UInt32> sharedItems;   // share key -> handle of the item owning the monitored item
+    std::map<OpcUa_UInt32, std::string> sharedKeys;    // and back
+    epicsMutexId shareLock;     // guards the sharedNext chains walked by dataChange()
 };
+
+extern int drvOpcua_SuppressEcho;
 #endif // DEVUASUBSCRIPTION_H
@@ -0,0 +1,243 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <errlog.h>
+
+#include "devUaThreadSched.h"
+
+struct SchedClass {
+    const char *name;
+    int prio;               // SCHED_FIFO priority, 0 = unchanged
+    std::string cpus;       // CPU list, empty = unchanged
+    unsigned int gen;       // incremented by each change
+};
+
+struct SchedThread {
+    char name[32];
+    int cls;
+    unsigned int gen;       // settings generation applied
+    int err;                // errno of the last attempt
+#ifdef __linux__
+    pthread_t tid;
+#endif
+};
+
+static SchedClass schedClasses[OPCUA_THREAD_CLASSES] = {
+    { "publish", 0, "", 0 },
+    { "timer",   0, "", 0 },
+    { "worker",  0, "", 0 },
+    { "replay",  0, "", 0 }
+};
+
+static epicsThreadOnceId schedOnce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId schedThreadId;
+static epicsMutexId schedLock;
+static std::vector<SchedThread *> schedThreads;
+
+static void schedInit(void *)
+{
+    schedThreadId = epicsThreadPrivateCreate();
+    schedLock = epicsMutexMustCreate();
+}
+
+#ifdef __linux__
+// Parse "2,4-7" into set, return 0 on success
+static int parseCpus(const char *cpus, cpu_set_t *set)
+{
+    const char *p = cpus;
+    char *end;
+
+    CPU_ZERO(set);
+    while(*p) {
+        long first = strtol(p, &end, 10), last;
+        if(end == p || first < 0 || first >= CPU_SETSIZE)
+            return 1;
+        last = first;
+        p = end;
+        if(*p == '-') {
+            last = strtol(p+1, &end, 10);
+            if(end == p+1 || last < first || last >= CPU_SETSIZE)
+                return 1;
+            p = end;
+        }
+        for(long c=first; c<=last; c++)
+            CPU_SET(c, set);
+        if(*p == ',')
+            p++;
+        else if(*p)
+            return 1;
+    }
+    return 0;
+}
+
+static std::string formatCpus(const cpu_set_t *set)
+{
+    std::string s;
+    char buf[24];
+
+    for(int c=0; c<CPU_SETSIZE; c++) {
+        if(!CPU_ISSET(c, set))
+            continue;
+        int last = c;
+        while(last+1 < CPU_SETSIZE && CPU_ISSET(last+1, set))
+            last++;
+        if(last > c)
+            sprintf(buf, "%s%d-%d", s.empty() ? "" : ",", c, last);
+        else
+            sprintf(buf, "%s%d", s.empty() ? "" : ",", c);
+        s += buf;
+        c = last;
+    }
+    return s;
+}
+#endif
+
+void uaThreadSched(int cls)
+{
+    SchedThread *t;
+    int prio;
+    std::string cpus;
+
+    epicsThreadOnce(&schedOnce, schedInit, NULL);
+    t = (SchedThread *) epicsThreadPrivateGet(schedThreadId);
+    if(t && t->gen == schedClasses[cls].gen)
+        return;
+    if(!t) {    // register the thread to show it in the report
+        t = (SchedThread *) calloc(1, sizeof(SchedThread));
+        if(!t)
+            return;
+        strncpy(t->name, epicsThreadGetNameSelf(), sizeof(t->name)-1);
+        t->cls = cls;
+#ifdef __linux__
+        t->tid = pthread_self();
+#endif
+        epicsThreadPrivateSet(schedThreadId, t);
+        epicsMutexLock(schedLock);
+        schedThreads.push_back(t);
+        epicsMutexUnlock(schedLock);
+    }
+    epicsMutexLock(schedLock);
+    prio = schedClasses[cls].prio;
+    cpus = schedClasses[cls].cpus;
+    t->gen = schedClasses[cls].gen;
+    epicsMutexUnlock(schedLock);
+
+    t->err = 0;
+#ifdef __linux__
+    if(prio > 0) {
+        struct sched_param param;
+        param.sched_priority = prio;
+        t->err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    }
+    if(!cpus.empty()) {
+        cpu_set_t set;
+        int err;
+        if(!parseCpus(cpus.c_str(), &set) && (err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)))
+            t->err = err;
+    }
+#else
+    if(prio > 0 || !cpus.empty())
+        t->err = ENOSYS;
+#endif
+    if(t->err)
+        errlogPrintf("%s: Failed to set %s thread scheduling: %s\n", t->name, schedClasses[cls].name, strerror(t->err));
+}
+
+long uaThreadSchedSet(const char *cls, int prio, const char *cpus)
+{
+    int i;
+
+    epicsThreadOnce(&schedOnce, schedInit, NULL);
+    for(i=0; i<OPCUA_THREAD_CLASSES; i++) {
+        if(cls && !strcmp(cls, schedClasses[i].name))
+            break;
+    }
+    if(i == OPCUA_THREAD_CLASSES) {
+        errlogPrintf("opcuaThreadSched: unknown thread class, use publish, timer, worker or replay\n");
+        return 1;
+    }
+#ifdef __linux__
+    if(prio < 0 || prio > sched_get_priority_max(SCHED_FIFO)) {
+        errlogPrintf("opcuaThreadSched: priority must be 0..%d\n", sched_get_priority_max(SCHED_FIFO));
+        return 1;
+    }
+    cpu_set_t set;
+    if(cpus && *cpus && parseCpus(cpus, &set)) {
+        errlogPrintf("opcuaThreadSched: illegal CPU list '%s', e.g. '2,4-7'\n", cpus);
+        return 1;
+    }
+#else
+    errlogPrintf("opcuaThreadSched: not supported on this OS\n");
+    return 1;
+#endif
+    epicsMutexLock(schedLock);
+    schedClasses[i].prio = prio;
+    schedClasses[i].cpus = cpus ? cpus : "";
+    schedClasses[i].gen++;
+    epicsMutexUnlock(schedLock);
+    return 0;
+}
+
+// Show configured and actually applied scheduling of the driver threads
+void uaThreadSchedReport(int verb)
+{
+    epicsThreadOnce(&schedOnce, schedInit, NULL);
+    epicsMutexLock(schedLock);
+    if(verb > 1) {
+        for(int i=0; i<OPCUA_THREAD_CLASSES; i++) {
+            if(schedClasses[i].prio || !schedClasses[i].cpus.empty())
+                errlogPrintf("Thread class %-8s configured: priority %d, CPUs %s\n", schedClasses[i].name,
+                             schedClasses[i].prio, schedClasses[i].cpus.empty() ? "-" : schedClasses[i].cpus.c_str());
+        }
+    }
+    for(unsigned int i=0; i<schedThreads.size(); i++) {
+        SchedThread *t = schedThreads[i];
+#ifdef __linux__
+        struct sched_param param;
+        int policy;
+        cpu_set_t set;
+        std::string cpus = "?";
+
+        if(pthread_getschedparam(t->tid, &policy, &param)) {
+            policy = -1;
+            param.sched_priority = 0;
+        }
+        if(!pthread_getaffinity_np(t->tid, sizeof(set), &set))
+            cpus = formatCpus(&set);
+        errlogPrintf("Thread %-16s %-8s %s priority %d, CPUs %s%s%s\n", t->name, schedClasses[t->cls].name,
+                     policy == SCHED_FIFO ? "FIFO " : policy == SCHED_RR ? "RR   " : policy == SCHED_OTHER ? "OTHER" : "?    ",
+                     param.sched_priority, cpus.c_str(), t->err ? ", failed: " : "", t->err ? strerror(t->err) : "");
+#else
+        errlogPrintf("Thread %-16s %-8s\n", t->name, schedClasses[t->cls].name);
+#endif
+    }
+    epicsMutexUnlock(schedLock);
+}
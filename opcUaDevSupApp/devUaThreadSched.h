@@ -0,0 +1,40 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUATHREADSCHED_H
+#define DEVUATHREADSCHED_H
+
+/* Real-time priority and CPU affinity of the threads running driver code. A thread
+ * calls uaThreadSched() with its class each time it wakes up, the settings of the
+ * class are applied the first time and after they were changed by opcuaThreadSched.
+ * Threads of the SDK and the EPICS timer queue are covered this way as well.
+ */
+typedef enum {
+    thrPublish = 0,     // SDK callback thread: data changes, write completion, connection status
+    thrTimer,           // timer queue of the client: reconnect and retry of failed items
+    thrWorker,          // process pool, see devUaProcessPool.h
+    thrReplay,          // opcuaReplay
+    OPCUA_THREAD_CLASSES
+} OpcUaThreadClass;
+
+void uaThreadSched(int cls);
+/* Set SCHED_FIFO priority (0 = don't change) and CPU list like "2,4-7" (NULL or
+ * empty = don't change) of a thread class. */
+long uaThreadSchedSet(const char *cls, int prio, const char *cpus);
+void uaThreadSchedReport(int verb);
+
+#endif // DEVUATHREADSCHED_H
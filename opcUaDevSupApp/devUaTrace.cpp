@@ -0,0 +1,138 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <errlog.h>
+#include <epicsExport.h>
+
+#include "devUaTrace.h"
+
+// Enable the trace rings, entries per thread (rounded up to a power of 2)
+int drvOpcua_Trace = 0;
+static int drvOpcua_TraceSize = 4096;
+
+extern "C" {
+    epicsExportAddress(int, drvOpcua_Trace);
+    epicsExportAddress(int, drvOpcua_TraceSize);
+}
+
+struct DevUaTraceRing {
+    char thread[32];
+    epicsUInt32 mask;
+    epicsUInt32 head;       // entries written, only the owner thread writes
+    DevUaTraceEntry *entries;
+};
+
+static epicsThreadOnceId traceOnce = EPICS_THREAD_ONCE_INIT;
+static epicsThreadPrivateId traceRingId;
+static epicsMutexId traceLock;
+static std::vector<DevUaTraceRing *> traceRings;
+
+static void traceInit(void *)
+{
+    traceRingId = epicsThreadPrivateCreate();
+    traceLock = epicsMutexMustCreate();
+}
+
+static DevUaTraceRing *newRing()
+{
+    epicsUInt32 size = 64;
+    DevUaTraceRing *ring = (DevUaTraceRing *) calloc(1, sizeof(DevUaTraceRing));
+
+    if(!ring)
+        return NULL;
+    while(size < (epicsUInt32) drvOpcua_TraceSize && size < 0x100000)
+        size <<= 1;
+    ring->entries = (DevUaTraceEntry *) calloc(size, sizeof(DevUaTraceEntry));
+    if(!ring->entries) {
+        free(ring);
+        return NULL;
+    }
+    ring->mask = size - 1;
+    strncpy(ring->thread, epicsThreadGetNameSelf(), sizeof(ring->thread)-1);
+    epicsMutexLock(traceLock);
+    traceRings.push_back(ring);
+    epicsMutexUnlock(traceLock);
+    epicsThreadPrivateSet(traceRingId, ring);
+    return ring;
+}
+
+void uaTrace(const char *event, const char *name, long a, long b)
+{
+    DevUaTraceRing *ring;
+    DevUaTraceEntry *e;
+
+    epicsThreadOnce(&traceOnce, traceInit, NULL);
+    ring = (DevUaTraceRing *) epicsThreadPrivateGet(traceRingId);
+    if(!ring && !(ring = newRing()))
+        return;
+    e = &ring->entries[ring->head & ring->mask];
+    epicsTimeGetCurrent(&e->ts);
+    e->event = event;
+    e->name  = name;
+    e->a = a;
+    e->b = b;
+    ring->head++;
+}
+
+struct TraceLine {
+    const DevUaTraceEntry *e;
+    const char *thread;
+};
+
+static bool traceLineBefore(const TraceLine &x, const TraceLine &y)
+{
+    if(x.e->ts.secPastEpoch != y.e->ts.secPastEpoch)
+        return x.e->ts.secPastEpoch < y.e->ts.secPastEpoch;
+    return x.e->ts.nsec < y.e->ts.nsec;
+}
+
+// Print the last n entries of all threads in time order
+void uaTraceDump(int n)
+{
+    std::vector<TraceLine> lines;
+    char buf[40];
+
+    epicsThreadOnce(&traceOnce, traceInit, NULL);
+    epicsMutexLock(traceLock);
+    for(unsigned int r=0; r<traceRings.size(); r++) {
+        DevUaTraceRing *ring = traceRings[r];
+        epicsUInt32 head = ring->head;
+        epicsUInt32 count = (head > ring->mask) ? ring->mask + 1 : head;
+        for(epicsUInt32 i=head-count; i!=head; i++) {
+            TraceLine l = { &ring->entries[i & ring->mask], ring->thread };
+            lines.push_back(l);
+        }
+    }
+    std::sort(lines.begin(), lines.end(), traceLineBefore);
+    if(n <= 0 || n > (int) lines.size())
+        n = lines.size();
+    for(unsigned int i=lines.size()-n; i<lines.size(); i++) {
+        const DevUaTraceEntry *e = lines[i].e;
+        epicsTimeToStrftime(buf, sizeof(buf), "%H:%M:%S.%06f", &e->ts);
+        errlogPrintf("%s %-16s %-12s %-28s %ld %#lx\n", buf, lines[i].thread, e->event,
+                     e->name ? e->name : "", e->a, e->b);
+    }
+    epicsMutexUnlock(traceLock);
+}
@@ -0,0 +1,50 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUATRACE_H
+#define DEVUATRACE_H
+
+#include <epicsTime.h>
+
+/* Binary trace of driver events. Each thread appends to its own ring, nothing is
+ * formatted until opcuaTraceDump() is called. With drvOpcua_Trace = 0 a trace point
+ * costs one compare, building with -DOPCUA_NO_TRACE removes the trace points.
+ *
+ * event and name are not copied, they must be string literals or record names.
+ * Entries written during a dump may show up partly written.
+ */
+typedef struct {
+    epicsTimeStamp ts;
+    const char *event;
+    const char *name;
+    long a;
+    long b;
+} DevUaTraceEntry;
+
+void uaTrace(const char *event, const char *name, long a, long b);
+void uaTraceDump(int n);
+
+extern int drvOpcua_Trace;
+
+#ifdef OPCUA_NO_TRACE
+#define UA_TRACE(event, name, a, b) do {} while(0)
+#else
+#define UA_TRACE(event, name, a, b) \
+    do { if(drvOpcua_Trace) uaTrace(event, name, (long)(a), (long)(b)); } while(0)
+#endif
+
+#endif // DEVUATRACE_H
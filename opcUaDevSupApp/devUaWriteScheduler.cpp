@@ -0,0 +1,207 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+#include <limits.h>
+#include <epicsExport.h>
+
+#include "devUaWriteScheduler.h"
+#include "devUaClient.h"
+#include "devUaBitWord.h"
+#include "devUaOutQueue.h"
+
+/* Max. number of write requests in flight per priority class, 0 = no limit. LOW is the
+ * default class of all records: bounded, so bulk writes can't fill the transport ahead
+ * of a HIGH write, but not serialized. */
+static int drvOpcua_WriteInFlightLow = 2;
+static int drvOpcua_WriteInFlightMedium = 4;
+static int drvOpcua_WriteInFlightHigh = 16;
+
+extern "C" {
+    epicsExportAddress(int, drvOpcua_WriteInFlightLow);
+    epicsExportAddress(int, drvOpcua_WriteInFlightMedium);
+    epicsExportAddress(int, drvOpcua_WriteInFlightHigh);
+}
+
+static const char *prioNames[OPCUA_WRITE_PRIOS] = { "LOW", "MEDIUM", "HIGH" };
+
+static int maxInFlight(int prio)
+{
+    int n;
+    switch(prio) {
+    case 2:  n = drvOpcua_WriteInFlightHigh; break;
+    case 1:  n = drvOpcua_WriteInFlightMedium; break;
+    default: n = drvOpcua_WriteInFlightLow; break;
+    }
+    return (n > 0) ? n : INT_MAX;
+}
+
+DevUaWriteScheduler::DevUaWriteScheduler(DevUaClient *client)
+    : client(client)
+    , lock(epicsMutexMustCreate())
+{
+    for(int i=0; i<OPCUA_WRITE_PRIOS; i++) {
+        cls[i].inFlight = 0;
+        cls[i].nWrites  = 0;
+        cls[i].nQueued  = 0;
+        cls[i].maxQueue = 0;
+        cls[i].sumWait  = 0.0;
+        cls[i].maxWait  = 0.0;
+        cls[i].nSent    = 0;
+        cls[i].sumSend  = 0;
+        cls[i].maxSend  = 0;
+    }
+}
+
+DevUaWriteScheduler::~DevUaWriteScheduler()
+{
+    epicsMutexDestroy(lock);
+}
+
+// call with lock held
+bool DevUaWriteScheduler::canSend(int prio) const
+{
+    for(int i=OPCUA_WRITE_PRIOS-1; i>prio; i--) {
+        if(!cls[i].queue.empty())
+            return false;
+    }
+    return cls[prio].queue.empty() && cls[prio].inFlight < maxInFlight(prio);
+}
+
+UaStatus DevUaWriteScheduler::submit(OPCUA_ItemINFO *uaItem, UaVariant &value)
+{
+    int prio = uaItem->writePrio;
+    WriteClass &c = cls[prio];
+
+    epicsMutexLock(lock);
+    if(canSend(prio)) {
+        c.inFlight++;
+        c.nWrites++;
+        epicsMutexUnlock(lock);
+
+        UaStatus result = send(c, uaItem, value);
+        if(result.isBad()) {    // no writeComplete will follow
+            epicsMutexLock(lock);
+            c.inFlight--;
+            epicsMutexUnlock(lock);
+            dispatch();
+        }
+        return result;
+    }
+    c.queue.push_back(PendingWrite());
+    c.queue.back().uaItem = uaItem;
+    c.queue.back().value  = value;
+    c.queue.back().queued = epicsTime::getCurrent();
+    c.nQueued++;
+    if(c.queue.size() > c.maxQueue)
+        c.maxQueue = c.queue.size();
+    epicsMutexUnlock(lock);
+    if(uaItem->debug >= 2)
+        errlogPrintf("%s: write queued, priority %s\n", uaItem->prec->name, prioNames[prio]);
+    return OpcUa_Good;
+}
+
+void DevUaWriteScheduler::complete(OPCUA_ItemINFO *uaItem)
+{
+    epicsMutexLock(lock);
+    if(cls[uaItem->writePrio].inFlight > 0)
+        cls[uaItem->writePrio].inFlight--;
+    epicsMutexUnlock(lock);
+    dispatch();
+}
+
+// Send queued writes, highest class first, as long as the in-flight bounds allow
+void DevUaWriteScheduler::dispatch()
+{
+    for(;;) {
+        PendingWrite w;
+        int prio;
+
+        epicsMutexLock(lock);
+        for(prio=OPCUA_WRITE_PRIOS-1; prio>=0; prio--) {
+            if(!cls[prio].queue.empty())
+                break;
+        }
+        if(prio < 0 || cls[prio].inFlight >= maxInFlight(prio)) {
+            epicsMutexUnlock(lock);
+            return;
+        }
+        WriteClass &c = cls[prio];
+        w = c.queue.front();
+        c.queue.pop_front();
+        c.inFlight++;
+        c.nWrites++;
+        double wait = epicsTime::getCurrent() - w.queued;
+        c.sumWait += wait;
+        if(wait > c.maxWait)
+            c.maxWait = wait;
+        epicsMutexUnlock(lock);
+
+        UaStatus result = client->isConnected() ? send(c, w.uaItem, w.value)
+                                                : UaStatus(OpcUa_BadServerNotConnected);
+        if(result.isBad()) {
+            epicsMutexLock(lock);
+            c.inFlight--;
+            epicsMutexUnlock(lock);
+            failWrite(w.uaItem, result.statusCode());
+        }
+    }
+}
+
+// Send the write, account the time it takes to encode and send the request
+UaStatus DevUaWriteScheduler::send(WriteClass &c, OPCUA_ItemINFO *uaItem, UaVariant &value)
+{
+    uint64_t start = uaTicksNow();
+    UaStatus result = client->sendWrite(uaItem, value);
+    uint64_t ticks = uaTicksNow() - start;
+
+    epicsMutexLock(lock);
+    c.nSent++;
+    c.sumSend += ticks;
+    if(ticks > c.maxSend)
+        c.maxSend = ticks;
+    epicsMutexUnlock(lock);
+    return result;
+}
+
+// A queued write could not be sent: finish the record like writeComplete() does
+void DevUaWriteScheduler::failWrite(OPCUA_ItemINFO *uaItem, OpcUa_StatusCode stat)
+{
+    uaItem->stat = stat;
+    if(uaItem->debug >= 1)
+        errlogPrintf("%s: queued write failed: %s\n", uaItem->prec->name, UaStatus(stat).toString().toUtf8());
+    if(uaItem->bitWord && uaItem->bitWord->isCarrier(uaItem))
+        uaItem->bitWord->complete(uaItem, stat);
+    else if(uaItem->outQueue)
+        uaItem->outQueue->complete(uaItem, stat);
+    else
+        callbackRequest(&(uaItem->callback));
+}
+
+void DevUaWriteScheduler::report(int verb)
+{
+    epicsMutexLock(lock);
+    errlogPrintf("Write scheduler: prio  inFlight/max(0=any)  queued  writes  waited  maxQueue  avgWait[ms]  maxWait[ms]  avgSend[us]  maxSend[us]\n");
+    for(int i=OPCUA_WRITE_PRIOS-1; i>=0; i--) {
+        WriteClass &c = cls[i];
+        errlogPrintf("                 %-6s %4d/%-4d %7lu %7u %7u %9lu %12.3f %12.3f %12.1f %12.1f\n", prioNames[i],
+                     c.inFlight, (maxInFlight(i) == INT_MAX) ? 0 : maxInFlight(i), (unsigned long) c.queue.size(), c.nWrites, c.nQueued,
+                     (unsigned long) c.maxQueue, c.nQueued ? 1000.0 * c.sumWait / c.nQueued : 0.0, 1000.0 * c.maxWait,
+                     c.nSent ? c.sumSend / 10.0 / c.nSent : 0.0, c.maxSend / 10.0);
+    }
+    epicsMutexUnlock(lock);
+}
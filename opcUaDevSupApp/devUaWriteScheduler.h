@@ -0,0 +1,74 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+#ifndef DEVUAWRITESCHEDULER_H
+#define DEVUAWRITESCHEDULER_H
+
+#include <deque>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include "drvOpcUa.h"
+
+#define OPCUA_WRITE_PRIOS 3    // LOW, MEDIUM, HIGH as in menuPriority
+
+/* Write scheduler: Each priority class has its own queue and a bound of write
+ * requests in flight. A class is only served if all higher classes have empty
+ * queues, so high priority writes are never queued behind bulk writes of a lower
+ * class. Every write is sent as its own request, nothing is batched.
+ */
+class DevUaWriteScheduler
+{
+    UA_DISABLE_COPY(DevUaWriteScheduler);
+public:
+    DevUaWriteScheduler(DevUaClient *client);
+    ~DevUaWriteScheduler();
+
+    // send the write or queue it. Return the beginWrite status if sent immediately.
+    UaStatus submit(OPCUA_ItemINFO *uaItem, UaVariant &value);
+    // the write of the item is done, send queued writes
+    void complete(OPCUA_ItemINFO *uaItem);
+    void report(int verb);
+
+private:
+    struct PendingWrite {
+        OPCUA_ItemINFO *uaItem;
+        UaVariant value;
+        epicsTime queued;
+    };
+    struct WriteClass {
+        std::deque<PendingWrite> queue;
+        int inFlight;
+        epicsUInt32 nWrites;        // writes sent
+        epicsUInt32 nQueued;        // writes that had to wait
+        size_t maxQueue;
+        double sumWait;             // s, queueing latency of the writes sent
+        double maxWait;
+        epicsUInt32 nSent;          // sendWrite() calls
+        uint64_t sumSend;           // 100ns ticks spent in sendWrite(): encoding and sending
+        uint64_t maxSend;
+    };
+    bool canSend(int prio) const;
+    void dispatch();
+    void failWrite(OPCUA_ItemINFO *uaItem, OpcUa_StatusCode stat);
+    UaStatus send(WriteClass &c, OPCUA_ItemINFO *uaItem, UaVariant &value);
+
+    DevUaClient *client;
+    epicsMutexId lock;
+    WriteClass cls[OPCUA_WRITE_PRIOS];
+};
+
+#endif // DEVUAWRITESCHEDULER_H
@@ -21,6 +21,7 @@
 
 #include <boost/algorithm/string.hpp>
 #include <string>
+#include <map>
 #include <vector>
 
 // regex and stoi for lexical_cast are available as std functions in C11
@@ -29,6 +30,7 @@
 #include <boost/lexical_cast.hpp>
 
 #include <epicsPrint.h>
+#include <epicsStdio.h>
 #include <epicsExport.h>
 #include <registryFunction.h>
 #include <dbCommon.h>
@@ -37,9 +39,17 @@
 #include <devLib.h>
 #include <iocsh.h>
 
+#include <opcua_proxystub.h>
+
 #include "drvOpcUa.h"
 #include "devUaSubscription.h"
 #include "devUaClient.h"
+#include "devUaShmRing.h"
+#include "devUaCapture.h"
+#include "devUaProcessPool.h"
+#include "devUaBitWord.h"
+#include "devUaStruct.h"
+#include "devUaAggregate.h"
 
 using namespace UaClientSdk;
 
@@ -246,6 +256,159 @@ int OPCUA_ItemINFO::checkDataLoss()
     return 0;
 }
 
+// Bind the compiled converters for the current itemDataType. Read converters target the
+// type the value is read into: VAL/RVAL for IN-records, the readback type for OUT-records.
+void OPCUA_ItemINFO::bindConverters()
+{
+    epicsType readType = inpDataType ? inpDataType : recDataType;
+
+    convType  = itemDataType;
+    readConv  = isArray ? NULL : uaReadConverter(itemDataType, readType);
+    writeConv = (isArray || !inpDataType) ? NULL : uaWriteConverter(inpDataType, itemDataType);
+}
+
+/* Direct decode mode: copy the notification value into the fixed, typed slots of the item.
+ * Never allocates - strings are cut to the record string size, arrays to NELM.
+ * Return 0 ok, 1 value type not supported. */
+long OPCUA_ItemINFO::decodeValue(const OpcUa_Variant &val)
+{
+    if(val.ArrayType == OpcUa_VariantArrayType_Scalar) {
+        if(val.Datatype == OpcUaType_String) {
+            OpcUa_String *pStr = (OpcUa_String *) &val.Value.String;
+            const char *raw = OpcUa_String_GetRawString(pStr);
+            epicsUInt32 len = raw ? OpcUa_String_StrSize(pStr) : 0;
+            if(len >= MAX_STRING_SIZE)
+                len = MAX_STRING_SIZE-1;
+            memcpy(strVal, raw, len);
+            strVal[len] = 0;
+            directVal.Datatype = OpcUaType_String;
+            directVal.ArrayType = OpcUa_VariantArrayType_Scalar;
+            return 0;
+        }
+        if(val.Datatype < OpcUaType_Boolean || val.Datatype > OpcUaType_Double)
+            return 1;
+        directVal.Datatype  = val.Datatype;
+        directVal.ArrayType = OpcUa_VariantArrayType_Scalar;
+        directVal.Value     = val.Value;    // fixed size scalar, no heap data
+        if(recDataType == epicsOldStringT || recDataType == epicsStringT) {
+            switch(val.Datatype) {
+            case OpcUaType_Boolean: strcpy(strVal, val.Value.Boolean ? "true" : "false"); break;
+            case OpcUaType_Float:   epicsSnprintf(strVal, MAX_STRING_SIZE, "%g", val.Value.Float); break;
+            case OpcUaType_Double:  epicsSnprintf(strVal, MAX_STRING_SIZE, "%g", val.Value.Double); break;
+            default: {
+                epicsFloat64 d;
+                uaReadConverter(val.Datatype, epicsFloat64T)(val, &d);
+                epicsSnprintf(strVal, MAX_STRING_SIZE, "%.0f", d);
+            }
+            }
+        }
+        return 0;
+    }
+    if(val.ArrayType != OpcUa_VariantArrayType_Array || !arrBuf)
+        return 1;
+    if(!arrayConv || arrayConvType != val.Datatype) {
+        arrayConv = uaArrayConverter(val.Datatype, recDataType);
+        arrayConvType = val.Datatype;
+        if(!arrayConv)
+            return 1;
+    }
+    arrLen = (val.Value.Array.Length > arraySize) ? arraySize : (val.Value.Array.Length > 0 ? val.Value.Array.Length : 0);
+    arrayConv(val.Value.Array.Value.Array, arrBuf, arrLen);
+    directVal.Datatype  = val.Datatype;
+    directVal.ArrayType = OpcUa_VariantArrayType_Array;
+    return 0;
+}
+
+/* Records sharing a monitored item decode a notification the same way if they read the
+ * same member into the same type and size, without a local aggregate of their own. */
+bool OPCUA_ItemINFO::sameDecode(const OPCUA_ItemINFO *other) const
+{
+    if(!other || other == this)
+        return false;
+    if((member == NULL) != (other->member == NULL) || (member && strcmp(member, other->member)))
+        return false;
+    if((aggregate && aggregate->local) || (other->aggregate && other->aggregate->local))
+        return false;
+    return directDecode == other->directDecode && recDataType == other->recDataType
+        && inpDataType == other->inpDataType && isArray == other->isArray
+        && arraySize == other->arraySize && arrElemSize == other->arrElemSize;
+}
+
+// Take the decoded value of a record of the same monitored item, see sameDecode()
+void OPCUA_ItemINFO::copyDecoded(const OPCUA_ItemINFO &from)
+{
+    if(!directDecode) {
+        varVal = from.varVal;
+        return;
+    }
+    directVal = from.directVal;     // scalar or type only, no heap data
+    memcpy(strVal, from.strVal, MAX_STRING_SIZE);
+    if(arrBuf && from.arrBuf) {
+        arrLen = from.arrLen;
+        memcpy(arrBuf, from.arrBuf, (size_t) arrLen * arrElemSize);
+    }
+}
+
+/* Split a link "node[first:last]": ItemPath keeps the node. A single element is
+ * given as [n:n]. A bracket without colon is part of the node, e.g. an array element
+ * node of a Siemens server. */
+void splitIndexRange(OPCUA_ItemINFO *uaItem)
+{
+    char *open = strrchr(uaItem->ItemPath, '[');
+    int first, last, len = 0;
+
+    uaItem->rangeFirst = uaItem->rangeCount = 0;
+    if(!open || sscanf(open, "[%d:%d]%n", &first, &last, &len) != 2 || open[len] != 0)
+        return;
+    if(first < 0 || last < first) {
+        errlogPrintf("%s: illegal index range '%s', ignored\n", uaItem->prec->name, open);
+        return;
+    }
+    uaItem->rangeFirst = first;
+    uaItem->rangeCount = last - first + 1;
+    *open = 0;
+}
+
+/* OPC UA IndexRange of the slice, of its first n elements if 0 < n < slice length.
+ * Empty string if the item has no slice. */
+UaString OPCUA_ItemINFO::indexRange(int n) const
+{
+    char buf[32];
+    int last = rangeFirst + ((n > 0 && n < rangeCount) ? n : rangeCount) - 1;
+
+    if(rangeCount == 0)
+        return UaString();
+    if(last == rangeFirst)
+        sprintf(buf, "%d", rangeFirst);
+    else
+        sprintf(buf, "%d:%d", rangeFirst, last);
+    return UaString(buf);
+}
+
+/* Value of the direct decode slots as variant for the generic conversions. A string
+ * is kept in strVal only, directVal has its type but no data. */
+UaVariant OPCUA_ItemINFO::directValue() const
+{
+    UaVariant v;
+    if(directVal.Datatype == OpcUaType_String)
+        v.setString(UaString(strVal));
+    else
+        v = directVal;
+    return v;
+}
+
+// Current value for debug output
+UaString OPCUA_ItemINFO::valueToString()
+{
+    if(!directDecode)
+        return varVal.toString();
+    if(directVal.Datatype == OpcUaType_String)
+        return UaString(strVal);
+    if(directVal.ArrayType == OpcUa_VariantArrayType_Array)
+        return UaString("[array]");
+    return UaVariant(directVal).toString();
+}
+
 /***************** just for debug ********************/
 
 void print_OpcUa_DataValue(_OpcUa_DataValue *d)
@@ -285,44 +448,93 @@ void printVal(UaVariant &val,OpcUa_UInt32 IdxUaItemInfo)
 
 long OPCUA_ItemINFO::write(UaVariant &tempValue)
 {
+    if(member) {    // writing a member would need to encode the whole structure
+        if(debug) errlogPrintf("%s: can't write member '%s'\n", prec->name, member);
+        stat = OpcUa_BadNotWritable;
+        return 1;
+    }
     stat = UaStatusCode(pMyClient->writeFunc(this, tempValue)).statusCode();
     if( OpcUa_IsGood(stat))
         return 0;
     return 1;
 }
 
-/* iocShell: Read and setup uaItem Item data type, createMonitoredItems */
-extern "C" {
-epicsRegisterFunction(OpcUaSetupMonitors);
-}
-long OpcUaSetupMonitors(void)
+/* Read value and access level of the items with the given handles, setup item data type
+ * and converters. Items with a bad link are skipped, their status is set by getNodes(). */
+static long setupItemData(const std::vector<OpcUa_UInt32> &handles)
 {
     UaStatus status;
     UaDataValues values;
     UaDataValues attribs; // OpcUa_Attributes_UserAccessLevel
+    UaDataValues dataTypes; // OpcUa_Attributes_DataType, only read for structure members
     ServiceSettings     serviceSettings;
+    initServiceSettings(serviceSettings);
     UaDiagnosticInfos   diagnosticInfos;
+    std::vector<OpcUa_UInt32> readHandles;      // one item per node
+    std::vector<OpcUa_UInt32> readIndex(handles.size(), 0);
+    std::map<std::string, OpcUa_UInt32> nodes;
+    bool members = false;
 
-    if(pMyClient == NULL)
-        return 1;
-    if(pMyClient->getDebug()) errlogPrintf("OpcUaSetupMonitors Browsepath ok len = %d\n",(int)pMyClient->vUaNodeId.size());
-
-    if(pMyClient->getNodes() )
-        return 1;
-    status = pMyClient->readFunc(values, serviceSettings, diagnosticInfos,OpcUa_Attributes_Value);
+    if(handles.empty())
+        return 0;
+    // items of the same node share the read result
+    for(OpcUa_UInt32 i=0; i<handles.size(); i++) {
+        if (pMyClient->vUaNodeId[handles[i]].isNull())
+            continue;
+        std::string node = std::string(pMyClient->vUaNodeId[handles[i]].toXmlString().toUtf8())
+                         + pMyClient->vUaItemInfo[handles[i]]->indexRange().toUtf8();
+        std::map<std::string, OpcUa_UInt32>::iterator it = nodes.find(node);
+        if(it == nodes.end()) {
+            it = nodes.insert(std::make_pair(node, (OpcUa_UInt32) readHandles.size())).first;
+            readHandles.push_back(handles[i]);
+        }
+        readIndex[i] = it->second;
+        if(pMyClient->vUaItemInfo[handles[i]]->member)
+            members = true;
+    }
+    if(readHandles.empty())
+        return 0;
+    status = pMyClient->readFunc(readHandles, values, serviceSettings, diagnosticInfos,OpcUa_Attributes_Value);
     if (status.isBad()) {
         errlogPrintf("OpcUaSetupMonitors: READ VALUES failed with status %s\n", status.toString().toUtf8());
         return 1;
     }
-    status = pMyClient->readFunc(attribs, serviceSettings, diagnosticInfos, OpcUa_Attributes_UserAccessLevel);
+    status = pMyClient->readFunc(readHandles, attribs, serviceSettings, diagnosticInfos, OpcUa_Attributes_UserAccessLevel);
     if (status.isBad()) {
         errlogPrintf("OpcUaSetupMonitors: READ VALUES failed with status %s\n", status.toString().toUtf8());
         return 1;
     }
-    if(pMyClient->getDebug() > 1) errlogPrintf("OpcUaSetupMonitors READ of %d values returned ok\n", values.length());
+    if(members) {
+        status = pMyClient->readFunc(readHandles, dataTypes, serviceSettings, diagnosticInfos, OpcUa_Attributes_DataType);
+        if (status.isBad()) {
+            errlogPrintf("OpcUaSetupMonitors: READ DATATYPES failed with status %s\n", status.toString().toUtf8());
+            return 1;
+        }
+    }
+    if(pMyClient->getDebug() > 1) errlogPrintf("OpcUaSetupMonitors READ of %d values for %lu items returned ok\n",
+                                               values.length(), (unsigned long) handles.size());
 
-    for(OpcUa_UInt32 i=0; i<values.length(); i++) {
-        OPCUA_ItemINFO* uaItem = pMyClient->vUaItemInfo[i];
+    for(OpcUa_UInt32 n=0; n<handles.size(); n++) {
+        OPCUA_ItemINFO* uaItem = pMyClient->vUaItemInfo[handles[n]];
+        OpcUa_UInt32 i = readIndex[n];
+        UaVariant memberVal;
+        const OpcUa_Variant *pValue = &values[i].Value;
+        if (pMyClient->vUaNodeId[handles[n]].isNull())
+            continue;
+        if (uaItem->member && OpcUa_IsGood(values[i].StatusCode)) {
+            UaNodeId dataTypeId;
+            if (OpcUa_IsBad(dataTypes[i].StatusCode) || OpcUa_IsBad(UaVariant(dataTypes[i].Value).toNodeId(dataTypeId))
+                    || structPlanSetup(uaItem, dataTypeId)) {
+                uaItem->stat = OpcUa_BadDataTypeIdUnknown;
+                continue;
+            }
+            if (uaItem->structPlan->decode(values[i].Value, memberVal)) {
+                uaItem->stat = OpcUa_BadDecodingError;
+                errlogPrintf("%s: can't decode member '%s' of '%s'\n", uaItem->prec->name, uaItem->member, uaItem->ItemPath);
+                continue;
+            }
+            pValue = memberVal;
+        }
         if (OpcUa_IsBad(values[i].StatusCode)) {
             uaItem->stat = values[i].StatusCode;
             errlogPrintf("%s: Read node '%s' failed with status %s\n",uaItem->prec->name, uaItem->ItemPath,
@@ -334,9 +546,11 @@ long OpcUaSetupMonitors(void)
                 errlogPrintf("%s: Read attribs' failed with status %s\n",uaItem->prec->name,
                              UaStatus(attribs[i].StatusCode).toString().toUtf8());
             }
-            else if(! ((int)values[i].Value.ArrayType == uaItem->isArray)) {
+            else if(! ((int)pValue->ArrayType == uaItem->isArray)) {
                 uaItem->stat = OpcUa_BadOutOfRange;
-                if((int)values[i].Value.ArrayType)
+                if(uaItem->rangeCount)
+                    errlogPrintf("%s: an array slice needs an array record, also a single element\n",uaItem->prec->name);
+                else if((int)pValue->ArrayType)
                     errlogPrintf("%s: scalar record try to read array data\n",uaItem->prec->name);
                 else
                     errlogPrintf("%s: array record try to read scalar data\n",uaItem->prec->name);
@@ -347,7 +561,8 @@ long OpcUaSetupMonitors(void)
                 uaItem->stat = OpcUa_Good;
             }
             epicsMutexLock(uaItem->flagLock);
-            uaItem->itemDataType = (int) values[i].Value.Datatype;
+            uaItem->itemDataType = (int) pValue->Datatype;
+            uaItem->bindConverters();
             epicsMutexUnlock(uaItem->flagLock);
 
             if(pMyClient->getDebug() > 1) {
@@ -367,11 +582,87 @@ long OpcUaSetupMonitors(void)
             }
         }
     }
+    return 0;
+}
+
+/* iocShell: Read and setup uaItem Item data type, createMonitoredItems */
+extern "C" {
+epicsRegisterFunction(OpcUaSetupMonitors);
+}
+static long setupMonitors(void);
+long OpcUaSetupMonitors(void)
+{
+    long ret;
+
+    if(pMyClient == NULL)
+        return 1;
+    epicsMutexLock(pMyClient->itemLock);
+    ret = setupMonitors();
+    epicsMutexUnlock(pMyClient->itemLock);
+    return ret;
+}
+
+static long setupMonitors(void)
+{
+    UaStatus status;
+
+    if(pMyClient->getDebug()) errlogPrintf("OpcUaSetupMonitors Browsepath ok len = %d\n",(int)pMyClient->vUaNodeId.size());
+    if(!pMyClient->monitorsActive)
+        pMyClient->reserveItems();
+
+    if(pMyClient->getNodes() )
+        return 1;
+    if(pShmRing)
+        pShmRing->open(pMyClient->vUaItemInfo);
+    if(pCapture)
+        pCapture->open(pMyClient->vUaItemInfo);
+    processPoolSetup(pMyClient->vUaItemInfo.size());
+    if(setupItemData(pMyClient->itemHandles()))
+        return 1;
     status = pMyClient->createMonitoredItems();
     if (status.isBad()) {
         errlogPrintf("OpcUaSetupMonitors: createMonitoredItems() failed with status %s\n", status.toString().toUtf8());
         return 1;
     }
+    pMyClient->monitorsActive = true;
+    pMyClient->updateConnState(pMyClient->itemHandles());
+    pMyClient->startOnDemand();
+    return 0;
+}
+
+/* Setup items added or changed after OpcUaSetupMonitors(): resolve their nodes, read data
+ * type and access level and add them to the subscription. The other monitored items of
+ * the subscription are not touched. */
+static long setupItems(const std::vector<OpcUa_UInt32> &handles);
+long OpcUaSetupItems(const std::vector<OpcUa_UInt32> &handles)
+{
+    long ret;
+
+    if(pMyClient == NULL)
+        return 1;
+    epicsMutexLock(pMyClient->itemLock);
+    ret = setupItems(handles);
+    epicsMutexUnlock(pMyClient->itemLock);
+    return ret;
+}
+
+static long setupItems(const std::vector<OpcUa_UInt32> &handles)
+{
+    UaStatus status;
+
+    if(pMyClient->resolveNodes(handles))
+        return 1;
+    if(setupItemData(handles)) {
+        pMyClient->updateConnState(handles);
+        return 1;
+    }
+    status = pMyClient->createMonitoredItems(handles);
+    pMyClient->updateConnState(handles);
+    if (status.isBad()) {
+        errlogPrintf("OpcUaSetupItems: createMonitoredItems() failed with status %s\n", status.toString().toUtf8());
+        return 1;
+    }
+    pMyClient->startOnDemand();     // items added or retargeted later may be the first on demand
     return 0;
 }
 
@@ -398,24 +689,147 @@ long opcUa_close(int verbose)
 /* iocShell/Client: Setup an opcUa Item for the driver*/
 int addOPCUA_Item(OPCUA_ItemINFO *h)
 {
+    int ret = 0;
+
     if(pMyClient == NULL)
         return 1;
-    pMyClient->addOPCUA_Item(h);
-    return 0;
+    epicsMutexLock(pMyClient->itemLock);
+    if(pMyClient->addOPCUA_Item(h))
+        ret = 1;
+    else if(pMyClient->monitorsActive && pMyClient->isConnected())    // added at runtime
+        ret = setupItems(std::vector<OpcUa_UInt32>(1, h->itemIdx));
+    epicsMutexUnlock(pMyClient->itemLock);
+    return ret;
+}
+
+/* iocShell/Client: Stop monitoring an item, see DevUaClient::removeOPCUA_Item() */
+int removeOPCUA_Item(OPCUA_ItemINFO *h)
+{
+    int ret;
+
+    if(pMyClient == NULL)
+        return 1;
+    epicsMutexLock(pMyClient->itemLock);
+    ret = pMyClient->removeOPCUA_Item(h);
+    epicsMutexUnlock(pMyClient->itemLock);
+    return ret;
+}
+
+/* iocShell: Point a record to another OPC UA node without resubscribing the other items.
+ * An empty link removes the item of the record, a new link adds it again. */
+static long retarget(const char *recName, const char *link);
+long OpcUaRetarget(const char *recName, const char *link)
+{
+    long ret;
+
+    if(pMyClient == NULL || recName == NULL)
+        return 1;
+    epicsMutexLock(pMyClient->itemLock);
+    ret = retarget(recName, link);
+    epicsMutexUnlock(pMyClient->itemLock);
+    return ret;
+}
+
+static long retarget(const char *recName, const char *link)
+{
+    bool removed;
+    OPCUA_ItemINFO *uaItem = pMyClient->findItem(recName, &removed);
+
+    if(!uaItem) {
+        errlogPrintf("OpcUaRetarget: no OPCUA record '%s'\n", recName);
+        return 1;
+    }
+    if(link == NULL || *link == 0) {
+        if(!removed && pMyClient->removeOPCUA_Item(uaItem))
+            return 1;
+        uaItem->ItemPath[0] = 0;
+        structSplitLink(uaItem);
+        uaItem->stat = OpcUa_BadNodeIdUnknown;
+        uaItem->connState = connNone;
+        return 0;
+    }
+    if(!removed) {
+        if(uaItem->subscription && pMyClient->isConnected())
+            uaItem->subscription->deleteMonitoredItems(std::vector<OpcUa_UInt32>(1, uaItem->itemIdx));
+        uaItem->subscription = NULL;
+        uaItem->monitoredItemId = 0;
+        pMyClient->releaseWrites(std::vector<OpcUa_UInt32>(1, uaItem->itemIdx));
+        pMyClient->vUaNodeId[uaItem->itemIdx] = UaNodeId();
+    }
+    strncpy(uaItem->ItemPath, link, ITEMPATHLEN-1);
+    uaItem->ItemPath[ITEMPATHLEN-1] = 0;
+    structSplitLink(uaItem);
+    splitIndexRange(uaItem);
+    if(uaItem->bitWord)
+        bitWordAttach(uaItem);
+    uaItem->stat = OpcUa_BadWaitingForInitialData;
+    if(removed)                     // new handle, set up if connected
+        return addOPCUA_Item(uaItem);
+    if(!pMyClient->isConnected())   // done by OpcUaSetupMonitors() at reconnect
+        return 0;
+    return setupItems(std::vector<OpcUa_UInt32>(1, uaItem->itemIdx));
+}
+
+// Transport limits of the OPC UA stack, 0 = stack default
+static int drvOpcua_MaxMessageSize = 0;     // bytes
+static int drvOpcua_MaxChunkCount = 0;
+static int drvOpcua_ChunkSize = 0;          // bytes
+static int drvOpcua_MaxArrayLength = 0;     // elements
+static int drvOpcua_MaxStringLength = 0;    // bytes
+
+extern "C" {
+    epicsExportAddress(int, drvOpcua_MaxMessageSize);
+    epicsExportAddress(int, drvOpcua_MaxChunkCount);
+    epicsExportAddress(int, drvOpcua_ChunkSize);
+    epicsExportAddress(int, drvOpcua_MaxArrayLength);
+    epicsExportAddress(int, drvOpcua_MaxStringLength);
+}
+
+// Apply the transport limits to the stack. Call after UaPlatformLayer::init().
+static void configureTransport(int debug)
+{
+    OpcUa_ProxyStubConfiguration config = OpcUa_ProxyStub_g_Configuration;
+
+    if(!drvOpcua_MaxMessageSize && !drvOpcua_MaxChunkCount && !drvOpcua_ChunkSize
+            && !drvOpcua_MaxArrayLength && !drvOpcua_MaxStringLength)
+        return;
+    if(drvOpcua_MaxMessageSize > 0) {
+        config.iSerializer_MaxMessageSize     = drvOpcua_MaxMessageSize;
+        config.iTcpTransport_MaxMessageLength = drvOpcua_MaxMessageSize;
+    }
+    if(drvOpcua_MaxChunkCount > 0)
+        config.iTcpTransport_MaxChunkCount = drvOpcua_MaxChunkCount;
+    if(drvOpcua_ChunkSize > 0)
+        config.iTcpConnection_DefaultChunkSize = drvOpcua_ChunkSize;
+    if(drvOpcua_MaxArrayLength > 0)
+        config.iSerializer_MaxArrayLength = drvOpcua_MaxArrayLength;
+    if(drvOpcua_MaxStringLength > 0) {
+        config.iSerializer_MaxStringLength     = drvOpcua_MaxStringLength;
+        config.iSerializer_MaxByteStringLength = drvOpcua_MaxStringLength;
+    }
+    if(OpcUa_IsBad(OpcUa_ProxyStub_ReInitialize(&config)))
+        errlogPrintf("drvOpcuaSetup: Failed to apply transport settings\n");
+    config = OpcUa_ProxyStub_g_Configuration;
+    if(debug)
+        errlogPrintf("drvOpcuaSetup: max. message size %d, chunk size %d, max. chunks %d, max. array length %d, max. string length %d\n",
+                     config.iSerializer_MaxMessageSize, config.iTcpConnection_DefaultChunkSize, config.iTcpTransport_MaxChunkCount,
+                     config.iSerializer_MaxArrayLength, config.iSerializer_MaxStringLength);
 }
 
 /* iocShell/Client: Setup server url and certificates, connect and subscribe */
-long opcUa_init(UaString &g_serverUrl, UaString &g_applicationCertificate, UaString &g_applicationPrivateKey, UaString &nodeName, int autoConn,int debug=0)
+long opcUa_init(UaString &g_serverUrl, UaString &g_applicationCertificate, UaString &g_applicationPrivateKey, UaString &g_certificateStorePath, UaString &nodeName, int autoConn,int debug=0)
 {
     UaStatus status;
     // Initialize the UA Stack platform layer
     UaPlatformLayer::init();
+    configureTransport(debug);
 
     // Create instance of DevUaClient
     pMyClient = new DevUaClient(autoConn,debug);
 
     pMyClient->applicationCertificate = g_applicationCertificate;
     pMyClient->applicationPrivateKey  = g_applicationPrivateKey;
+    pMyClient->certificateStorePath   = g_certificateStorePath;
     pMyClient->hostName = nodeName;
     pMyClient->url = g_serverUrl;
     pMyClient->setDebug(debug);
@@ -497,7 +911,7 @@ void drvOpcuaSetup (const iocshArgBuf *args )
         }
     }
 
-    opcUa_init(g_serverUrl,g_applicationCertificate,g_applicationPrivateKey,g_defaultHostname,1,verbose);
+    opcUa_init(g_serverUrl,g_applicationCertificate,g_applicationPrivateKey,g_certificateStorePath,g_defaultHostname,1,verbose);
 }
 extern "C" {
 epicsRegisterFunction(drvOpcuaSetup);
@@ -525,12 +939,134 @@ void opcuaStat (const iocshArgBuf *args )
 {
     if(pMyClient!= NULL)
         pMyClient->itemStat(args[0].ival);
+    if(pShmRing != NULL)
+        pShmRing->report(args[0].ival);
+    if(pCapture != NULL)
+        pCapture->report(args[0].ival);
+    latencyReport(args[0].ival);
+    uaThreadSchedReport(args[0].ival);
+    bitWordReport(args[0].ival);
     return;
 }
 extern "C" {
 epicsRegisterFunction(opcuaStat);
 }
 
+static const iocshArg opcuaShmSetupArg0 = {"[FILE] ring file, e.g. /dev/shm/opcua", iocshArgString};
+static const iocshArg opcuaShmSetupArg1 = {"Number of slots", iocshArgInt};
+static const iocshArg opcuaShmSetupArg2 = {"Max. value bytes per slot", iocshArgInt};
+static const iocshArg opcuaShmSetupArg3 = {"All items (1) or info(opcua:SHM) only (0)", iocshArgInt};
+static const iocshArg *const opcuaShmSetupArg[4] = {&opcuaShmSetupArg0,&opcuaShmSetupArg1,&opcuaShmSetupArg2,&opcuaShmSetupArg3};
+iocshFuncDef opcuaShmSetupFuncDef = {"opcuaShmSetup", 4, opcuaShmSetupArg};
+void opcuaShmSetup (const iocshArgBuf *args )
+{
+    int nSlots  = args[1].ival;
+    int maxData = args[2].ival;
+
+    if(args[0].sval == NULL || strlen(args[0].sval) == 0) {
+        errlogPrintf("opcuaShmSetup: ABORT Missing Argument \"file\".\n");
+        return;
+    }
+    if(pShmRing != NULL) {
+        errlogPrintf("opcuaShmSetup: Ignore, shared memory ring already configured\n");
+        return;
+    }
+    if(nSlots <= 0)  nSlots  = 4096;
+    if(maxData <= 0) maxData = 64;
+    pShmRing = new DevUaShmRing(args[0].sval, nSlots, maxData, args[3].ival);
+}
+extern "C" {
+epicsRegisterFunction(opcuaShmSetup);
+}
+
+static const iocshArg opcuaRetargetArg0 = {"record name", iocshArgString};
+static const iocshArg opcuaRetargetArg1 = {"new link, empty to stop monitoring", iocshArgString};
+static const iocshArg *const opcuaRetargetArg[2] = {&opcuaRetargetArg0,&opcuaRetargetArg1};
+iocshFuncDef opcuaRetargetFuncDef = {"opcuaRetarget", 2, opcuaRetargetArg};
+void opcuaRetarget (const iocshArgBuf *args )
+{
+    if(args[0].sval == NULL || strlen(args[0].sval) == 0) {
+        errlogPrintf("opcuaRetarget: ABORT Missing Argument \"record name\".\n");
+        return;
+    }
+    if(pMyClient == NULL) {
+        errlogPrintf("Ignore: OpcUa not initialized\n");
+        return;
+    }
+    OpcUaRetarget(args[0].sval, args[1].sval);
+}
+extern "C" {
+epicsRegisterFunction(opcuaRetarget);
+}
+
+static const iocshArg opcuaCaptureArg0 = {"[FILE] capture file, empty to stop", iocshArgString};
+static const iocshArg opcuaCaptureArg1 = {"Max. value bytes", iocshArgInt};
+static const iocshArg *const opcuaCaptureArg[2] = {&opcuaCaptureArg0,&opcuaCaptureArg1};
+iocshFuncDef opcuaCaptureFuncDef = {"opcuaCapture", 2, opcuaCaptureArg};
+void opcuaCapture (const iocshArgBuf *args )
+{
+    int maxData = args[1].ival;
+
+    if(pCapture != NULL)
+        pCapture->close();
+    if(args[0].sval == NULL || strlen(args[0].sval) == 0)
+        return;
+    if(maxData <= 0) maxData = 65536;
+    if(pCapture == NULL)
+        pCapture = new DevUaCapture(args[0].sval, maxData);
+    else
+        pCapture->setFileName(args[0].sval);
+    if(pMyClient != NULL && pMyClient->monitorsActive)    // after iocInit, else opened by OpcUaSetupMonitors
+        pCapture->open(pMyClient->vUaItemInfo);
+}
+extern "C" {
+epicsRegisterFunction(opcuaCapture);
+}
+
+static const iocshArg opcuaReplayArg0 = {"[FILE] capture file", iocshArgString};
+static const iocshArg opcuaReplayArg1 = {"Speed factor, 0 = as fast as possible", iocshArgDouble};
+static const iocshArg *const opcuaReplayArg[2] = {&opcuaReplayArg0,&opcuaReplayArg1};
+iocshFuncDef opcuaReplayFuncDef = {"opcuaReplay", 2, opcuaReplayArg};
+void opcuaReplay (const iocshArgBuf *args )
+{
+    if(args[0].sval == NULL || strlen(args[0].sval) == 0) {
+        errlogPrintf("opcuaReplay: ABORT Missing Argument \"file\".\n");
+        return;
+    }
+    if(pMyClient == NULL) {
+        errlogPrintf("Ignore: OpcUa not initialized\n");
+        return;
+    }
+    opcUaReplay(args[0].sval, args[1].dval);
+}
+extern "C" {
+epicsRegisterFunction(opcuaReplay);
+}
+
+static const iocshArg opcuaTraceDumpArg0 = {"Number of entries, 0 = all", iocshArgInt};
+static const iocshArg *const opcuaTraceDumpArg[1] = {&opcuaTraceDumpArg0};
+iocshFuncDef opcuaTraceDumpFuncDef = {"opcuaTraceDump", 1, opcuaTraceDumpArg};
+void opcuaTraceDump (const iocshArgBuf *args )
+{
+    uaTraceDump(args[0].ival);
+}
+extern "C" {
+epicsRegisterFunction(opcuaTraceDump);
+}
+
+static const iocshArg opcuaThreadSchedArg0 = {"Thread class: publish, timer, worker, replay", iocshArgString};
+static const iocshArg opcuaThreadSchedArg1 = {"SCHED_FIFO priority, 0 = unchanged", iocshArgInt};
+static const iocshArg opcuaThreadSchedArg2 = {"CPU list e.g. 2,4-7, empty = unchanged", iocshArgString};
+static const iocshArg *const opcuaThreadSchedArg[3] = {&opcuaThreadSchedArg0,&opcuaThreadSchedArg1,&opcuaThreadSchedArg2};
+iocshFuncDef opcuaThreadSchedFuncDef = {"opcuaThreadSched", 3, opcuaThreadSchedArg};
+void opcuaThreadSched (const iocshArgBuf *args )
+{
+    uaThreadSchedSet(args[0].sval, args[1].ival, args[2].sval);
+}
+extern "C" {
+epicsRegisterFunction(opcuaThreadSched);
+}
+
 //create a static object to make shure that opcRegisterToIocShell is called on beginning of
 class OpcRegisterToIocShell
 {
@@ -543,6 +1079,12 @@ OpcRegisterToIocShell::OpcRegisterToIocShell(void)
     iocshRegister(&drvOpcuaSetupFuncDef, drvOpcuaSetup);
     iocshRegister(&opcuaDebugFuncDef, opcuaDebug);
     iocshRegister(&opcuaStatFuncDef, opcuaStat);
+    iocshRegister(&opcuaShmSetupFuncDef, opcuaShmSetup);
+    iocshRegister(&opcuaRetargetFuncDef, opcuaRetarget);
+    iocshRegister(&opcuaTraceDumpFuncDef, opcuaTraceDump);
+    iocshRegister(&opcuaCaptureFuncDef, opcuaCapture);
+    iocshRegister(&opcuaReplayFuncDef, opcuaReplay);
+    iocshRegister(&opcuaThreadSchedFuncDef, opcuaThreadSched);
       //
 }
 static OpcRegisterToIocShell opcRegisterToIocShell;
@@ -33,14 +33,35 @@
 #include <uasession.h>
 
 class OPCUA_ItemINFO;
+class DevUaBitWord;
+class DevUaStructPlan;
+class DevUaAggregate;
+class DevUaOutQueue;
 #include "devUaClient.h"
 #include "devUaSubscription.h"
+#include "devUaConvert.h"
+#include "devUaLatency.h"
+#include "devUaTrace.h"
 
 #define ITEMPATHLEN 128
+
+// Connection state of an item
+typedef enum {
+    connNone = 0,       // not set up: before iocInit, server disconnected or no link
+    connMonitored,      // monitored item created
+    connFailed,         // node not found or not monitored, retried by the client
+    connInvalid         // link can't be parsed, not retried until retargeted
+} OpcUaConnState;
+extern const char *connStateStrings(int state);
+
 class OPCUA_ItemINFO {
 public:
 //    int NdIdx;              // Namspace index
     char ItemPath[ITEMPATHLEN];
+    char *member;           // member path in a structure node, from a link "node|member", NULL if none
+    DevUaStructPlan *structPlan;    // decodes the member, guarded by flagLock
+    int rangeFirst;         // array slice from a link "node[first:last]"
+    int rangeCount;         // elements of the slice, 0 for the whole value
 
     int itemDataType;       // OPCUA Datatype
     int itemIdx;            // Index of this item in UaNodeId vector
@@ -62,6 +83,51 @@ public:
     double samplingInterval;
     epicsUInt32 queueSize;
     unsigned char discardOldest;
+    // as revised by the server in createMonitoredItems
+    double revisedSamplingInterval;
+    epicsUInt32 revisedQueueSize;
+    OpcUa_UInt32 monitoredItemId;
+    DevUaSubscription *subscription;    // the item is monitored on, NULL if not monitored
+    OPCUA_ItemINFO *sharedPrimary;      // owner of the monitored item this item shares, NULL if own
+    OPCUA_ItemINFO *sharedNext;         // next item getting the notifications of the same monitored item
+    char *triggeredBy;      // record of the trigger item from info(opcua:TRIGGEREDBY), NULL if none
+    int onDemand;           // monitor only while the record has monitors, from info(opcua:ONDEMAND)
+    int monitoringMode;     // OpcUa_MonitoringMode of the monitored item
+    epicsUInt32 idleScans;  // interest scans without monitors on the records of the monitored item
+    int readInterest;       // record processed since the last interest scan (atomic)
+    int connState;          // OpcUaConnState
+    epicsUInt32 nRetries;   // failed attempts to set up the item since the last success
+
+    UaReadConverter readConv;   // compiled converters bound to itemDataType by bindConverters()
+    UaWriteConverter writeConv;
+    int convType;               // OPC UA type the converters are bound to
+
+    int directDecode;       // decode notifications into the fixed slots below instead of varVal
+    OpcUa_Variant directVal;// direct decode: numeric scalar, never holds heap data
+    char strVal[MAX_STRING_SIZE]; // direct decode: string value
+    void *arrBuf;           // direct decode: NELM elements of recDataType, allocated at init
+    epicsUInt32 arrLen;     // direct decode: number of elements in arrBuf
+    epicsUInt32 arrElemSize;    // direct decode: bytes per element of arrBuf
+    UaArrayConverter arrayConv;
+    int arrayConvType;      // OPC UA type arrayConv is bound to
+
+    int writePrio;          // write scheduler class 0..2 (LOW..HIGH), from PRIO or info(opcua:WPRIO)
+    DevUaOutQueue *outQueue;    // OUT records: writes queued without PACT, from info(opcua:WQUEUE), NULL if none
+    UaWriteValues *writeTemplate;   // OUT records: prebuilt write request, guarded by flagLock
+    int writeTemplateElems; // elements the index range of writeTemplate is built for
+    int nodeRegistered;     // the node of writeTemplate is registered by RegisterNodes
+    OpcUa_Variant echoVal;  // OUT records: value of the last write sent, guarded by flagLock
+    int echoArmed;          // the next data change may be the echo of echoVal, no readback then
+    int bit;                // bi/bo: bit number in the word node from info(opcua:BIT), -1 for the whole value
+    DevUaBitWord *bitWord;  // bo with bit: merges the bit writes to the word
+
+    DevUaAggregate *aggregate;  // aggregate instead of samples, from info(opcua:AGGREGATE), NULL if none
+
+    int shmPublish;         // append data changes to the shared memory ring, set by info(opcua:SHM)
+    int procQueued;         // queued on a worker of the process pool, guarded by the worker lock
+
+    DevUaLatency *latency;  // latency histograms of the record type
+    uint64_t rcvTicks;      // time of the last data change not yet processed, 0 if none
 
     int debug;              // debug level of this item, defined in field REC:TPRO
     OpcUa_StatusCode stat;  // status of the last operation on the item 0=OpcGood, OpcUa_StatusCode or 1 for any internal error
@@ -76,22 +142,34 @@ public:
     dbCommon *prec;
     int  maxDebug(int recDbg);
     int checkDataLoss();
+    void bindConverters();
+    long decodeValue(const OpcUa_Variant &val);
+    bool sameDecode(const OPCUA_ItemINFO *other) const;
+    void copyDecoded(const OPCUA_ItemINFO &from);
+    UaString valueToString();
+    UaVariant directValue() const;
+    UaString indexRange(int n = 0) const;
     long write(UaVariant &tempValue);
 };
 extern DevUaClient* pMyClient;
 typedef enum {BOTH=0,NODEID,BROWSEPATH,BROWSEPATH_CONCAT,GETNODEMODEMAX} GetNodeMode;
 const  char *variantTypeStrings(int type);
 extern char *getTime(char *buf);
+extern void initServiceSettings(UaClientSdk::ServiceSettings &settings);
 extern long opcUa_close(int verbose);
 extern long OpcUaSetupMonitors(void);
+extern long OpcUaSetupItems(const std::vector<OpcUa_UInt32> &handles);
 extern int  addOPCUA_Item(OPCUA_ItemINFO *h);
+extern int  removeOPCUA_Item(OPCUA_ItemINFO *h);
+extern long OpcUaRetarget(const char *recName, const char *link);
+extern void splitIndexRange(OPCUA_ItemINFO *uaItem);
 // iocShell:
 //extern long OpcUaWriteItems(OPCUA_ItemINFO* uaItem);
 
 // client:
 extern long OpcReadValues(int verbose,int monitored);
 extern long OpcWriteValue(int opcUaItemIndex,double val,int verbose);
-extern long opcUa_init(UaString &g_serverUrl, UaString &g_applicationCertificate, UaString &g_applicationPrivateKey, UaString &nodeName, int autoConn, int debug);
+extern long opcUa_init(UaString &g_serverUrl, UaString &g_applicationCertificate, UaString &g_applicationPrivateKey, UaString &g_certificateStorePath, UaString &nodeName, int autoConn, int debug);
 extern "C" {
 extern long opcUa_io_report (int); /* Write IO report output to stdout. */
 }
@@ -0,0 +1,478 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+/* Browse a server subtree and create an EPICS database with DTYP="OPCUA" records
+ * for all variables found:
+ *
+ *   opcUaBrowseDb -u opc.tcp://plc:4840 -r 3,DataBlocksGlobal -p PLC1: -o plc1.db
+ *
+ * The tree is browsed level by level. The nodes of a level are split into
+ * batches of Browse requests (BrowseNext for continuation points), the batches
+ * are run by a bounded number of threads on the same session. DataType,
+ * ValueRank, ArrayDimensions and UserAccessLevel of all variables are read
+ * the same way.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include <epicsThread.h>
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+
+#include "drvOpcUa.h"
+#include "devUaClient.h"
+
+using namespace UaClientSdk;
+
+struct BrowseNode {
+    UaNodeId id;
+    std::string path;       // record name part, browse names joined by ':'
+};
+
+struct VarNode {
+    UaNodeId id;
+    std::string path;
+    int dataType;           // OpcUa_BuiltInType, 0 if not a built-in type
+    int valueRank;
+    epicsUInt32 nelm;
+    epicsUInt32 access;     // UserAccessLevel
+};
+
+static UaSession *pSession;
+static int batchSize = 500;
+static int nThreads = 4;
+static int verbose = 0;
+
+/* Run nJobs calls of func(ctx, job) on at most nThreads threads */
+struct ParallelRun {
+    void (*func)(void *ctx, size_t job);
+    void *ctx;
+    size_t next;
+    size_t nJobs;
+    epicsMutexId lock;
+};
+
+static void parallelWorker(void *arg)
+{
+    std::pair<ParallelRun *, epicsEventId> *p = (std::pair<ParallelRun *, epicsEventId> *) arg;
+    ParallelRun *run = p->first;
+    for (;;) {
+        epicsMutexLock(run->lock);
+        size_t job = run->next++;
+        epicsMutexUnlock(run->lock);
+        if (job >= run->nJobs)
+            break;
+        run->func(run->ctx, job);
+    }
+    epicsEventSignal(p->second);
+}
+
+static void runParallel(size_t nJobs, void (*func)(void *ctx, size_t job), void *ctx)
+{
+    ParallelRun run;
+    size_t n = (nJobs < (size_t) nThreads) ? nJobs : (size_t) nThreads;
+    std::vector<std::pair<ParallelRun *, epicsEventId> > workers(n);
+
+    run.func  = func;
+    run.ctx   = ctx;
+    run.next  = 0;
+    run.nJobs = nJobs;
+    run.lock  = epicsMutexMustCreate();
+    for (size_t i = 0; i < n; i++) {
+        workers[i].first  = &run;
+        workers[i].second = epicsEventMustCreate(epicsEventEmpty);
+        epicsThreadMustCreate("opcUaBrowse", epicsThreadPriorityMedium,
+                              epicsThreadGetStackSize(epicsThreadStackMedium), parallelWorker, &workers[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        epicsEventMustWait(workers[i].second);
+        epicsEventDestroy(workers[i].second);
+    }
+    epicsMutexDestroy(run.lock);
+}
+
+/* Browse: one job browses one batch of the current level */
+struct BrowseLevel {
+    const std::vector<BrowseNode> *nodes;
+    std::vector<std::vector<BrowseNode> > objects;  // per job: children to browse next
+    std::vector<std::vector<BrowseNode> > vars;     // per job: variables found
+};
+
+static std::string recordPart(const UaString &browseName)
+{
+    std::string s(browseName.toUtf8());
+    for (size_t i = 0; i < s.size(); i++) {
+        char c = s[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-'))
+            s[i] = '_';
+    }
+    return s;
+}
+
+static void addReferences(BrowseLevel *level, size_t job, const BrowseNode &parent,
+                          const OpcUa_ReferenceDescription *refs, OpcUa_Int32 nRefs)
+{
+    for (OpcUa_Int32 r = 0; r < nRefs; r++) {
+        BrowseNode child;
+        child.id   = UaExpandedNodeId(refs[r].NodeId).nodeId();
+        child.path = parent.path.empty() ? recordPart(UaQualifiedName(refs[r].BrowseName).name())
+                   : parent.path + ":" + recordPart(UaQualifiedName(refs[r].BrowseName).name());
+        if (refs[r].NodeClass == OpcUa_NodeClass_Variable)
+            level->vars[job].push_back(child);
+        else
+            level->objects[job].push_back(child);
+    }
+}
+
+static void browseBatch(void *ctx, size_t job)
+{
+    BrowseLevel *level = (BrowseLevel *) ctx;
+    const std::vector<BrowseNode> &nodes = *level->nodes;
+    size_t first = job * batchSize;
+    size_t n = (nodes.size() - first < (size_t) batchSize) ? nodes.size() - first : batchSize;
+    ServiceSettings serviceSettings;
+    UaBrowseDescriptions desc;
+    UaBrowseResults results;
+    UaDiagnosticInfos diag;
+
+    desc.create(n);
+    for (size_t i = 0; i < n; i++) {
+        nodes[first + i].id.copyTo(&desc[i].NodeId);
+        desc[i].BrowseDirection = OpcUa_BrowseDirection_Forward;
+        UaNodeId(OpcUaId_HierarchicalReferences).copyTo(&desc[i].ReferenceTypeId);
+        desc[i].IncludeSubtypes = OpcUa_True;
+        desc[i].NodeClassMask   = OpcUa_NodeClass_Object | OpcUa_NodeClass_Variable;
+        desc[i].ResultMask      = OpcUa_BrowseResultMask_All;
+    }
+    UaStatus status = pSession->browseList(serviceSettings, desc, results, diag);
+    if (status.isBad()) {
+        fprintf(stderr, "Browse failed: %s\n", status.toString().toUtf8());
+        return;
+    }
+    for (size_t i = 0; i < results.length() && i < n; i++) {
+        const BrowseNode &parent = nodes[first + i];
+        if (OpcUa_IsBad(results[i].StatusCode)) {
+            if (verbose)
+                fprintf(stderr, "Browse %s: %s\n", parent.id.toString().toUtf8(),
+                        UaStatus(results[i].StatusCode).toString().toUtf8());
+            continue;
+        }
+        addReferences(level, job, parent, results[i].References, results[i].NoOfReferences);
+
+        UaByteString cp(results[i].ContinuationPoint);
+        while (cp.length() > 0) {
+            UaByteStringArray cps;
+            UaBrowseResults next;
+            cps.create(1);
+            cp.copyTo(&cps[0]);
+            status = pSession->browseListNext(serviceSettings, OpcUa_False, cps, next, diag);
+            if (status.isBad() || next.length() < 1 || OpcUa_IsBad(next[0].StatusCode))
+                break;
+            addReferences(level, job, parent, next[0].References, next[0].NoOfReferences);
+            cp = UaByteString(next[0].ContinuationPoint);
+        }
+    }
+}
+
+/* Read the attributes of one batch of variables */
+#define NATTRIBS 4
+static const OpcUa_UInt32 varAttribs[NATTRIBS] = {
+    OpcUa_Attributes_DataType, OpcUa_Attributes_ValueRank,
+    OpcUa_Attributes_ArrayDimensions, OpcUa_Attributes_UserAccessLevel
+};
+
+static void readBatch(void *ctx, size_t job)
+{
+    std::vector<VarNode> &vars = *(std::vector<VarNode> *) ctx;
+    size_t first = job * batchSize;
+    size_t n = (vars.size() - first < (size_t) batchSize) ? vars.size() - first : batchSize;
+    ServiceSettings serviceSettings;
+    UaReadValueIds ids;
+    UaDataValues values;
+    UaDiagnosticInfos diag;
+
+    ids.create(n * NATTRIBS);
+    for (size_t i = 0; i < n; i++) {
+        for (int a = 0; a < NATTRIBS; a++) {
+            vars[first + i].id.copyTo(&ids[i * NATTRIBS + a].NodeId);
+            ids[i * NATTRIBS + a].AttributeId = varAttribs[a];
+        }
+    }
+    UaStatus status = pSession->read(serviceSettings, 0, OpcUa_TimestampsToReturn_Neither, ids, values, diag);
+    if (status.isBad() || values.length() != n * NATTRIBS) {
+        fprintf(stderr, "Read attributes failed: %s\n", status.toString().toUtf8());
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        VarNode &var = vars[first + i];
+        const OpcUa_DataValue *v = &values[i * NATTRIBS];
+        UaNodeId dataType;
+
+        if (OpcUa_IsGood(v[0].StatusCode)) {
+            UaVariant(v[0].Value).toNodeId(dataType);
+            if (dataType.namespaceIndex() == 0 && dataType.identifierType() == OpcUa_IdentifierType_Numeric
+                    && dataType.identifierNumeric() <= OpcUaType_String)
+                var.dataType = dataType.identifierNumeric();
+        }
+        if (OpcUa_IsGood(v[1].StatusCode))
+            UaVariant(v[1].Value).toInt32(var.valueRank);
+        if (OpcUa_IsGood(v[2].StatusCode)) {
+            UaUInt32Array dims;
+            UaVariant(v[2].Value).toUInt32Array(dims);
+            if (dims.length() > 0 && dims[0] > 0)
+                var.nelm = dims[0];
+        }
+        if (OpcUa_IsGood(v[3].StatusCode))
+            UaVariant(v[3].Value).toUInt32(var.access);
+    }
+}
+
+/* NodeId in link syntax "ns,identifier". Empty for Guid and Opaque identifiers */
+static std::string linkOf(const UaNodeId &id)
+{
+    char buf[32];
+    sprintf(buf, "%u,", id.namespaceIndex());
+    if (id.identifierType() == OpcUa_IdentifierType_Numeric) {
+        sprintf(buf + strlen(buf), "%u", id.identifierNumeric());
+        return buf;
+    }
+    if (id.identifierType() == OpcUa_IdentifierType_String)
+        return std::string(buf) + UaString(&id.internHandle()->Identifier.String).toUtf8();
+    return "";
+}
+
+static const char *ftvlOf(int dataType)
+{
+    switch (dataType) {
+    case OpcUaType_Boolean:
+    case OpcUaType_Byte:   return "UCHAR";
+    case OpcUaType_SByte:  return "CHAR";
+    case OpcUaType_Int16:  return "SHORT";
+    case OpcUaType_UInt16: return "USHORT";
+    case OpcUaType_Int32:  return "LONG";
+    case OpcUaType_UInt32: return "ULONG";
+    case OpcUaType_Float:  return "FLOAT";
+    case OpcUaType_Int64:
+    case OpcUaType_UInt64:
+    case OpcUaType_Double: return "DOUBLE";
+    default:               return NULL;
+    }
+}
+
+// Record type for a scalar of dataType. Types that don't fit into a long go to ai/ao
+static const char *recordTypeOf(int dataType, bool output)
+{
+    switch (dataType) {
+    case OpcUaType_Boolean: return output ? "bo" : "bi";
+    case OpcUaType_SByte:
+    case OpcUaType_Byte:
+    case OpcUaType_Int16:
+    case OpcUaType_UInt16:
+    case OpcUaType_Int32:   return output ? "longout" : "longin";
+    case OpcUaType_UInt32:
+    case OpcUaType_Int64:
+    case OpcUaType_UInt64:
+    case OpcUaType_Float:
+    case OpcUaType_Double:  return output ? "ao" : "ai";
+    case OpcUaType_String:  return output ? "stringout" : "stringin";
+    default:                return NULL;
+    }
+}
+
+static void writeRecords(FILE *fp, const std::vector<VarNode> &vars, const char *prefix,
+                         epicsUInt32 defaultNelm, bool substitutions, int *nRecords)
+{
+    std::map<std::string, std::vector<const VarNode *> > byType;
+
+    for (size_t i = 0; i < vars.size(); i++) {
+        const VarNode &var = vars[i];
+        std::string link = linkOf(var.id);
+        bool output = (var.access & 0x2) != 0;
+        bool array  = var.valueRank >= 0;   // 0: OneOrMoreDimensions, >0: dimensions
+        const char *rtyp = array ? (ftvlOf(var.dataType) ? "waveform" : NULL) : recordTypeOf(var.dataType, output);
+        std::string name = std::string(prefix) + var.path;
+
+        if (link.empty() || !rtyp || !(var.access & 0x1)) {
+            fprintf(fp, "# skipped %s (%s): %s\n", var.path.c_str(), var.id.toString().toUtf8(),
+                    link.empty() ? "unsupported NodeId type" : (!rtyp ? "unsupported data type" : "no read access"));
+            continue;
+        }
+        if (name.size() > PVNAME_STRINGSZ - 1)
+            fprintf(fp, "# record name too long, truncated: %s\n", name.c_str());
+        if (substitutions) {
+            byType[rtyp].push_back(&var);
+            continue;
+        }
+        fprintf(fp, "record(%s, \"%s\") {\n", rtyp, name.substr(0, PVNAME_STRINGSZ - 1).c_str());
+        fprintf(fp, "    field(DTYP, \"OPCUA\")\n");
+        if (output && !array) {
+            fprintf(fp, "    field(OUT,  \"@%s\")\n", link.c_str());
+        }
+        else {
+            fprintf(fp, "    field(INP,  \"@%s\")\n", link.c_str());
+            fprintf(fp, "    field(SCAN, \"I/O Intr\")\n");
+        }
+        if (array) {
+            fprintf(fp, "    field(FTVL, \"%s\")\n", ftvlOf(var.dataType));
+            fprintf(fp, "    field(NELM, \"%u\")\n", var.nelm ? var.nelm : defaultNelm);
+        }
+        fprintf(fp, "}\n\n");
+        (*nRecords)++;
+    }
+
+    // substitutions: one template per record type, e.g. opcua_ai.template with macros NAME, LINK, FTVL, NELM
+    std::map<std::string, std::vector<const VarNode *> >::iterator it;
+    for (it = byType.begin(); it != byType.end(); it++) {
+        fprintf(fp, "file \"opcua_%s.template\" {\n    pattern { NAME, LINK, FTVL, NELM }\n", it->first.c_str());
+        for (size_t i = 0; i < it->second.size(); i++) {
+            const VarNode &var = *it->second[i];
+            const char *ftvl = ftvlOf(var.dataType);
+            fprintf(fp, "    { \"%s\", \"@%s\", \"%s\", \"%u\" }\n",
+                    (std::string(prefix) + var.path).substr(0, PVNAME_STRINGSZ - 1).c_str(), linkOf(var.id).c_str(),
+                    ftvl ? ftvl : "", var.valueRank >= 0 ? (var.nelm ? var.nelm : defaultNelm) : 1);
+            (*nRecords)++;
+        }
+        fprintf(fp, "}\n\n");
+    }
+}
+
+static UaNodeId parseNodeId(const char *s)
+{
+    const char *comma = strchr(s, ',');
+    char *end;
+    if (!comma)
+        return UaNodeId();
+    OpcUa_UInt16 ns = (OpcUa_UInt16) atoi(s);
+    unsigned long num = strtoul(comma + 1, &end, 10);
+    if (*end == 0 && end != comma + 1)
+        return UaNodeId((OpcUa_UInt32) num, ns);
+    return UaNodeId(UaString(comma + 1), ns);
+}
+
+int main(int argc, char *argv[])
+{
+    const char help[] = "opcUaBrowseDb [OPTIONS]\n"
+    "-u URL:    server url\n"
+    "-r NODE:   start node 'ns,identifier' (default: Objects folder 0,85)\n"
+    "-p PREFIX: record name prefix\n"
+    "-o FILE:   output file (default stdout)\n"
+    "-s:        write a substitutions file instead of records\n"
+    "-d DEPTH:  max. browse depth (default unlimited)\n"
+    "-b N:      nodes per Browse/Read request (500)\n"
+    "-j N:      parallel requests (4)\n"
+    "-a N:      NELM of arrays without ArrayDimensions (100)\n"
+    "-v:        verbose\n";
+    const char *url = NULL, *prefix = "", *outFile = NULL;
+    UaNodeId root(OpcUaId_ObjectsFolder);
+    bool substitutions = false;
+    int maxDepth = -1, c, nRecords = 0;
+    epicsUInt32 defaultNelm = 100;
+
+    while ((c = getopt(argc, argv, "hu:r:p:o:sd:b:j:a:v")) != -1) {
+        switch (c) {
+        case 'u': url = optarg; break;
+        case 'r': root = parseNodeId(optarg); break;
+        case 'p': prefix = optarg; break;
+        case 'o': outFile = optarg; break;
+        case 's': substitutions = true; break;
+        case 'd': maxDepth = atoi(optarg); break;
+        case 'b': batchSize = atoi(optarg); break;
+        case 'j': nThreads = atoi(optarg); break;
+        case 'a': defaultNelm = atoi(optarg); break;
+        case 'v': verbose++; break;
+        default:
+            printf("%s", help);
+            return c == 'h' ? 0 : 1;
+        }
+    }
+    if (!url || root.isNull() || batchSize < 1 || nThreads < 1) {
+        printf("%s", help);
+        return 1;
+    }
+
+    UaPlatformLayer::init();
+    DevUaClient *client = new DevUaClient(0, verbose);
+    client->url = url;
+    client->hostName = "localhost";
+    if (client->connect().isBad())
+        return 1;
+    pSession = client->session();
+
+    epicsTime start = epicsTime::getCurrent();
+    std::vector<BrowseNode> level(1);
+    std::vector<BrowseNode> found;
+    std::set<std::string> visited;  // hierarchical references may form loops
+    level[0].id = root;
+    for (int depth = 0; !level.empty() && depth != maxDepth; depth++) {
+        BrowseLevel browse;
+        size_t nJobs = (level.size() + batchSize - 1) / batchSize;
+        std::vector<BrowseNode> next;
+
+        browse.nodes = &level;
+        browse.objects.resize(nJobs);
+        browse.vars.resize(nJobs);
+        runParallel(nJobs, browseBatch, &browse);
+        for (size_t j = 0; j < nJobs; j++) {
+            for (size_t k = 0; k < browse.objects[j].size(); k++) {
+                if (visited.insert(browse.objects[j][k].id.toXmlString().toUtf8()).second)
+                    next.push_back(browse.objects[j][k]);
+            }
+            found.insert(found.end(), browse.vars[j].begin(), browse.vars[j].end());
+        }
+        if (verbose)
+            fprintf(stderr, "level %d: %lu nodes browsed, %lu variables so far\n", depth,
+                    (unsigned long) level.size(), (unsigned long) found.size());
+        level.swap(next);
+    }
+
+    std::vector<VarNode> vars(found.size());
+    for (size_t i = 0; i < found.size(); i++) {
+        vars[i].id        = found[i].id;
+        vars[i].path      = found[i].path;
+        vars[i].dataType  = 0;
+        vars[i].valueRank = -1;
+        vars[i].nelm      = 0;
+        vars[i].access    = 0;
+    }
+    runParallel((vars.size() + batchSize - 1) / batchSize, readBatch, &vars);
+
+    FILE *fp = outFile ? fopen(outFile, "w") : stdout;
+    if (!fp) {
+        perror(outFile);
+        return 1;
+    }
+    fprintf(fp, "# Created by opcUaBrowseDb from %s, start node %s\n\n", url, root.toString().toUtf8());
+    writeRecords(fp, vars, prefix, defaultNelm, substitutions, &nRecords);
+    if (outFile)
+        fclose(fp);
+    fprintf(stderr, "%lu variables, %d records in %.2f s\n", (unsigned long) vars.size(), nRecords,
+            epicsTime::getCurrent() - start);
+
+    client->disconnect();
+    delete client;
+    UaPlatformLayer::cleanup();
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+/* Layout of the shared memory notification ring and the reader API.
+ *
+ * The IOC (writer) appends one slot per data change of the selected items.
+ * Readers poll the ring without any locking: each slot carries a sequence
+ * number that is odd while the writer fills it, so a reader detects torn or
+ * overwritten slots and resynchronizes.
+ *
+ *   | opcUaShmHeader | name table: nItems * OPCUA_SHM_NAMELEN | nSlots * slotSize |
+ *
+ * This header has no dependencies on EPICS or the OPC UA SDK, so it can be
+ * used by plain C consumers.
+ */
+#ifndef __OPCUASHM_H
+#define __OPCUASHM_H
+
+#include <stdint.h>
+
+#define OPCUA_SHM_MAGIC   0x4f505348u  /* "OPSH" */
+#define OPCUA_SHM_VERSION 1
+#define OPCUA_SHM_NAMELEN 64           /* record name incl. terminating 0 */
+
+/* Slot flags */
+#define OPCUA_SHM_FLAG_ARRAY     0x01  /* payload holds array elements */
+#define OPCUA_SHM_FLAG_TRUNCATED 0x02  /* payload was cut to the slot size */
+
+typedef struct opcUaShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nItems;        /* entries in the name table, index = item handle */
+    uint32_t nSlots;        /* number of slots, power of 2 */
+    uint32_t slotSize;      /* bytes per slot incl. opcUaShmSlot */
+    uint32_t dataOffset;    /* file offset of the first slot */
+    volatile uint64_t head; /* number of slots written since setup */
+} opcUaShmHeader;
+
+typedef struct opcUaShmSlot {
+    volatile uint64_t seq;  /* 2*n+1 while slot n is written, 2*n+2 when complete */
+    uint32_t handle;        /* item handle, index into the name table */
+    uint32_t status;        /* OPC UA status code of the notification */
+    uint64_t serverTime;    /* OPC UA DateTime: 100ns since 1601-01-01 */
+    uint64_t sourceTime;
+    uint16_t dataType;      /* OPC UA built-in type id, OpcUaType_xxx */
+    uint16_t flags;         /* OPCUA_SHM_FLAG_xxx */
+    uint32_t length;        /* bytes of raw value data following the slot header */
+} opcUaShmSlot;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Reader API, see opcUaShmReader.c */
+typedef struct opcUaShmReader opcUaShmReader;
+
+opcUaShmReader *opcUaShmOpen(const char *fileName);
+void            opcUaShmClose(opcUaShmReader *reader);
+const char     *opcUaShmItemName(opcUaShmReader *reader, uint32_t handle);
+uint32_t        opcUaShmItemCount(opcUaShmReader *reader);
+/* return 1: slot copied to *slot and data, 0: nothing new, -1: error */
+int             opcUaShmRead(opcUaShmReader *reader, opcUaShmSlot *slot, void *data, uint32_t maxData);
+/* number of slots the reader lost because it was overrun by the writer */
+uint64_t        opcUaShmLost(opcUaShmReader *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef __OPCUASHM_H */
@@ -0,0 +1,125 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+/* Demo consumer of the shared memory notification ring:
+ *
+ *   opcUaShmDump /dev/shm/opcua [record name]
+ *
+ * Prints every notification of all items (or of one record) to stdout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "opcUaShm.h"
+
+#define MAXDATA 65536
+
+/* OPC UA built-in type ids used for printing */
+enum { T_BOOL=1, T_SBYTE, T_BYTE, T_INT16, T_UINT16, T_INT32, T_UINT32,
+       T_INT64, T_UINT64, T_FLOAT, T_DOUBLE, T_STRING, T_DATETIME };
+
+static void printElement(int type, const char *p)
+{
+    switch (type) {
+    case T_BOOL:
+    case T_BYTE:     printf(" %u", *(const uint8_t *) p); break;
+    case T_SBYTE:    printf(" %d", *(const int8_t *) p); break;
+    case T_INT16:    printf(" %d", *(const int16_t *) p); break;
+    case T_UINT16:   printf(" %u", *(const uint16_t *) p); break;
+    case T_INT32:    printf(" %d", *(const int32_t *) p); break;
+    case T_UINT32:   printf(" %u", *(const uint32_t *) p); break;
+    case T_INT64:    printf(" %lld", (long long) *(const int64_t *) p); break;
+    case T_UINT64:
+    case T_DATETIME: printf(" %llu", (unsigned long long) *(const uint64_t *) p); break;
+    case T_FLOAT:    printf(" %g", *(const float *) p); break;
+    case T_DOUBLE:   printf(" %g", *(const double *) p); break;
+    default:         printf(" ?"); break;
+    }
+}
+
+static uint32_t elementSize(int type)
+{
+    switch (type) {
+    case T_BOOL: case T_SBYTE: case T_BYTE:  return 1;
+    case T_INT16: case T_UINT16:             return 2;
+    case T_INT32: case T_UINT32: case T_FLOAT: return 4;
+    case T_INT64: case T_UINT64: case T_DOUBLE: case T_DATETIME: return 8;
+    default:                                 return 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    opcUaShmReader *reader;
+    opcUaShmSlot slot;
+    char *data;
+    const char *filter = NULL;
+    uint64_t lost = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s RING_FILE [RECORD]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2)
+        filter = argv[2];
+
+    reader = opcUaShmOpen(argv[1]);
+    if (!reader)
+        return 1;
+    data = (char *) malloc(MAXDATA + 1);
+    if (!data)
+        return 1;
+
+    printf("%s: %u items\n", argv[1], opcUaShmItemCount(reader));
+    for (;;) {
+        int ret = opcUaShmRead(reader, &slot, data, MAXDATA);
+        if (ret < 0)
+            break;
+        if (ret == 0) {
+            usleep(1000);
+            continue;
+        }
+        if (opcUaShmLost(reader) != lost) {
+            printf("** lost %llu notifications\n", (unsigned long long) (opcUaShmLost(reader) - lost));
+            lost = opcUaShmLost(reader);
+        }
+        if (filter && strcmp(filter, opcUaShmItemName(reader, slot.handle)))
+            continue;
+
+        printf("%-30s %llu stat=%#010x", opcUaShmItemName(reader, slot.handle),
+               (unsigned long long) slot.serverTime, slot.status);
+        if (slot.dataType == T_STRING) {
+            data[slot.length] = 0;
+            printf(" '%s'", data);
+        }
+        else {
+            uint32_t size = elementSize(slot.dataType);
+            uint32_t i;
+            for (i = 0; size && i + size <= slot.length; i += size)
+                printElement(slot.dataType, data + i);
+        }
+        printf("%s\n", (slot.flags & OPCUA_SHM_FLAG_TRUNCATED) ? " (truncated)" : "");
+        fflush(stdout);
+    }
+    opcUaShmClose(reader);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,151 @@
+/*************************************************************************\
+* Copyright (c) 2016 Helmholtz-Zentrum Berlin
+*     fuer Materialien und Energie GmbH (HZB), Berlin, Germany.
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU Lesser General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+\*************************************************************************/
+
+/* Reader side of the shared memory notification ring, see opcUaShm.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "opcUaShm.h"
+
+struct opcUaShmReader {
+    int            fd;
+    size_t         size;
+    char          *base;
+    opcUaShmHeader *hdr;
+    uint64_t       next;    /* number of the next slot to read */
+    uint64_t       lost;
+};
+
+opcUaShmReader *opcUaShmOpen(const char *fileName)
+{
+    struct stat st;
+    opcUaShmReader *reader;
+
+    reader = (opcUaShmReader *) calloc(1, sizeof(opcUaShmReader));
+    if (!reader)
+        return NULL;
+
+    reader->fd = open(fileName, O_RDONLY);
+    if (reader->fd < 0 || fstat(reader->fd, &st) || (size_t) st.st_size < sizeof(opcUaShmHeader)) {
+        fprintf(stderr, "opcUaShmOpen: can't open '%s'\n", fileName);
+        goto fail;
+    }
+    reader->size = (size_t) st.st_size;
+    reader->base = (char *) mmap(NULL, reader->size, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if (reader->base == MAP_FAILED) {
+        fprintf(stderr, "opcUaShmOpen: mmap of '%s' failed\n", fileName);
+        reader->base = NULL;
+        goto fail;
+    }
+    reader->hdr = (opcUaShmHeader *) reader->base;
+    if (reader->hdr->magic != OPCUA_SHM_MAGIC || reader->hdr->version != OPCUA_SHM_VERSION
+            || (size_t) reader->hdr->dataOffset + (size_t) reader->hdr->nSlots * reader->hdr->slotSize > reader->size) {
+        fprintf(stderr, "opcUaShmOpen: '%s' is not a valid notification ring\n", fileName);
+        goto fail;
+    }
+    /* start with the current head, old slots are history */
+    reader->next = reader->hdr->head;
+    return reader;
+
+fail:
+    opcUaShmClose(reader);
+    return NULL;
+}
+
+void opcUaShmClose(opcUaShmReader *reader)
+{
+    if (!reader)
+        return;
+    if (reader->base)
+        munmap(reader->base, reader->size);
+    if (reader->fd >= 0)
+        close(reader->fd);
+    free(reader);
+}
+
+uint32_t opcUaShmItemCount(opcUaShmReader *reader)
+{
+    return reader->hdr->nItems;
+}
+
+const char *opcUaShmItemName(opcUaShmReader *reader, uint32_t handle)
+{
+    if (handle >= reader->hdr->nItems)
+        return "";
+    return reader->base + sizeof(opcUaShmHeader) + (size_t) handle * OPCUA_SHM_NAMELEN;
+}
+
+uint64_t opcUaShmLost(opcUaShmReader *reader)
+{
+    return reader->lost;
+}
+
+int opcUaShmRead(opcUaShmReader *reader, opcUaShmSlot *slot, void *data, uint32_t maxData)
+{
+    const opcUaShmHeader *hdr = reader->hdr;
+    const opcUaShmSlot *pSlot;
+    uint64_t head, seq;
+    uint32_t len;
+
+    for (;;) {
+        head = hdr->head;
+        __sync_synchronize();
+        if (reader->next >= head)
+            return 0;
+        if (head - reader->next > hdr->nSlots) {    /* overrun: skip to the oldest valid slot */
+            reader->lost += head - hdr->nSlots - reader->next;
+            reader->next  = head - hdr->nSlots;
+        }
+        pSlot = (const opcUaShmSlot *) (reader->base + hdr->dataOffset
+                + (size_t) (reader->next & (hdr->nSlots - 1)) * hdr->slotSize);
+
+        seq = pSlot->seq;
+        __sync_synchronize();
+        if (seq != 2 * reader->next + 2) {
+            if (seq < 2 * reader->next + 2)         /* writer still busy with this slot */
+                return 0;
+            reader->lost++;                         /* already overwritten */
+            reader->next++;
+            continue;
+        }
+        memcpy(slot, (const void *) pSlot, sizeof(opcUaShmSlot));
+        len = slot->length;
+        if (len > hdr->slotSize - sizeof(opcUaShmSlot))
+            len = hdr->slotSize - sizeof(opcUaShmSlot);
+        if (len > maxData) {
+            len = maxData;
+            slot->flags |= OPCUA_SHM_FLAG_TRUNCATED;
+        }
+        memcpy(data, (const char *) pSlot + sizeof(opcUaShmSlot), len);
+        slot->length = len;
+        __sync_synchronize();
+        if (pSlot->seq != seq) {                    /* overwritten while copying */
+            reader->lost++;
+            reader->next++;
+            continue;
+        }
+        reader->next++;
+        return 1;
+    }
+}